@@ -0,0 +1,340 @@
+// Batch front end: runs many machines at once on a pool of threads, for
+// regression runs over a set of ROMs and input scripts, and reports the
+// aggregate speed.
+#include "emulator.h"
+#include "input.h"
+#include "utilities.h"
+#include "workpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FRAMES 600
+
+// One ROM, mapped once and shared by every job that runs it
+typedef struct {
+  char *FileName;
+  RomImage *Image;
+} RomFile;
+
+typedef struct {
+  RomFile *Rom;
+  // Frames come from the script when there is one, --frames otherwise
+  InputScript Script;
+  bool HasScript;
+  uint64_t Frames;
+
+  // Results
+  bool Ok;
+  uint64_t Instructions;
+  uint64_t Cycles;
+  uint32_t RamHash;
+} BatchJob;
+
+typedef struct {
+  BatchJob *Jobs;
+  int JobCount;
+  RomFile **Roms;
+  int RomCount;
+} Batch;
+
+void printUsage(char *program) {
+  printf("Usage: %s <jobs> [--threads N] [--repeat N] [--frames N] "
+         "[--scaling] [--quiet]\n",
+         program);
+  printf("Each line of the jobs file is \"<rom> [input script]\". Jobs "
+         "without a script\nrun %d frames unless --frames says otherwise.\n",
+         DEFAULT_FRAMES);
+}
+
+RomFile *findRom(Batch *batch, const char *fileName) {
+  for (int i = 0; i < batch->RomCount; i++) {
+    if (strcmp(batch->Roms[i]->FileName, fileName) == 0) {
+      return batch->Roms[i];
+    }
+  }
+  RomFile **roms =
+      realloc(batch->Roms, (batch->RomCount + 1) * sizeof(RomFile *));
+  if (roms == NULL) {
+    return NULL;
+  }
+  batch->Roms = roms;
+  RomFile *rom = malloc(sizeof(RomFile));
+  if (rom == NULL) {
+    return NULL;
+  }
+  rom->Image = openGame(fileName);
+  if (rom->Image == NULL) {
+    free(rom);
+    return NULL;
+  }
+  rom->FileName = strdup(fileName);
+  batch->Roms[batch->RomCount++] = rom;
+  return rom;
+}
+
+bool addJob(Batch *batch, const char *romName, const char *scriptName,
+            uint64_t frames) {
+  BatchJob job = {0};
+  job.Frames = frames;
+  if (scriptName != NULL) {
+    if (!loadInputScript(scriptName, &job.Script)) {
+      return false;
+    }
+    job.HasScript = true;
+    job.Frames = job.Script.FrameCount;
+  }
+  RomFile *rom = findRom(batch, romName);
+  BatchJob *jobs =
+      realloc(batch->Jobs, (batch->JobCount + 1) * sizeof(BatchJob));
+  if (jobs == NULL || rom == NULL) {
+    if (jobs != NULL) {
+      batch->Jobs = jobs;
+    }
+    freeInputScript(&job.Script);
+    return false;
+  }
+  job.Rom = rom;
+  batch->Jobs = jobs;
+  batch->Jobs[batch->JobCount++] = job;
+  return true;
+}
+
+bool readJobFile(Batch *batch, const char *fileName, uint64_t frames) {
+  FILE *file = fopen(fileName, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open %s\n", fileName);
+    return false;
+  }
+  char line[1024];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    char romName[512];
+    char scriptName[512];
+    char *text = line + strspn(line, " \t");
+    if (*text == '#' || *text == '\n' || *text == '\0') {
+      continue;
+    }
+    int fields = sscanf(text, "%511s %511s", romName, scriptName);
+    ok = addJob(batch, romName, fields == 2 ? scriptName : NULL, frames);
+  }
+  fclose(file);
+  return ok;
+}
+
+// Copies the first jobCount jobs until there are jobCount * repeat of them.
+// Scripts are shared between the copies.
+bool repeatJobs(Batch *batch, int repeat) {
+  int jobCount = batch->JobCount;
+  BatchJob *jobs = realloc(batch->Jobs, (size_t)jobCount * repeat *
+                                            sizeof(BatchJob));
+  if (jobs == NULL) {
+    return false;
+  }
+  for (int i = jobCount; i < jobCount * repeat; i++) {
+    jobs[i] = jobs[i % jobCount];
+  }
+  batch->Jobs = jobs;
+  batch->JobCount = jobCount * repeat;
+  return true;
+}
+
+// Runs on a pool thread. Every job has its own machine, so jobs share
+// nothing but the read-only ROM and script.
+void runJob(void *context, int index) {
+  BatchJob *job = &((Batch *)context)->Jobs[index];
+  NesMachine *machine = nesMachineCreateFromImage(job->Rom->Image);
+  job->Ok = machine != NULL;
+  if (machine == NULL) {
+    return;
+  }
+  CPU *cpu = nesMachineGetCpu(machine);
+  uint64_t startCycles = cpu->Cycles;
+  job->Instructions = 0;
+  for (uint64_t frame = 0; frame < job->Frames; frame++) {
+    if (job->HasScript) {
+      nesMachineSetButtons(machine, 0, job->Script.Buttons[frame]);
+    }
+    job->Instructions += nesMachineRunFrames(machine, 1);
+  }
+  job->Cycles = cpu->Cycles - startCycles;
+  job->RamHash = hashBytes(cpu->Ram, sizeof(cpu->Ram));
+  nesMachineDestroy(machine);
+}
+
+// Runs the whole batch and returns the wall time, or a negative value if the
+// threads could not be started
+double runBatch(Batch *batch, int threads, uint64_t *steals) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!runWorkStealing(batch->JobCount, threads, runJob, batch, steals)) {
+    return -1;
+  }
+  return secondsSince(&start);
+}
+
+uint64_t countFrames(Batch *batch) {
+  uint64_t frames = 0;
+  for (int i = 0; i < batch->JobCount; i++) {
+    frames += batch->Jobs[i].Frames;
+  }
+  return frames;
+}
+
+void printResults(Batch *batch) {
+  printf("%6s %-24s %8s %12s %12s %8s\n", "Job", "ROM", "Frames",
+         "Instructions", "Cycles", "RAM");
+  for (int i = 0; i < batch->JobCount; i++) {
+    BatchJob *job = &batch->Jobs[i];
+    if (!job->Ok) {
+      printf("%6d %-24s out of memory\n", i, job->Rom->FileName);
+      continue;
+    }
+    printf("%6d %-24s %8llu %12llu %12llu %08x\n", i, job->Rom->FileName,
+           (unsigned long long)job->Frames,
+           (unsigned long long)job->Instructions,
+           (unsigned long long)job->Cycles, job->RamHash);
+  }
+}
+
+// Runs the batch with 1 thread, then doubling up to the number of cores
+// (and the core count itself), checking every run ends like the first.
+int runScaling(Batch *batch, int cores) {
+  uint64_t frames = countFrames(batch);
+  uint32_t *hashes = malloc(batch->JobCount * sizeof(uint32_t));
+  if (hashes == NULL) {
+    return 1;
+  }
+  printf("%7s %12s %9s %10s %7s\n", "Threads", "Frames/s", "Speedup",
+         "Efficiency", "Steals");
+  double baseline = 0;
+  int status = 0;
+  for (int threads = 1; threads <= cores;
+       threads = threads * 2 > cores && threads < cores ? cores
+                                                        : threads * 2) {
+    uint64_t steals;
+    double seconds = runBatch(batch, threads, &steals);
+    if (seconds < 0) {
+      status = 1;
+      break;
+    }
+    double framesPerSecond = frames / seconds;
+    if (threads == 1) {
+      baseline = framesPerSecond;
+    }
+    printf("%7d %12.0f %8.2fx %9.0f%% %7llu\n", threads, framesPerSecond,
+           framesPerSecond / baseline,
+           100 * framesPerSecond / baseline / threads,
+           (unsigned long long)steals);
+    for (int i = 0; i < batch->JobCount; i++) {
+      if (threads == 1) {
+        hashes[i] = batch->Jobs[i].RamHash;
+      } else if (hashes[i] != batch->Jobs[i].RamHash) {
+        printf("Job %d ended differently with %d threads\n", i, threads);
+        status = 1;
+      }
+    }
+  }
+  free(hashes);
+  return status;
+}
+
+void freeBatch(Batch *batch, int scriptedJobs) {
+  // Repeated jobs share the scripts of the first ones
+  for (int i = 0; i < scriptedJobs; i++) {
+    freeInputScript(&batch->Jobs[i].Script);
+  }
+  for (int i = 0; i < batch->RomCount; i++) {
+    free(batch->Roms[i]->FileName);
+    romImageRelease(batch->Roms[i]->Image);
+    free(batch->Roms[i]);
+  }
+  free(batch->Jobs);
+  free(batch->Roms);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1) {
+    cores = 1;
+  }
+  int threads = cores;
+  int repeat = 1;
+  uint64_t frames = DEFAULT_FRAMES;
+  bool scaling = false;
+  bool quiet = false;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--scaling") == 0) {
+      scaling = true;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (threads < 1 || repeat < 1) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  Batch batch = {0};
+  bool ok = readJobFile(&batch, argv[1], frames);
+  int fileJobs = batch.JobCount;
+  if (ok && batch.JobCount == 0) {
+    fprintf(stderr, "%s has no jobs\n", argv[1]);
+    ok = false;
+  }
+  if (!ok || !repeatJobs(&batch, repeat)) {
+    freeBatch(&batch, fileJobs);
+    return 1;
+  }
+
+  int status = 0;
+  if (scaling) {
+    printf("\n%d jobs, %d cores\n", batch.JobCount, cores);
+    status = runScaling(&batch, cores);
+  } else {
+    uint64_t steals;
+    double seconds = runBatch(&batch, threads, &steals);
+    if (seconds < 0) {
+      status = 1;
+    } else {
+      if (!quiet) {
+        printf("\n");
+        printResults(&batch);
+      }
+      uint64_t totalFrames = countFrames(&batch);
+      printf("\n");
+      printf("Jobs: %d on %d threads (%llu steals)\n", batch.JobCount,
+             threads, (unsigned long long)steals);
+      printf("Frames: %llu\n", (unsigned long long)totalFrames);
+      printf("Wall time: %.3f s\n", seconds);
+      printf("Frames per second: %.0f (%.0f per thread)\n",
+             totalFrames / seconds, totalFrames / seconds / threads);
+      printf("Speed: %.2fx real time\n",
+             totalFrames / seconds / (2.0 * NTSC_CPU_CLOCK_HZ /
+                                      NTSC_HALF_CYCLES_PER_FRAME));
+    }
+  }
+  for (int i = 0; i < batch.JobCount; i++) {
+    if (!batch.Jobs[i].Ok) {
+      status = 1;
+    }
+  }
+  freeBatch(&batch, fileJobs);
+  return status;
+}
@@ -0,0 +1,75 @@
+// Storage of the decoded block cache. Decoding is in cpu.c, next to the
+// tables and handlers it needs. Only built when NES_BLOCK_CACHE is enabled.
+#include "block.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The first chunk comes with the cache, so there is always one to go back to
+BlockCache *blockCacheCreate(void) {
+  BlockCache *cache = calloc(1, sizeof(BlockCache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->Chunks[0] = malloc(BLOCK_CHUNK_SIZE * sizeof(Block));
+  if (cache->Chunks[0] == NULL) {
+    free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void blockCacheDestroy(BlockCache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  for (int chunk = 0; chunk < BLOCK_CHUNK_COUNT; chunk++) {
+    free(cache->Chunks[chunk]);
+  }
+  free(cache);
+}
+
+// Only the used entries of the index are cleared, not all 128KiB of it. The
+// chunks are kept for the blocks that replace them.
+static void flush(BlockCache *cache) {
+  for (uint32_t i = 0; i < cache->Used; i++) {
+    cache->Index[blockCacheGet(cache, i)->Start] = 0;
+  }
+  cache->Used = 0;
+}
+
+void blockCacheMap(BlockCache *cache, const CPU *cpu) {
+  // Loading a state maps the same pages again, which keeps the blocks
+  if (memcmp(cache->ReadPages, cpu->ReadPages, sizeof(cache->ReadPages)) ==
+          0 &&
+      memcmp(cache->WritePages, cpu->WritePages, sizeof(cache->WritePages)) ==
+          0) {
+    return;
+  }
+  flush(cache);
+  memcpy(cache->ReadPages, cpu->ReadPages, sizeof(cache->ReadPages));
+  memcpy(cache->WritePages, cpu->WritePages, sizeof(cache->WritePages));
+}
+
+Block *blockCacheAllocate(BlockCache *cache, uint16_t pc) {
+  if (cache->Used == BLOCK_CACHE_CAPACITY) {
+    flush(cache);
+  }
+  Block **chunk = &cache->Chunks[cache->Used >> BLOCK_CHUNK_SHIFT];
+  if (*chunk == NULL) {
+    *chunk = malloc(BLOCK_CHUNK_SIZE * sizeof(Block));
+  }
+  // Out of memory, the blocks there are make room instead
+  if (*chunk == NULL) {
+    flush(cache);
+  }
+  Block *block = blockCacheGet(cache, cache->Used++);
+  cache->Index[pc] = cache->Used;
+  block->Start = pc;
+  block->Instructions = 0;
+  block->Cycles = 0;
+#ifdef NES_JIT
+  block->Runs = 0;
+  block->Untranslatable = false;
+#endif
+  return block;
+}
@@ -0,0 +1,93 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "cpu.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decoded basic blocks (cmake -DNES_BLOCK_CACHE=ON). The code in ROM is
+// decoded once into runs of straight-line instructions that end at a
+// branch, jump, return or BRK, each with the address of its handler in run(),
+// its operand already read and the cycles it takes without penalties. A few
+// common pairs and triples are fused into one entry. run() then goes through
+// a block with no decoding, fetching or bounds checks between instructions.
+//
+// Only code in pages that are mapped for reading but not for writing, which
+// is ROM, is decoded, so nothing the CPU writes can make a block stale. Code
+// in RAM is left to the interpreter. The cache is dropped when the memory
+// map changes.
+
+#define BLOCK_MAX_INSTRUCTIONS 16
+// No instruction takes more than 7 cycles, plus 1 for crossing a page
+#define BLOCK_MAX_CYCLES (BLOCK_MAX_INSTRUCTIONS * 8)
+#define BLOCK_CACHE_CAPACITY 4096
+// Blocks are allocated a chunk at a time as the game reaches new code, so a
+// machine only pays for the blocks its game needs
+#define BLOCK_CHUNK_SHIFT 8
+#define BLOCK_CHUNK_SIZE (1 << BLOCK_CHUNK_SHIFT)
+#define BLOCK_CHUNK_COUNT (BLOCK_CACHE_CAPACITY / BLOCK_CHUNK_SIZE)
+#define BLOCK_ADDRESSES 0x10000
+
+typedef struct {
+  // Label in run() that executes the entry
+  const void *Handler;
+  uint16_t Operand;
+  // Where a branch goes, or the operand of the second instruction of a fused
+  // load and store
+  uint16_t Target;
+  // The address after the entry
+  uint16_t Next;
+  // Extra cycles when the branch is taken, page crossing included
+  uint8_t TakenCycles;
+} BlockEntry;
+
+typedef struct {
+  uint16_t Start;
+  // Instructions in the block, counting each one of a fused entry
+  uint8_t Instructions;
+  // Base cycles of all of them
+  uint16_t Cycles;
+#ifdef NES_JIT
+  // Times the block was run, to find the hot ones
+  uint32_t Runs;
+  // Set when the JIT couldn't translate it, so it isn't asked again
+  bool Untranslatable;
+#endif
+  // A block that doesn't end in a jump ends in an entry that sets PC to
+  // where it stopped
+  BlockEntry Code[BLOCK_MAX_INSTRUCTIONS + 1];
+} Block;
+
+struct BlockCache {
+  // Block number + 1 by start address, 0 when not decoded
+  uint16_t Index[BLOCK_ADDRESSES];
+  uint32_t Used;
+  // Block n is in chunk n >> BLOCK_CHUNK_SHIFT. A chunk is allocated when
+  // the first of its blocks is, and never moves.
+  Block *Chunks[BLOCK_CHUNK_COUNT];
+  // The memory map the blocks were decoded from
+  uint8_t *ReadPages[BUS_PAGE_COUNT];
+  uint8_t *WritePages[BUS_PAGE_COUNT];
+};
+
+#ifdef NES_BLOCK_CACHE
+
+BlockCache *blockCacheCreate(void);
+void blockCacheDestroy(BlockCache *cache);
+// Drops every block if the CPU's memory map isn't the one they came from
+void blockCacheMap(BlockCache *cache, const CPU *cpu);
+// A fresh block at pc, emptying the cache when it is full or out of memory
+Block *blockCacheAllocate(BlockCache *cache, uint16_t pc);
+
+static inline Block *blockCacheGet(const BlockCache *cache, uint32_t n) {
+  return &cache->Chunks[n >> BLOCK_CHUNK_SHIFT][n & (BLOCK_CHUNK_SIZE - 1)];
+}
+
+static inline Block *blockCacheFind(BlockCache *cache, uint16_t pc) {
+  uint16_t index = cache->Index[pc];
+  return index == 0 ? NULL : blockCacheGet(cache, index - 1);
+}
+
+#endif
+
+#endif
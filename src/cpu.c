@@ -1,2342 +1,1839 @@
 // 6502 Processor CPU (based on the 6502 CPU).
 #include "cpu.h"
+#include "block.h"
+#include "jit.h"
+#include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #define NUMBER_OF_INSTRUCTIONS 256
 
-// Global variables
-
-typedef struct {
-  void (*execute)(CPU *cpu);
-  char name[20];
-} Instruction;
-
-Instruction instructions[NUMBER_OF_INSTRUCTIONS] = {};
-
+// Operations and addressing modes are written as small functions and then
+// expanded into every opcode that uses them, see OPCODE_TABLE. Force them
+// inline so that each opcode ends up as one piece of straight-line code.
+#if defined(__GNUC__)
+#define INLINE static inline __attribute__((always_inline))
+#else
+#define INLINE static inline
+#endif
+
+// Power-on state. resetProcessor still has to run before the first
+// instruction.
 void initProcessor(CPU *cpu) {
   cpu->A = 0;
   cpu->X = 0;
   cpu->Y = 0;
-  cpu->P = 0;
-  cpu->S = 0xFF;
+  setProcessorStatus(cpu, 0x24);
+  cpu->S = 0x00;
   cpu->PC = 0xFFFC;
-  // The stack lives in addresses 0x0100 to 0x01FF
-  for (int i = 0x0100; i < 0x01FF; i++) {
-    cpu->Memory[i] = 0;
+  cpu->Cycles = 0;
+  cpu->PpuControl = 0;
+  cpu->PpuStatus = 0;
+  cpu->ControllerStrobe = 0;
+  for (int port = 0; port < 2; port++) {
+    cpu->Buttons[port] = 0;
+    cpu->ControllerShift[port] = 0;
   }
+  memset(cpu->Ram, 0, sizeof(cpu->Ram));
 }
 
-void pushStack(CPU *cpu, uint8_t value) {
-  if (cpu->S < 0x00) {
-    printf("ERROR; Stack overflow detected!\n");
-  }
-  cpu->Memory[cpu->S + 0x0100] = value;
+// S wraps around inside page 1 instead of overflowing
+INLINE void pushStack(CPU *cpu, uint8_t value) {
+  cpu->Ram[0x0100 + cpu->S] = value;
   cpu->S--;
 }
 
-uint8_t getStackPointerValue(CPU *cpu) { return cpu->Memory[cpu->S]; }
+uint8_t getStackPointerValue(CPU *cpu) { return cpu->Ram[cpu->S]; }
 
-uint8_t getCurrentInstruction(CPU *cpu) {
-  uint8_t currentInstruction = cpu->Memory[cpu->PC];
-  printf("Returned current instruction \"%u\".", currentInstruction);
-  return currentInstruction;
+INLINE uint8_t popStack(CPU *cpu) {
+  cpu->S++;
+  return cpu->Ram[0x0100 + cpu->S];
+}
+
+// Points the size bytes of the address space starting at address at memory.
+// Both must be multiples of BUS_PAGE_SIZE. Bank switching is just another
+// call to this.
+static void mapPages(uint8_t **pages, uint16_t address, uint32_t size,
+                     uint8_t *memory) {
+  int firstPage = address >> BUS_PAGE_SHIFT;
+  int pageCount = size >> BUS_PAGE_SHIFT;
+  for (int i = 0; i < pageCount; i++) {
+    pages[firstPage + i] = memory == NULL ? NULL : memory + i * BUS_PAGE_SIZE;
+  }
 }
 
-uint8_t popStack(CPU *cpu) {
-  if (cpu->S == 0xFF) {
-    printf("ERROR: Stack underflow detected!\n");
+// Standard controllers on $4016 and $4017. While the strobe bit is set the
+// shift registers keep reloading the buttons; once it is cleared every read
+// shifts out the next one, A first and Right last, then 1s.
+static uint8_t readController(CPU *cpu, int port) {
+  if (cpu->ControllerStrobe) {
+    cpu->ControllerShift[port] = cpu->Buttons[port];
+  }
+  uint8_t bit = cpu->ControllerShift[port] & 0x01;
+  cpu->ControllerShift[port] = cpu->ControllerShift[port] >> 1 | 0x80;
+  // The upper bits are open bus, which holds $40 from the address
+  return 0x40 | bit;
+}
+
+// Handles every page that has no memory behind it: the PPU registers
+// ($2000-$3FFF, mirrored every 8 bytes), the APU and I/O registers
+// ($4000-$401F) and the expansion area up to $5FFF. Only PPUSTATUS and the
+// controllers are emulated, everything else reads as open bus, which mostly
+// holds the high byte of the address.
+static uint8_t readBusIo(CPU *cpu, uint16_t address) {
+  if (address < 0x4000 && (address & 0x0007) == 0x0002) {
+    // Reading PPUSTATUS acknowledges the vblank flag
+    uint8_t status = cpu->PpuStatus;
+    cpu->PpuStatus &= 0x7F;
+    return status;
+  }
+  if (address == 0x4016 || address == 0x4017) {
+    return readController(cpu, address - 0x4016);
+  }
+  return address >> 8;
+}
+
+static void writeBusIo(CPU *cpu, uint16_t address, uint8_t value) {
+  if (address < 0x4000 && (address & 0x0007) == 0x0000) {
+    cpu->PpuControl = value;
+  } else if (address == 0x4016) {
+    cpu->ControllerStrobe = value & 0x01;
+    if (cpu->ControllerStrobe) {
+      cpu->ControllerShift[0] = cpu->Buttons[0];
+      cpu->ControllerShift[1] = cpu->Buttons[1];
+    }
   }
-  cpu->S++;
-  return cpu->Memory[(cpu->S - 1) + 0x0100];
 }
 
-uint8_t readBusMapperZero(CPU *cpu, uint16_t address) {
-  // For NROM Mapper
-  // CPU $6000-$7FFF
-  // CPU $8000-$BFFF First 16KB of ROM
-  // CPU $C000-$FFFF Last 16KB of ROM
-
-  // Get it from zero-page memory.
-  if (address >= 0x00 && address <= 0x00FF) {
+// NROM has no registers, so writes to ROM are simply ignored.
+static void writeBusMapperZero(CPU *cpu, uint16_t address, uint8_t value) {
+  if (address < 0x6000) {
+    writeBusIo(cpu, address, value);
   }
+}
 
-  // Get it from the stack.
-  if (address >= 0x0100 && address <= 0x01FF) {
-    return popStack(cpu);
+static void mapMapperZero(CPU *cpu) {
+  // For NROM Mapper
+  // CPU $6000-$7FFF PRG RAM
+  // CPU $8000-$FFFF The first 32KiB of ROM. 8KiB or 16KiB of ROM is mirrored
+  // to fill the space.
+  // ROM only ever goes into ReadPages, so dropping const is safe; the image
+  // may well be mapped read-only.
+  uint8_t *prgRom = (uint8_t *)cpu->PrgRom;
+  // checkRom only lets through whole 8KiB banks
+  uint32_t prgSize = cpu->PrgRomSize < 0x8000 ? cpu->PrgRomSize : 0x8000;
+
+  for (int page = 0; page < BUS_PAGE_COUNT; page++) {
+    cpu->ReadPages[page] = NULL;
+    cpu->WritePages[page] = NULL;
   }
-
-  if (address >= 0x8000 && address <= 0xBFFF) {
-    // Subtract 0xC000 for mapping, and add 0x0010 for header
-    uint16_t gameAddress = address - 0xBFF0;
-    return cpu->GameData[gameAddress];
+  // 2KiB of RAM, mirrored 3 times till 0x1FFF
+  for (int mirror = 0; mirror < 4; mirror++) {
+    mapPages(cpu->ReadPages, mirror * NES_RAM_SIZE, NES_RAM_SIZE, cpu->Ram);
+    mapPages(cpu->WritePages, mirror * NES_RAM_SIZE, NES_RAM_SIZE, cpu->Ram);
   }
-
-  if (address >= 0xC000 && address <= 0xFFFF) {
-    // printf("Address value: 0x%02x\n", address);
-    uint16_t gameAddress = address - 0xBFF0;
-    // printf("Game address value: 0x%02x\n", gameAddress);
-    return cpu->GameData[gameAddress];
+  // Without PRG RAM these pages stay NULL and read as open bus
+  mapPages(cpu->ReadPages, 0x6000, PRG_RAM_SIZE, cpu->PrgRam);
+  mapPages(cpu->WritePages, 0x6000, PRG_RAM_SIZE, cpu->PrgRam);
+  for (uint32_t offset = 0; offset < 0x8000; offset += BUS_PAGE_SIZE) {
+    mapPages(cpu->ReadPages, 0x8000 + offset, BUS_PAGE_SIZE,
+             prgRom + offset % prgSize);
   }
-
-  printf("ERROR: Invalid bus address was accessed!\n");
-  return -1;
+  cpu->ReadBus = readBusIo;
+  cpu->WriteBus = writeBusMapperZero;
 }
 
-uint8_t readBus(CPU *cpu, uint16_t address) {
+// RAM and ROM are read straight through the page table, only pages without
+// memory behind them go through the ReadBus callback.
+INLINE uint8_t readBus(CPU *cpu, uint16_t address) {
+  uint8_t *page = cpu->ReadPages[address >> BUS_PAGE_SHIFT];
+  if (page != NULL) {
+    return page[address & (BUS_PAGE_SIZE - 1)];
+  }
   return cpu->ReadBus(cpu, address);
 }
 
-void setAndPrintMapper(CPU *cpu, uint8_t mapperNumber) {
-  switch (mapperNumber) {
-  case 0:
-    printf("NROM Mapper recognized!\n");
-    cpu->ReadBus = readBusMapperZero;
-    break;
-  case 4:
-    printf("Nintendo MMC3 Mapper recognized!\n");
-    break;
-  default:
-    printf("Unrecognized mapper.\n");
+// Reads code to analyze it, from the page table only so that it never has
+// side effects. Never calling ReadBus also lets the compiler see that the
+// branches that call the idle loop detector don't change PC, instead of
+// reloading it after every one. A page without memory reads as BRK.
+INLINE uint8_t readCode(const CPU *cpu, uint16_t address) {
+  const uint8_t *page = cpu->ReadPages[address >> BUS_PAGE_SHIFT];
+  return page == NULL ? 0x00 : page[address & (BUS_PAGE_SIZE - 1)];
+}
+
+// For display, so it doesn't touch I/O either
+uint8_t getCurrentInstruction(CPU *cpu) { return readCode(cpu, cpu->PC); }
+
+// Stores go through the page table the same way: RAM is written directly,
+// everything else (I/O and mapper registers, ROM) goes to the WriteBus
+// callback.
+INLINE void writeBus(CPU *cpu, uint16_t address, uint8_t value) {
+  uint8_t *page = cpu->WritePages[address >> BUS_PAGE_SHIFT];
+  if (page != NULL) {
+    page[address & (BUS_PAGE_SIZE - 1)] = value;
+    return;
   }
+  cpu->WriteBus(cpu, address, value);
+}
+
+void setMapper(CPU *cpu, uint16_t mapperNumber) {
+  cpu->MapperType = mapperNumber;
+#ifdef NES_IDLE_SKIP
+  // A new mapping may put other code where the last loop was
+  memset(&cpu->Idle, 0, sizeof(cpu->Idle));
+#endif
+  // Only NROM is implemented. Other mappers get its layout, which at least
+  // lets the code in their fixed bank start up.
+  mapMapperZero(cpu);
+#ifdef NES_BLOCK_CACHE
+  if (cpu->Blocks != NULL) {
+    blockCacheMap(cpu->Blocks, cpu);
+  }
+#endif
+#ifdef NES_JIT
+  if (cpu->Jit != NULL) {
+    jitCacheMap(cpu->Jit, cpu);
+  }
+#endif
+}
+
+// The state is struct CPU as it is in memory, with the fields that point
+// into the host process (callbacks, page tables, ROM, PRG RAM, the block
+// cache, the JIT, the tracer and the profiler) zeroed so identical states give
+// identical bytes. The page tables are rebuilt from the mapper state on load
+// instead. So is the idle loop detector, which only changes how fast the CPU
+// gets somewhere.
+void saveProcessorState(const CPU *cpu, uint8_t *state) {
+  memcpy(state, cpu, sizeof(CPU));
+  memset(state + offsetof(CPU, ReadBus), 0,
+         offsetof(CPU, MapperType) - offsetof(CPU, ReadBus));
+#ifdef NES_IDLE_SKIP
+  memset(state + offsetof(CPU, Idle), 0, sizeof(cpu->Idle));
+#endif
+#ifdef NES_BLOCK_CACHE
+  memset(state + offsetof(CPU, Blocks), 0, sizeof(cpu->Blocks));
+#endif
+#ifdef NES_JIT
+  memset(state + offsetof(CPU, Jit), 0, sizeof(cpu->Jit));
+#endif
+#ifdef NES_TRACE
+  memset(state + offsetof(CPU, Tracer), 0, sizeof(cpu->Tracer));
+#endif
+#ifdef NES_PROFILE
+  memset(state + offsetof(CPU, Profiler), 0, sizeof(cpu->Profiler));
+  memset(state + offsetof(CPU, Calls), 0, sizeof(cpu->Calls));
+#endif
+}
+
+void loadProcessorState(CPU *cpu, const uint8_t *state) {
+  const uint8_t *prgRom = cpu->PrgRom;
+  uint64_t prgRomSize = cpu->PrgRomSize;
+  uint8_t *prgRam = cpu->PrgRam;
+#ifdef NES_BLOCK_CACHE
+  BlockCache *blocks = cpu->Blocks;
+#endif
+#ifdef NES_JIT
+  JitCache *jit = cpu->Jit;
+#endif
+#ifdef NES_TRACE
+  Trace *tracer = cpu->Tracer;
+#endif
+#ifdef NES_PROFILE
+  Profile *profiler = cpu->Profiler;
+  CallStack *calls = cpu->Calls;
+#endif
+  memcpy(cpu, state, sizeof(CPU));
+  cpu->PrgRom = prgRom;
+  cpu->PrgRomSize = prgRomSize;
+  cpu->PrgRam = prgRam;
+#ifdef NES_BLOCK_CACHE
+  cpu->Blocks = blocks;
+#endif
+#ifdef NES_JIT
+  cpu->Jit = jit;
+#endif
+#ifdef NES_TRACE
+  cpu->Tracer = tracer;
+#endif
+#ifdef NES_PROFILE
+  cpu->Profiler = profiler;
+  cpu->Calls = calls;
+#endif
+  setMapper(cpu, cpu->MapperType);
 }
 
 // Fetches instruction from memory at PC location, and increments PC
-uint8_t fetchInstructionByte(CPU *cpu) {
+INLINE uint8_t fetchInstructionByte(CPU *cpu) {
   uint8_t instruction = readBus(cpu, cpu->PC);
-  printf("\n Fetched: 0x%02x ", instruction);
   cpu->PC++;
   return instruction;
 }
 
-uint8_t fetchImmediate(CPU *cpu) { return fetchInstructionByte(cpu); }
-
-uint16_t fetchAbsoluteAddress(CPU *cpu) {
+INLINE uint16_t fetchInstructionWord(CPU *cpu) {
   uint8_t ll = fetchInstructionByte(cpu);
   uint8_t hh = fetchInstructionByte(cpu);
   return (uint16_t)hh << 8 | ll;
 }
 
-uint8_t fetchAbsolute(CPU *cpu) {
-  uint16_t address = fetchAbsoluteAddress(cpu);
-  return readBus(cpu, address);
+// Addressing modes. The interpreter reads the operand bytes after the opcode
+// with FETCH_<Mode>. From the operand, address<Mode> works out the effective
+// address and read<Mode> also reads the value at it; the block cache decodes
+// operands once and only does that second step.
+#define FETCH_Immediate fetchInstructionByte
+#define FETCH_ZeroPage fetchInstructionByte
+#define FETCH_ZeroPageX fetchInstructionByte
+#define FETCH_ZeroPageY fetchInstructionByte
+#define FETCH_Absolute fetchInstructionWord
+#define FETCH_AbsoluteX fetchInstructionWord
+#define FETCH_AbsoluteY fetchInstructionWord
+#define FETCH_Indirect fetchInstructionWord
+#define FETCH_IndirectX fetchInstructionByte
+#define FETCH_IndirectY fetchInstructionByte
+
+// Indexed reads take one extra cycle when the index carries into the high
+// byte of the address. Writes and read-modify-write instructions always pay
+// for it, so their base cycle count already includes it.
+INLINE void addPageCrossPenalty(CPU *cpu, uint16_t address,
+                                uint16_t effectiveAddress) {
+  if ((address & 0xFF00) != (effectiveAddress & 0xFF00)) {
+    cpu->Cycles++;
+  }
 }
 
-uint16_t fetchZeroPageAddress(CPU *cpu) {
-  uint8_t result = readBus(cpu, cpu->PC);
-  return result;
+INLINE uint8_t readImmediate(CPU *cpu, uint16_t operand) {
+  (void)cpu;
+  return operand;
 }
 
-uint8_t fetchZeroPage(CPU *cpu) {
-  // Instruction is a ZeroPage memory address
-  uint16_t instruction = fetchZeroPageAddress(cpu);
-  return readBus(cpu, instruction);
+INLINE uint16_t addressZeroPage(CPU *cpu, uint16_t operand) {
+  (void)cpu;
+  return operand;
 }
 
-uint8_t fetchAbsoluteX(CPU *cpu) {
-  uint8_t ll = fetchInstructionByte(cpu);
-  uint8_t hh = fetchInstructionByte(cpu);
-  uint16_t address = (uint16_t)hh << 8 | ll;
-  uint16_t effectiveAddress = address + cpu->X;
-  return readBus(cpu, address);
+INLINE uint8_t readZeroPage(CPU *cpu, uint16_t operand) {
+  return readBus(cpu, addressZeroPage(cpu, operand));
 }
 
-uint8_t fetchAbsoluteY(CPU *cpu) {
-  uint8_t ll = fetchInstructionByte(cpu);
-  uint8_t hh = fetchInstructionByte(cpu);
-  uint16_t address = (uint16_t)hh << 8 | ll;
-  uint16_t effectiveAddress = address + cpu->Y;
-  return readBus(cpu, address);
+// Zero page indexing wraps around inside the zero page
+INLINE uint16_t addressZeroPageX(CPU *cpu, uint16_t operand) {
+  return (uint8_t)(operand + cpu->X);
 }
 
-uint8_t fetchZeroPageX(CPU *cpu) {
-  uint8_t instruction = readBus(cpu, cpu->PC);
-  uint16_t effectiveAddress = instruction + cpu->X;
-  return readBus(cpu, (uint16_t)instruction);
+INLINE uint8_t readZeroPageX(CPU *cpu, uint16_t operand) {
+  return readBus(cpu, addressZeroPageX(cpu, operand));
 }
 
-uint8_t fetchZeroPageY(CPU *cpu) {
-  uint8_t instruction = readBus(cpu, cpu->PC);
-  uint16_t effectiveAddress = instruction + cpu->X;
-  return readBus(cpu, (uint16_t)instruction);
+INLINE uint16_t addressZeroPageY(CPU *cpu, uint16_t operand) {
+  return (uint8_t)(operand + cpu->Y);
 }
 
-uint16_t fetchIndirectAddress(CPU *cpu) {
-  uint8_t ll = fetchInstructionByte(cpu);
-  uint8_t hh = fetchInstructionByte(cpu);
-  uint16_t instructionAddress = (uint16_t)hh << 8 | ll;
-  uint8_t llIndirect = readBus(cpu, instructionAddress);
-  uint8_t hhIndirect = readBus(cpu, instructionAddress + 1);
-  return (uint16_t)hhIndirect << 8 | llIndirect;
+INLINE uint8_t readZeroPageY(CPU *cpu, uint16_t operand) {
+  return readBus(cpu, addressZeroPageY(cpu, operand));
 }
 
-uint16_t fetchPreIndexedIndirectXAddress(CPU *cpu) {
-  uint8_t instructionAddress = fetchInstructionByte(cpu);
-  uint8_t indexedAddress = instructionAddress + cpu->X;
-  uint8_t ll = readBus(cpu, indexedAddress);
-  uint8_t hh = readBus(cpu, indexedAddress + 1);
-  return (uint16_t)hh << 8 | ll;
+INLINE uint16_t addressAbsolute(CPU *cpu, uint16_t operand) {
+  (void)cpu;
+  return operand;
 }
 
-uint8_t fetchPreIndexedIndirectX(CPU *cpu) {
-  uint16_t effectiveAddress = fetchPreIndexedIndirectXAddress(cpu);
-  return readBus(cpu, effectiveAddress);
+INLINE uint8_t readAbsolute(CPU *cpu, uint16_t operand) {
+  return readBus(cpu, operand);
 }
 
-uint16_t fetchPostIndexedIndirectYAddress(CPU *cpu) {
-  uint16_t instructionAddress = fetchInstructionByte(cpu);
-  uint8_t ll = readBus(cpu, instructionAddress);
-  uint8_t hh = readBus(cpu, instructionAddress);
-  uint16_t lookupAddress = (uint16_t)hh << 8 | ll;
-  return lookupAddress + cpu->Y;
+INLINE uint16_t addressAbsoluteX(CPU *cpu, uint16_t operand) {
+  return operand + cpu->X;
 }
 
-uint8_t fetchPostIndexedIndirectY(CPU *cpu) {
-  uint16_t effectiveAddress = fetchPostIndexedIndirectYAddress(cpu);
+INLINE uint8_t readAbsoluteX(CPU *cpu, uint16_t operand) {
+  uint16_t effectiveAddress = operand + cpu->X;
+  addPageCrossPenalty(cpu, operand, effectiveAddress);
   return readBus(cpu, effectiveAddress);
 }
 
-// Sets the Zero Flag to 1 in the Status Register if result is zero.
-void setZeroFlagIfZero(CPU *cpu, uint8_t result) {
-  if (result == 0) {
-    cpu->P = cpu->P | 0x02;
-  }
-}
-
-// Sets the Negative Flag to 1 in the Status Register if the result is negative
-void setNegativeFlagIfNegative(CPU *cpu, uint8_t result) {
-  if ((result & 0x80) == 0x80) {
-    cpu->P = cpu->P | 0x02;
-  }
-}
-
-// Sets the overflow flag to 1 if original is smaller than the result
-void setOverflowFlagIfOverflow(CPU *cpu, uint8_t larger, uint8_t smaller) {
-  if (smaller > larger) {
-    cpu->P = cpu->P | 0x40;
-  }
-}
-
-void setCarryFlagConditionally(CPU *cpu, bool condition) {
-  if (condition) {
-    cpu->P = cpu->P | 0x01;
-  } else {
-    cpu->P = cpu->P & 0xFE;
-  }
-}
-
-uint8_t isCarryFlagSet(CPU *cpu) { return (cpu->P & 0x01) == 0x01; }
-
-// ------------- INSTRUCTIONS -------------
-
-// ADC Add Memory to Accumulator with Carry
-// NZCIDV
-// +++--+
-
-void addWithCarry(CPU *cpu, uint8_t oper) {
-  bool hasCarry = isCarryFlagSet(cpu);
-  uint8_t result = cpu->A + oper + (uint8_t)hasCarry;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  setOverflowFlagIfOverflow(cpu, cpu->A, result);
-  setCarryFlagConditionally(cpu, cpu->A > result);
-  cpu->A = result;
-}
-
-// 0x69, ADC #oper, 2 bytes, 2 cycles
-void addWithCarryImmediate(CPU *cpu) {
-  uint8_t oper = fetchImmediate(cpu);
-  addWithCarry(cpu, oper);
-}
-
-// 0x65, ADC oper, 2 bytes, 2 cycles
-void addWithCarryZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  addWithCarry(cpu, oper);
+INLINE uint16_t addressAbsoluteY(CPU *cpu, uint16_t operand) {
+  return operand + cpu->Y;
 }
 
-// 0x75, ADC oper,X, 2 bytes, 4 cycles
-void addWithCarryZeroPageX(CPU *cpu) {
-  uint8_t oper = fetchZeroPageX(cpu);
-  addWithCarry(cpu, oper);
-}
-
-// 0x6D, ADC oper,X, 2 bytes, 4 cycles
-void addWithCarryAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  addWithCarry(cpu, oper);
+INLINE uint8_t readAbsoluteY(CPU *cpu, uint16_t operand) {
+  uint16_t effectiveAddress = operand + cpu->Y;
+  addPageCrossPenalty(cpu, operand, effectiveAddress);
+  return readBus(cpu, effectiveAddress);
 }
 
-// 0x7D, ADC oper, 3 bytes, 4* cycles
-void addWithCarryAbsoluteX(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteX(cpu);
-  addWithCarry(cpu, oper);
+// JMP (oper) only. The pointer's high byte never carries, so JMP ($10FF)
+// reads its target from $10FF and $1000, like the real 6502.
+INLINE uint16_t addressIndirect(CPU *cpu, uint16_t pointer) {
+  uint8_t ll = readBus(cpu, pointer);
+  uint8_t hh = readBus(cpu, (pointer & 0xFF00) | (uint8_t)(pointer + 1));
+  return (uint16_t)hh << 8 | ll;
 }
 
-// 0x79, ADC oper,Y, 3 bytes, 4* cycles
-void addWithCarryAbsoluteY(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteY(cpu);
-  addWithCarry(cpu, oper);
+// (oper,X): the pointer is read from zero page, at the operand plus X
+INLINE uint16_t addressIndirectX(CPU *cpu, uint16_t operand) {
+  uint8_t indexedAddress = operand + cpu->X;
+  uint8_t ll = readBus(cpu, indexedAddress);
+  uint8_t hh = readBus(cpu, (uint8_t)(indexedAddress + 1));
+  return (uint16_t)hh << 8 | ll;
 }
 
-// 0x61, ADC (oper,X), 2 bytes, 6 cycles
-void addWithCarryIndirectX(CPU *cpu) {
-  uint8_t oper = fetchPreIndexedIndirectX(cpu);
-  addWithCarry(cpu, oper);
+INLINE uint8_t readIndirectX(CPU *cpu, uint16_t operand) {
+  return readBus(cpu, addressIndirectX(cpu, operand));
 }
 
-// 0x71, ADC (oper),Y, 2 bytes, 5* cycles
-void addWithCarryIndirectY(CPU *cpu) {
-  uint8_t oper = fetchPostIndexedIndirectY(cpu);
-  addWithCarry(cpu, oper);
+// Reads the (not yet indexed) pointer stored in zero page
+INLINE uint16_t readIndirectPointer(CPU *cpu, uint8_t operand) {
+  uint8_t ll = readBus(cpu, operand);
+  uint8_t hh = readBus(cpu, (uint8_t)(operand + 1));
+  return (uint16_t)hh << 8 | ll;
 }
 
-// AND Memory with Accumulator
-// NZCIDV
-// ++----
-void andMemoryWithAccumulator(CPU *cpu, uint8_t oper) {
-  uint8_t result = cpu->A | oper;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->A = result;
+// (oper),Y: Y is added to the pointer read from zero page
+INLINE uint16_t addressIndirectY(CPU *cpu, uint16_t operand) {
+  return readIndirectPointer(cpu, operand) + cpu->Y;
 }
 
-// 0x29, AND #oper, 2 bytes, 2 cycles
-void andImmediate(CPU *cpu) {
-  uint8_t oper = fetchPreIndexedIndirectX(cpu);
-  andMemoryWithAccumulator(cpu, oper);
+INLINE uint8_t readIndirectY(CPU *cpu, uint16_t operand) {
+  uint16_t lookupAddress = readIndirectPointer(cpu, operand);
+  uint16_t effectiveAddress = lookupAddress + cpu->Y;
+  addPageCrossPenalty(cpu, lookupAddress, effectiveAddress);
+  return readBus(cpu, effectiveAddress);
 }
 
-// 0x25
-void andZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  andMemoryWithAccumulator(cpu, oper);
-}
+// Flags. With NES_LAZY_FLAGS the handlers only store the value each flag is
+// derived from, and the flags are worked out when something actually looks at
+// them: a branch tests one of them, while PHP, BRK, interrupts and the
+// debugger build all of P with getProcessorStatus. Without it every handler
+// updates the bits of P directly.
+#ifdef NES_LAZY_FLAGS
 
-// 0x35
-void andZeroPageX(CPU *cpu) {
-  uint8_t oper = fetchZeroPageX(cpu);
-  andMemoryWithAccumulator(cpu, oper);
+INLINE void setZeroNegative(CPU *cpu, uint8_t result) {
+  cpu->ZeroNegative = result;
 }
 
-// 0x2D
-void andAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  andMemoryWithAccumulator(cpu, oper);
+// For BIT, where N does not come from the same value as Z
+INLINE void setZeroAndNegative(CPU *cpu, uint8_t zeroResult,
+                               uint8_t negativeResult) {
+  cpu->ZeroNegative = (uint16_t)(negativeResult & 0x80) << 1 | zeroResult;
 }
 
-// 0x3D
-void andAbsoluteX(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteX(cpu);
-  andMemoryWithAccumulator(cpu, memValue);
+INLINE void setCarryFlagConditionally(CPU *cpu, bool condition) {
+  cpu->Carry = condition;
 }
 
-// 0x39
-void andAbsoluteY(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteY(cpu);
-  andMemoryWithAccumulator(cpu, memValue);
-}
+// V is bit 7 of value
+INLINE void setOverflowFlag(CPU *cpu, uint8_t value) { cpu->Overflow = value; }
 
-// 0x21, AND (oper, X), 2 bytes, 6 cycles
-void andIndirectX(CPU *cpu) {
-  uint8_t oper = fetchPreIndexedIndirectX(cpu);
-  andMemoryWithAccumulator(cpu, oper);
+INLINE bool isCarryFlagSet(CPU *cpu) { return cpu->Carry; }
+INLINE bool isZeroFlagSet(CPU *cpu) { return (cpu->ZeroNegative & 0xFF) == 0; }
+INLINE bool isNegativeFlagSet(CPU *cpu) {
+  return (cpu->ZeroNegative & 0x180) != 0;
 }
+INLINE bool isOverflowFlagSet(CPU *cpu) { return (cpu->Overflow & 0x80) != 0; }
 
-void andIndirectY(CPU *cpu) {
-  uint8_t oper = fetchPostIndexedIndirectY(cpu);
-  andMemoryWithAccumulator(cpu, oper);
+uint8_t getProcessorStatus(CPU *cpu) {
+  return (cpu->P & 0x3C) | isNegativeFlagSet(cpu) << 7 |
+         isOverflowFlagSet(cpu) << 6 | isZeroFlagSet(cpu) << 1 |
+         isCarryFlagSet(cpu);
 }
 
-// ASL Shift Left One Bit (Memory or Accumulator
-//
-void arithmeticShiftLeft(CPU *cpu, uint8_t oper) {
-  uint8_t result = oper << 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  setOverflowFlagIfOverflow(cpu, oper, result);
-  cpu->Memory[oper] = result;
+void setProcessorStatus(CPU *cpu, uint8_t status) {
+  // B only exists on the stack, and bit 5 always reads back as set
+  cpu->P = (status & 0xCF) | 0x20;
+  cpu->ZeroNegative = (uint16_t)(status & 0x80) << 1 | (~status >> 1 & 0x01);
+  cpu->Carry = status & 0x01;
+  cpu->Overflow = status << 1;
 }
 
-// 0x0A, ASL, NZC, 1 byte, 2 cycles
-void arithmeticShiftLeftAccumulator(CPU *cpu) {
-  setCarryFlagConditionally(cpu, (cpu->A & 0x80) == 0x80);
-  uint8_t result = cpu->A << 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->A = result;
-}
+#else
 
-// 0x06, ASL oper, NZC, 2 bytes, 5 cycles
-void arithmeticShiftLeftZeroPage(CPU *cpu) {
-  uint8_t oper = fetchInstructionByte(cpu);
-  arithmeticShiftLeft(cpu, oper);
+INLINE void setZeroNegative(CPU *cpu, uint8_t result) {
+  cpu->P = (cpu->P & 0x7D) | (result & 0x80) | (result == 0) << 1;
 }
 
-// 0x16, ASL oper,X, NZC, 2 bytes, 6 cycles
-void arithmeticShiftLeftZeroPageX(CPU *cpu) {
-  uint8_t oper = fetchZeroPageX(cpu);
-  arithmeticShiftLeft(cpu, oper);
+INLINE void setZeroAndNegative(CPU *cpu, uint8_t zeroResult,
+                               uint8_t negativeResult) {
+  cpu->P =
+      (cpu->P & 0x7D) | (negativeResult & 0x80) | (zeroResult == 0) << 1;
 }
 
-// 0x0E, ASL oper, NZC, 3 bytes, 6 cycles
-void arithmeticShiftLeftAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  arithmeticShiftLeft(cpu, oper);
+INLINE void setCarryFlagConditionally(CPU *cpu, bool condition) {
+  cpu->P = (cpu->P & 0xFE) | condition;
 }
 
-// 0x1E, ASL oper,X, NZC, 3 bytes, 7 cycles
-void arithmeticShiftLeftAbsoluteX(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteX(cpu);
-  arithmeticShiftLeft(cpu, oper);
+INLINE void setOverflowFlag(CPU *cpu, uint8_t value) {
+  cpu->P = (cpu->P & 0xBF) | (value & 0x80) >> 1;
 }
 
-// BCC Branch on Carry Clear
-void branchOnClearCarryRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x01) == 0x00) {
-    cpu->P = cpu->P + address;
-  }
-}
+INLINE bool isCarryFlagSet(CPU *cpu) { return (cpu->P & 0x01) != 0; }
+INLINE bool isZeroFlagSet(CPU *cpu) { return (cpu->P & 0x02) != 0; }
+INLINE bool isNegativeFlagSet(CPU *cpu) { return (cpu->P & 0x80) != 0; }
+INLINE bool isOverflowFlagSet(CPU *cpu) { return (cpu->P & 0x40) != 0; }
 
-// BCS Branch on Carry Set
-void branchOnCarrySetRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x01) == 0x01) {
-    cpu->P = cpu->P + address;
-  }
-}
+uint8_t getProcessorStatus(CPU *cpu) { return cpu->P; }
 
-// BEQ Branch on Result Zero
-void branchOnEqualRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x02) == 0x02) {
-    cpu->P = cpu->P + address;
-  }
+void setProcessorStatus(CPU *cpu, uint8_t status) {
+  cpu->P = (status & 0xCF) | 0x20;
 }
 
-// BIT Test
+#endif
 
-// 0x24, BIT oper, Z, 2 bytes, 3 cycles
-// Addressing Mode: ZeroPage
-void bitTestZeroPage(CPU *cpu) {
-  uint8_t memValue = fetchZeroPage(cpu);
-  uint8_t nvBits = memValue | 0x3F; // Mask out irrelevant bits
-  uint8_t result = cpu->P | 0xC0 & nvBits;
-  setZeroFlagIfZero(cpu, result);
-  cpu->P = result;
-}
-
-// 0x2C, BIT oper, Z, 3 bytes, 4 cycles
-// Addressing Mode: Absolute
-void bitTestAbsolute(CPU *cpu) {
-  uint8_t memValue = fetchAbsolute(cpu);
-  uint8_t nvBits = memValue | 0x3F; // Mask out irrelevant bits
-  uint8_t result = cpu->P | 0xC0 & nvBits;
-  setZeroFlagIfZero(cpu, result);
-  cpu->P = result;
-}
+// Branch conditions
+INLINE bool isCarryFlagClear(CPU *cpu) { return !isCarryFlagSet(cpu); }
+INLINE bool isZeroFlagClear(CPU *cpu) { return !isZeroFlagSet(cpu); }
+INLINE bool isNegativeFlagClear(CPU *cpu) { return !isNegativeFlagSet(cpu); }
+INLINE bool isOverflowFlagClear(CPU *cpu) { return !isOverflowFlagSet(cpu); }
 
-// BMI Branch on Result Minus
-// 0x30
-void branchOnMinusRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x80) == 0x80) {
-    cpu->P = cpu->P + address;
-  }
-}
+// ------------- INSTRUCTIONS -------------
+// Each operation only does the work of the instruction. The operand is
+// fetched by the addressing mode it is paired with in OPCODE_TABLE, and
+// what an operation receives or returns depends on the kind of access:
+//   READ         operation(cpu, value)
+//   WRITE        value = operation(cpu), stored to the address
+//   MODIFY       operation(cpu, value) returns the value written back
+//   ACCUMULATOR  the same as MODIFY, on A instead of memory
+//   BRANCH       operation(cpu) returns whether the branch is taken
+//   JUMP         operation(cpu, address)
+//   IMPLIED      operation(cpu)
 
-// BNE Branch on Result not Zero
-// 0xD0
-void branchOnNotEqualRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x02) == 0x00) {
-    cpu->P = cpu->P + address;
-  }
+// ADC Add Memory to Accumulator with Carry
+// NZCIDV
+// +++--+
+INLINE void addWithCarry(CPU *cpu, uint8_t oper) {
+  uint16_t sum = cpu->A + oper + isCarryFlagSet(cpu);
+  uint8_t result = sum;
+  setCarryFlagConditionally(cpu, sum > 0xFF);
+  // Overflow when both inputs have the same sign and the result does not
+  setOverflowFlag(cpu, (cpu->A ^ result) & (oper ^ result));
+  setZeroNegative(cpu, result);
+  cpu->A = result;
 }
 
-// BPL Branch on Result Plus
-// 0x10, BPL oper, -, 2 bytes, 2 cycles
-void branchOnPlusRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x80) == 0x00) {
-    cpu->P = cpu->P + address;
-  }
+// AND Memory with Accumulator
+// NZCIDV
+// ++----
+INLINE void andMemoryWithAccumulator(CPU *cpu, uint8_t oper) {
+  uint8_t result = cpu->A & oper;
+  setZeroNegative(cpu, result);
+  cpu->A = result;
 }
 
-// 0x00, BRK, I, 1 byte, 7 cycles
-void forceBreak(CPU *cpu) {
-  // Push PC + 2 to stack;
-  pushStack(cpu, cpu->PC + 2);
-  // Push Processor Status to stack with I flag set to 1
-  pushStack(cpu, cpu->P | 0x04);
-  // Sets PC to be equal to FFFE and FFF0
-  cpu->PC = cpu->Memory[0xFFFE];
+// ASL Shift Left One Bit (Memory or Accumulator)
+// NZCIDV
+// +++---
+INLINE uint8_t arithmeticShiftLeft(CPU *cpu, uint8_t value) {
+  uint8_t result = value << 1;
+  setCarryFlagConditionally(cpu, value & 0x80);
+  setZeroNegative(cpu, result);
+  return result;
 }
 
-// BVC Branch on Overflow Clear
-// 0x50
-void branchOnOverflowSetRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x40) == 0x00) {
-    cpu->P = cpu->P + address;
+// Shared by all conditional branches. The offset is signed and relative to
+// the next instruction. A taken branch costs one extra cycle, and another
+// one if it lands on a different page.
+INLINE void branchRelative(CPU *cpu, bool condition) {
+  int8_t offset = (int8_t)fetchInstructionByte(cpu);
+  if (condition) {
+    uint16_t target = cpu->PC + offset;
+    cpu->Cycles++;
+    addPageCrossPenalty(cpu, cpu->PC, target);
+    cpu->PC = target;
   }
 }
 
-// BVS Branch on Overflow Set
-// 0x70
-void branchOnOverflowClearRelative(CPU *cpu) {
-  uint8_t address = fetchInstructionByte(cpu);
-  if ((cpu->P & 0x40) == 0x01) {
-    cpu->P = cpu->P + address;
-  }
+// BIT Test Bits in Memory with Accumulator
+// Z from A AND memory, N and V straight from bits 7 and 6 of memory
+// NZCIDV
+// ++---+
+INLINE void bitTest(CPU *cpu, uint8_t memValue) {
+  setZeroAndNegative(cpu, cpu->A & memValue, memValue);
+  setOverflowFlag(cpu, memValue << 1);
+}
+
+// Pushes PC and the status, then continues at the address in vector with
+// interrupts disabled. BRK pushes B set, hardware interrupts push it clear.
+static void interrupt(CPU *cpu, uint16_t vector, uint8_t pushedBits) {
+#ifdef NES_PROFILE
+  uint8_t base = cpu->S;
+#endif
+  pushStack(cpu, cpu->PC >> 8);
+  pushStack(cpu, cpu->PC & 0xFF);
+  pushStack(cpu, (getProcessorStatus(cpu) & 0xCF) | pushedBits);
+  cpu->P = cpu->P | 0x04;
+  uint16_t ll = readBus(cpu, vector);
+  uint16_t hh = readBus(cpu, vector + 1);
+  cpu->PC = (hh << 8) | ll;
+  PROFILE_CALL(cpu, vector == 0xFFFA ? FrameNmi : FrameIrq, cpu->PC, base);
+}
+
+// BRK Force Break
+// NZCIDV
+// ---1--
+INLINE void forceBreak(CPU *cpu) {
+  // BRK skips the byte after it, so the return address is PC + 2
+  cpu->PC++;
+  interrupt(cpu, 0xFFFE, 0x30);
 }
 
 // CLC Clear Carry Flag
-// 0x18, CLC, -, 1 byte, 2 cycles
-void clearCarry(CPU *cpu) { cpu->P = cpu->P & 0xFE; }
+INLINE void clearCarry(CPU *cpu) { setCarryFlagConditionally(cpu, false); }
 
-// CLD Cleaer Decimal Mode
-// 0xD8
-void clearDecimal(CPU *cpu) { cpu->P = cpu->P & 0xF7; }
+// CLD Clear Decimal Mode
+INLINE void clearDecimal(CPU *cpu) { cpu->P = cpu->P & 0xF7; }
 
-// CLI Clear Interrupt Disable BIt
-// 0x58
-void clearInterruptDisable(CPU *cpu) { cpu->P = cpu->P & 0xFB; }
+// CLI Clear Interrupt Disable Bit
+INLINE void clearInterruptDisable(CPU *cpu) { cpu->P = cpu->P & 0xFB; }
 
 // CLV Clear Overflow Flag
-// 0xB8
-void clearOverflow(CPU *cpu) { cpu->P = cpu->P & 0xBF; }
+INLINE void clearOverflow(CPU *cpu) { setOverflowFlag(cpu, 0); }
+
 // CMP Compare Memory with Accumulator
-void compareWithAccumulator(CPU *cpu, uint8_t memory) {
+// NZCIDV
+// +++---
+INLINE void compareWithAccumulator(CPU *cpu, uint8_t memory) {
   uint8_t result = cpu->A - memory;
-  setNegativeFlagIfNegative(cpu, result);
-  setZeroFlagIfZero(cpu, result);
-  setCarryFlagConditionally(cpu, memory >= cpu->A);
-}
-
-// 0xC9
-void compareWithAccumulatorImmediate(CPU *cpu) {
-  uint8_t oper = fetchImmediate(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xC5
-void compareWithAccumulatorZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xD5
-void compareWithAccumulatorZeroPageX(CPU *cpu) {
-  uint8_t oper = fetchZeroPageX(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xCD
-void compareWithAccumulatorAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xDD
-void compareWithAccumulatorAbsoluteX(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteX(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xD9
-void compareWithAccumulatorAbsoluteY(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteY(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xC1
-void compareWithAccumulatorIndirectX(CPU *cpu) {
-  uint8_t oper = fetchPreIndexedIndirectX(cpu);
-  compareWithAccumulator(cpu, oper);
-}
-
-// 0xD1
-void compareWithAccumulatorIndirectY(CPU *cpu) {
-  uint8_t oper = fetchPostIndexedIndirectY(cpu);
-  compareWithAccumulator(cpu, oper);
+  setZeroNegative(cpu, result);
+  setCarryFlagConditionally(cpu, cpu->A >= memory);
 }
 
 // CPX Compare Memory and Index X
-void compareWithX(CPU *cpu, uint8_t memory) {
+INLINE void compareWithX(CPU *cpu, uint8_t memory) {
   uint8_t result = cpu->X - memory;
-  setNegativeFlagIfNegative(cpu, result);
-  setZeroFlagIfZero(cpu, result);
-  setCarryFlagConditionally(cpu, memory >= cpu->X);
-}
-
-// 0xE0
-void compareWithXImmediate(CPU *cpu) {
-  uint8_t oper = fetchImmediate(cpu);
-  compareWithX(cpu, oper);
-}
-
-// 0xE4
-void compareWithXZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  compareWithX(cpu, oper);
-}
-
-// 0xEC
-void compareWithXAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  compareWithX(cpu, oper);
+  setZeroNegative(cpu, result);
+  setCarryFlagConditionally(cpu, cpu->X >= memory);
 }
 
 // CPY Compare Memory and Index Y
-void compareWithY(CPU *cpu, uint8_t memory) {
+INLINE void compareWithY(CPU *cpu, uint8_t memory) {
   uint8_t result = cpu->Y - memory;
-  setNegativeFlagIfNegative(cpu, result);
-  setZeroFlagIfZero(cpu, result);
-  setCarryFlagConditionally(cpu, memory >= cpu->Y);
-}
-
-// 0xC0
-void compareWithYImmediate(CPU *cpu) {
-  uint8_t oper = fetchImmediate(cpu);
-  compareWithY(cpu, oper);
-}
-
-// 0xC4
-void compareWithYZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  compareWithY(cpu, oper);
-}
-
-// 0xCC
-void compareWithYAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  compareWithY(cpu, oper);
+  setZeroNegative(cpu, result);
+  setCarryFlagConditionally(cpu, cpu->Y >= memory);
 }
 
 // DEC Decrement Memory by One
-void decrement(CPU *cpu, uint8_t memAddr) {
-  uint8_t result = cpu->Memory[memAddr] - 1;
-  setNegativeFlagIfNegative(cpu, result);
-  setZeroFlagIfZero(cpu, result);
-  cpu->Memory[memAddr] = result;
-}
-
-// 0xC6
-void decrementZeroPage(CPU *cpu) {
-  uint8_t memAddr = fetchZeroPage(cpu);
-  decrement(cpu, memAddr);
-}
-
-// 0xD6
-void decrementZeroPageX(CPU *cpu) {
-  uint8_t memAddr = fetchZeroPageX(cpu);
-  decrement(cpu, memAddr);
-}
-
-// 0xCE
-void decrementAbsolute(CPU *cpu) {
-  uint8_t memAddr = fetchAbsolute(cpu);
-  decrement(cpu, memAddr);
-}
-
-// 0xDE
-void decrementAbsoluteX(CPU *cpu) {
-  uint8_t memAddr = fetchAbsoluteX(cpu);
-  decrement(cpu, memAddr);
+INLINE uint8_t decrement(CPU *cpu, uint8_t value) {
+  uint8_t result = value - 1;
+  setZeroNegative(cpu, result);
+  return result;
 }
 
 // DEX Decrement Index X by One
-// 0xCA
-void decrementX(CPU *cpu) {
-  uint8_t result = cpu->X - 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->X = result;
+INLINE void decrementX(CPU *cpu) {
+  cpu->X--;
+  setZeroNegative(cpu, cpu->X);
 }
 
 // DEY Decrement Index Y by One
-// 0x88
-void decrementY(CPU *cpu) {
-  uint8_t result = cpu->Y - 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->Y = result;
+INLINE void decrementY(CPU *cpu) {
+  cpu->Y--;
+  setZeroNegative(cpu, cpu->Y);
 }
 
 // EOR Exclusive-Or Memory with Accumulator
-void exclusiveOr(CPU *cpu, uint8_t memValue) {
+INLINE void exclusiveOr(CPU *cpu, uint8_t memValue) {
   uint8_t result = cpu->A ^ memValue;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
+  setZeroNegative(cpu, result);
   cpu->A = result;
 }
 
-// 0x49
-void exclusiveOrImmediate(CPU *cpu) {
-  uint8_t oper = fetchImmediate(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x45
-void exclusiveOrZeroPage(CPU *cpu) {
-  uint8_t oper = fetchZeroPage(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x55
-void exclusiveOrZeroPageX(CPU *cpu) {
-  uint8_t oper = fetchZeroPageX(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x4D
-void exclusiveOrAbsolute(CPU *cpu) {
-  uint8_t oper = fetchAbsolute(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x5D
-void exclusiveOrAbsoluteX(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteX(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x59
-void exclusiveOrAbsoluteY(CPU *cpu) {
-  uint8_t oper = fetchAbsoluteX(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x41
-void exclusiveOrIndirectX(CPU *cpu) {
-  uint8_t oper = fetchPreIndexedIndirectX(cpu);
-  exclusiveOr(cpu, oper);
-}
-
-// 0x51
-void exclusiveOrIndirectY(CPU *cpu) {
-  uint8_t oper = fetchPostIndexedIndirectY(cpu);
-  exclusiveOr(cpu, oper);
-}
-
 // INC Increment Memory by One
-void increment(CPU *cpu, uint8_t memAddr) {
-  uint8_t result = cpu->Memory[memAddr] + 1;
-  setNegativeFlagIfNegative(cpu, result);
-  setZeroFlagIfZero(cpu, result);
-  cpu->Memory[memAddr] = result;
-}
-
-// 0xE6
-void incrementZeroPage(CPU *cpu) {
-  uint8_t memAddr = fetchZeroPage(cpu);
-  increment(cpu, memAddr);
-}
-
-// 0xF6
-void incrementZeroPageX(CPU *cpu) {
-  uint8_t memAddr = fetchZeroPageX(cpu);
-  increment(cpu, memAddr);
-}
-
-// 0xEE
-void incrementAbsolute(CPU *cpu) {
-  uint8_t memAddr = fetchAbsolute(cpu);
-  increment(cpu, memAddr);
-}
-
-// 0xFE
-void incrementAbsoluteX(CPU *cpu) {
-  uint8_t memAddr = fetchAbsoluteX(cpu);
-  increment(cpu, memAddr);
+INLINE uint8_t increment(CPU *cpu, uint8_t value) {
+  uint8_t result = value + 1;
+  setZeroNegative(cpu, result);
+  return result;
 }
 
 // INX Increment Index X by One
-// 0xE8
-void incrementX(CPU *cpu) {
-  uint8_t result = cpu->X + 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->X = result;
+INLINE void incrementX(CPU *cpu) {
+  cpu->X++;
+  setZeroNegative(cpu, cpu->X);
 }
 
 // INY Increment Index Y by One
-// 0xC8
-void incrementY(CPU *cpu) {
-  uint8_t result = cpu->Y + 1;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->Y = result;
+INLINE void incrementY(CPU *cpu) {
+  cpu->Y++;
+  setZeroNegative(cpu, cpu->Y);
 }
 
 // JMP Jump to new Location
-void jump(CPU *cpu, uint16_t address) { cpu->PC = address; }
-
-// 0x4C
-void jumpAbsolute(CPU *cpu) {
-  uint16_t address = fetchAbsoluteAddress(cpu);
-  jump(cpu, address);
-}
-
-// 0x6C
-void jumpIndirect(CPU *cpu) {
-  uint16_t address = fetchIndirectAddress(cpu);
-  jump(cpu, address);
-}
+INLINE void jump(CPU *cpu, uint16_t address) { cpu->PC = address; }
 
 // JSR Jump to new Location Saving Return Address
-// 0x20, JSR oper, -, 3 bytes, 6 cycles
-void jumpSubRoutineAbsolute(CPU *cpu) {
-  pushStack(cpu, cpu->PC + 2);
-  uint16_t address = fetchAbsoluteAddress(cpu);
+// The address pushed is the last byte of the JSR, RTS adds the missing one.
+INLINE void jumpToSubroutine(CPU *cpu, uint16_t address) {
+  uint16_t returnAddress = cpu->PC - 1;
+  PROFILE_CALL(cpu, FrameSubroutine, address, cpu->S);
+  pushStack(cpu, returnAddress >> 8);
+  pushStack(cpu, returnAddress & 0xFF);
   cpu->PC = address;
 }
 
 // LDA Load Accumulator with Memory
-void loadAccumulator(CPU *cpu, uint8_t value) {
-  setZeroFlagIfZero(cpu, value);
-  setNegativeFlagIfNegative(cpu, value);
+INLINE void loadAccumulator(CPU *cpu, uint8_t value) {
+  setZeroNegative(cpu, value);
   cpu->A = value;
 }
 
-// 0xA9
-void loadAccumulatorImmediate(CPU *cpu) {
-  uint8_t value = fetchImmediate(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xA5
-void loadAccumulatorZeroPage(CPU *cpu) {
-  uint8_t value = fetchZeroPage(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xB5
-void loadAccumulatorZeroPageX(CPU *cpu) {
-  uint8_t value = fetchZeroPageX(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xAD
-void loadAccumulatorAbsolute(CPU *cpu) {
-  uint8_t value = fetchAbsolute(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xBD
-void loadAccumulatorAbsoluteX(CPU *cpu) {
-  uint8_t value = fetchAbsoluteX(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xB9
-void loadAccumulatorAbsoluteY(CPU *cpu) {
-  uint8_t value = fetchAbsoluteY(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xA1
-void loadAccumulatorIndirectX(CPU *cpu) {
-  uint8_t value = fetchPreIndexedIndirectX(cpu);
-  loadAccumulator(cpu, value);
-}
-
-// 0xB1
-void loadAccumulatorIndirectY(CPU *cpu) {
-  uint8_t value = fetchPostIndexedIndirectY(cpu);
-  loadAccumulator(cpu, value);
-}
-
 // LDX Load Index X with Memory
-void loadX(CPU *cpu, uint8_t value) {
-  setZeroFlagIfZero(cpu, value);
-  setNegativeFlagIfNegative(cpu, value);
+INLINE void loadX(CPU *cpu, uint8_t value) {
+  setZeroNegative(cpu, value);
   cpu->X = value;
 }
 
-// 0xA2
-void loadXImmediate(CPU *cpu) {
-  uint8_t value = fetchImmediate(cpu);
-  loadX(cpu, value);
-}
-
-// 0xA6
-void loadXZeroPage(CPU *cpu) {
-  uint8_t value = fetchZeroPage(cpu);
-  loadX(cpu, value);
-}
-
-// 0xB6
-void loadXZeroPageY(CPU *cpu) {
-  uint8_t value = fetchZeroPageY(cpu);
-  loadX(cpu, value);
-}
-
-// 0xAE
-void loadXAbsolute(CPU *cpu) {
-  uint8_t value = fetchAbsolute(cpu);
-  loadX(cpu, value);
-}
-
-// 0xBE
-void loadXAbsoluteY(CPU *cpu) {
-  uint8_t value = fetchAbsoluteY(cpu);
-  loadX(cpu, value);
-}
-
 // LDY Load Index Y with Memory
-void loadY(CPU *cpu, uint8_t value) {
-  setZeroFlagIfZero(cpu, value);
-  setNegativeFlagIfNegative(cpu, value);
+INLINE void loadY(CPU *cpu, uint8_t value) {
+  setZeroNegative(cpu, value);
   cpu->Y = value;
 }
 
-// 0xA0
-void loadYImmediate(CPU *cpu) {
-  uint8_t value = fetchImmediate(cpu);
-  loadY(cpu, value);
-}
-
-// 0xA4
-void loadYZeroPage(CPU *cpu) {
-  uint8_t value = fetchZeroPage(cpu);
-  loadY(cpu, value);
-}
-
-// 0xB4
-void loadYZeroPageX(CPU *cpu) {
-  uint8_t value = fetchZeroPageX(cpu);
-  loadY(cpu, value);
-}
-
-// 0xAC
-void loadYAbsolute(CPU *cpu) {
-  uint8_t value = fetchAbsolute(cpu);
-  loadY(cpu, value);
-}
-
-// 0xBC
-void loadYAbsoluteX(CPU *cpu) {
-  uint8_t value = fetchAbsoluteX(cpu);
-  loadY(cpu, value);
-}
-
 // LSR Shift One Bit Right (Memory or Accumulator)
-uint8_t logisticalShiftRight(CPU *cpu, uint8_t value) {
+INLINE uint8_t logisticalShiftRight(CPU *cpu, uint8_t value) {
   uint8_t result = value >> 1;
-  // Reset N flag
-  cpu->P = cpu->P & 0x7F;
-  setZeroFlagIfZero(cpu, result);
-  // Set 0th bit to Carry
-  uint8_t zeroBit = value & 0x01;
-  if (zeroBit == 0x01) {
-    cpu->P = cpu->P | 0x01;
-  } else {
-    cpu->P = cpu->P & 0xFE;
-  }
+  // Bit 0 goes to carry, N always ends up clear
+  setCarryFlagConditionally(cpu, value & 0x01);
+  setZeroNegative(cpu, result);
   return result;
 }
 
-// 0x4A
-void logisticalShiftRightAccumulator(CPU *cpu) {
-  uint8_t result = logisticalShiftRight(cpu, cpu->A);
-  cpu->A = result;
-}
-
-// 0x46
-void logisticalShiftRightZeroPage(CPU *cpu) {
-  uint16_t address = fetchZeroPageAddress(cpu);
-  uint8_t value = readBus(cpu, address);
-  uint8_t result = logisticalShiftRight(cpu, value);
-  cpu->Memory[address] = result;
-}
-
-// 0x56
-void logisticalShiftRightZeroPageX(CPU *cpu) {
-  uint16_t address = fetchZeroPageAddress(cpu) + cpu->X;
-  uint8_t value = readBus(cpu, address);
-  uint8_t result = logisticalShiftRight(cpu, value);
-  cpu->Memory[address] = result;
-}
-
-// 0x4E
-void logisticalShiftRightAbsolute(CPU *cpu) {
-  uint16_t address = fetchAbsoluteAddress(cpu);
-  uint8_t value = readBus(cpu, address);
-  uint8_t result = logisticalShiftRight(cpu, value);
-  cpu->Memory[address] = result;
-}
-
-// 0x5E
-void logisticalShiftRightAbsoluteX(CPU *cpu) {
-  uint16_t address = fetchAbsoluteAddress(cpu) + cpu->X;
-  uint8_t value = readBus(cpu, address);
-  uint8_t result = logisticalShiftRight(cpu, value);
-  cpu->Memory[address] = result;
-}
-
 // NOP No Operation
-// 0xEA
-void noOperation(CPU *cpu) { return; }
+INLINE void noOperation(CPU *cpu) { (void)cpu; }
 
 // ORA Or Memory with Accumulator
-uint8_t orA(CPU *cpu, uint8_t memValue) {
+INLINE void orA(CPU *cpu, uint8_t memValue) {
   uint8_t result = memValue | cpu->A;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  return result;
-}
-
-// 0x09, ORA #oper, NZ, 2 bytes, 2 cycles
-void orAImmediate(CPU *cpu) {
-  uint8_t memValue = fetchImmediate(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x05, ORA oper, NZ, 2 bytes, 3 cycles
-void orAZeroPage(CPU *cpu) {
-  uint8_t memValue = fetchZeroPage(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x15, ORA oper,X, NZ, 2 bytes, 4 cycles
-void orAZeroPageX(CPU *cpu) {
-  uint8_t memValue = fetchZeroPageX(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x0D, ORA oper, NZ, 3 bytes, 4 cycles
-void orAAbsolute(CPU *cpu) {
-  uint8_t memValue = fetchAbsolute(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x1D, ORA oper,X, NZ, 3 bytes, 4 cycles
-void orAAbsoluteX(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteX(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x19, ORA oper,Y, NZ, 3 bytes, 4* cycles
-void orAAbsoluteY(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteY(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x01, ORA(oper,X), NZ, 2 bytes, 6 cycles
-void orAIndirectX(CPU *cpu) {
-  uint8_t memValue = fetchPreIndexedIndirectX(cpu);
-  uint8_t result = orA(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x11, ORA (oper),Y, NZ, 2 bytes, 5 cycles
-void orAIndirectY(CPU *cpu) {
-  uint8_t memValue = fetchPostIndexedIndirectY(cpu);
-  uint8_t result = orA(cpu, memValue);
+  setZeroNegative(cpu, result);
   cpu->A = result;
 }
 
 // PHA Push Accumulator on Stack
-// 0x48
-void pushAccumulatorOntoStack(CPU *cpu) { pushStack(cpu, cpu->A); }
+INLINE void pushAccumulatorOntoStack(CPU *cpu) { pushStack(cpu, cpu->A); }
 
-// PHP Push Processor Status on Status
-// 0x08, PHP, -, 1 byte, 3 cycles
-void pushProcessorStatusOnStack(CPU *cpu) {
-  // Set B Flag and Pin 5 to 1 before pushing
-  cpu->P = cpu->P | 0x30; // 00110000
-  pushStack(cpu, cpu->P);
+// PHP Push Processor Status on Stack
+INLINE void pushProcessorStatusOnStack(CPU *cpu) {
+  // B and bit 5 are set in the pushed copy only
+  pushStack(cpu, getProcessorStatus(cpu) | 0x30);
 }
 
 // PLA Pull Accumulator from Stack
-void pullAccumulatorFromStack(CPU *cpu) {
+INLINE void pullAccumulatorFromStack(CPU *cpu) {
   uint8_t stackValue = popStack(cpu);
-  setZeroFlagIfZero(cpu, stackValue);
-  setNegativeFlagIfNegative(cpu, stackValue);
+  setZeroNegative(cpu, stackValue);
   cpu->A = stackValue;
 }
 
-// Pull Processor Stauts from Stack
-// 0x28
-void pullProcessorStatusFromStack(CPU *cpu) { cpu->P = popStack(cpu); }
+// PLP Pull Processor Status from Stack
+INLINE void pullProcessorStatusFromStack(CPU *cpu) {
+  setProcessorStatus(cpu, popStack(cpu));
+}
 
 // ROL Rotate One Bit Left
-uint8_t rotateLeft(CPU *cpu, uint8_t value) {
-  uint8_t result;
-  if ((value | 0x7F) != value) {
-    cpu->P = cpu->P | 0x01;
-    result = (value << 1) + 1;
-  } else {
-    cpu->P = cpu->P & 0xFE;
-    result = value << 1;
-  }
+INLINE uint8_t rotateLeft(CPU *cpu, uint8_t value) {
+  uint8_t result = value << 1 | isCarryFlagSet(cpu);
+  setCarryFlagConditionally(cpu, value & 0x80);
+  setZeroNegative(cpu, result);
   return result;
 }
 
-// 0x2A
-void rotateLeftAccumulator(CPU *cpu) {
-  uint8_t result = rotateLeft(cpu, cpu->A);
-  cpu->A = result;
-}
-
-// 0x26
-void rotateLeftZeroPage(CPU *cpu) {
-  uint8_t memValue = fetchZeroPage(cpu);
-  uint8_t result = rotateLeft(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x36
-void rotateLeftZeroPageX(CPU *cpu) {
-  uint8_t memValue = fetchZeroPageX(cpu);
-  uint8_t result = rotateLeft(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x2E
-void rotateLeftAbsolute(CPU *cpu) {
-  uint8_t memValue = fetchAbsolute(cpu);
-  uint8_t result = rotateLeft(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x3E
-void rotateLeftAbsoluteX(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteX(cpu);
-  uint8_t result = rotateLeft(cpu, memValue);
-  cpu->A = result;
-}
-
 // ROR Rotate One Bit Right
-uint8_t rotateRight(CPU *cpu, uint8_t value) {
-  uint8_t result;
-  if ((value | 0x01) == value) { // If 0th bit is 1
-    cpu->P = cpu->P | 0x01;
-    result = (value >> 1) | 0x80;
-  } else {
-    cpu->P = cpu->P & 0xFE;
-    result = value >> 1 & 0x7F;
-  }
+INLINE uint8_t rotateRight(CPU *cpu, uint8_t value) {
+  uint8_t result = value >> 1 | isCarryFlagSet(cpu) << 7;
+  setCarryFlagConditionally(cpu, value & 0x01);
+  setZeroNegative(cpu, result);
   return result;
 }
 
-// 0x6A
-void rotateRightAccumulator(CPU *cpu) {
-  uint8_t result = rotateRight(cpu, cpu->A);
-  cpu->A = result;
-}
-
-// 0x66
-void rotateRightZeroPage(CPU *cpu) {
-  uint8_t memValue = fetchZeroPage(cpu);
-  uint8_t result = rotateRight(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x76
-void rotateRightZeroPageX(CPU *cpu) {
-  uint8_t memValue = fetchZeroPageX(cpu);
-  uint8_t result = rotateRight(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x6E
-void rotateRightAbsolute(CPU *cpu) {
-  uint8_t memValue = fetchAbsolute(cpu);
-  uint8_t result = rotateRight(cpu, memValue);
-  cpu->A = result;
-}
-
-// 0x7E
-void rotateRightAbsoluteX(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteX(cpu);
-  uint8_t result = rotateRight(cpu, memValue);
-  cpu->A = result;
-}
-
 // RTI Return from Interrupt
-// 0x40
-void returnFromInterrupt(CPU *cpu) {
-  cpu->P = popStack(cpu);
+INLINE void returnFromInterrupt(CPU *cpu) {
+  setProcessorStatus(cpu, popStack(cpu));
   uint8_t pcl = popStack(cpu);
   uint8_t pch = popStack(cpu);
   cpu->PC = (pch << 8) + pcl;
+  PROFILE_RETURN(cpu);
 }
 
 // RTS Return from Subroutine
-// 0x60
-void returnFromSubroutine(CPU *cpu) {}
-
-// SBC Subtract Memory from Accumulator with Borrow
-uint8_t subtractWithCarry(CPU *cpu, uint8_t value) {
-  uint8_t result;
-  if (cpu->A > value) {
-    // No borrow
-    cpu->P = cpu->P | 0x01;
-  } else {
-    cpu->P = cpu->P & 0xFE;
-  }
-  result = cpu->A - value;
-  // Set overflow
-  setOverflowFlagIfOverflow(cpu, cpu->A, result);
-  setNegativeFlagIfNegative(cpu, result);
-  return result;
-}
-
-// 0xE9
-void subtractWithCarryImmediate(CPU *cpu) {
-  uint8_t memValue = fetchImmediate(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xE5
-void subtractWithCarryZeroPage(CPU *cpu) {
-  uint8_t memValue = fetchZeroPage(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xF5
-void subtractWithCarryZeroPageX(CPU *cpu) {
-  uint8_t memValue = fetchZeroPageX(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xED
-void subtractWithCarryAbsolute(CPU *cpu) {
-  uint8_t memValue = fetchAbsolute(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xFD
-void subtractWithCarryAbsoluteX(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteX(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xF9
-void subtractWithCarryAbsoluteY(CPU *cpu) {
-  uint8_t memValue = fetchAbsoluteY(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
-}
-
-// 0xE1
-void subtractWithCarryIndirectX(CPU *cpu) {
-  uint8_t memValue = fetchPreIndexedIndirectX(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
+INLINE void returnFromSubroutine(CPU *cpu) {
+  uint8_t pcl = popStack(cpu);
+  uint8_t pch = popStack(cpu);
+  cpu->PC = ((pch << 8) | pcl) + 1;
+  PROFILE_RETURN(cpu);
 }
 
-// 0xF1
-void subtractWithCarryIndirectY(CPU *cpu) {
-  uint8_t memValue = fetchPostIndexedIndirectY(cpu);
-  uint8_t result = subtractWithCarry(cpu, memValue);
+// SBC Subtract Memory from Accumulator with Borrow
+// A - M - (1 - C) is the same as A + ~M + C, carry clear meaning a borrow.
+INLINE void subtractWithCarry(CPU *cpu, uint8_t value) {
+  addWithCarry(cpu, value ^ 0xFF);
 }
 
 // SEC Set Carry Flag
-// 0x38
-void setCarry(CPU *cpu) { cpu->P = cpu->P | 0x01; }
+INLINE void setCarry(CPU *cpu) { setCarryFlagConditionally(cpu, true); }
 
 // SED Set Decimal Flag
-// 0xF8
-void setDecimal(CPU *cpu) { cpu->P = cpu->P | 0x08; }
+INLINE void setDecimal(CPU *cpu) { cpu->P = cpu->P | 0x08; }
 
 // SEI Set Interrupt Disable Status
-// 0x78
-void setInterruptDisable(CPU *cpu) { cpu->P = cpu->P | 0x04; }
+INLINE void setInterruptDisable(CPU *cpu) { cpu->P = cpu->P | 0x04; }
 
 // STA Store Accumulator in Memory
-// 0x85
-void storeAccumulatorZeroPage(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu);
-  cpu->Memory[memAddr] = cpu->A;
-}
+INLINE uint8_t storeAccumulator(CPU *cpu) { return cpu->A; }
 
-// 0x95
-void storeAccumulatorZeroPageX(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu) + cpu->X;
-  cpu->Memory[memAddr] = cpu->A;
-}
+// STX Store Index X in Memory
+INLINE uint8_t storeX(CPU *cpu) { return cpu->X; }
 
-// 0x8D
-void storeAccumulatorAbsolute(CPU *cpu) {
-  uint16_t memAddr = fetchAbsoluteAddress(cpu);
-  cpu->Memory[memAddr] = cpu->A;
-}
+// STY Store Index Y in Memory
+INLINE uint8_t storeY(CPU *cpu) { return cpu->Y; }
 
-// 0x9D
-void storeAccumulatorAbsoluteX(CPU *cpu) {
-  uint16_t memAddr = fetchAbsoluteAddress(cpu) + cpu->X;
-  cpu->Memory[memAddr] = cpu->A;
+// TAX Transfer Accumulator to Index X
+INLINE void transferAccumulatorToX(CPU *cpu) {
+  cpu->X = cpu->A;
+  setZeroNegative(cpu, cpu->X);
 }
 
-// 0x99
-void storeAccumulatorAbsoluteY(CPU *cpu) {
-  uint16_t memAddr = fetchAbsoluteAddress(cpu) + cpu->Y;
-  cpu->Memory[memAddr] = cpu->A;
+// TAY Transfer Accumulator to Index Y
+INLINE void transferAccumulatorToY(CPU *cpu) {
+  cpu->Y = cpu->A;
+  setZeroNegative(cpu, cpu->Y);
 }
 
-// 0x81
-void storeAccumulatorIndirectX(CPU *cpu) {
-  uint16_t memAddr = fetchPreIndexedIndirectXAddress(cpu) + cpu->Y;
-  cpu->Memory[memAddr] = cpu->A;
+// TSX Transfer Stack Pointer to Index X
+INLINE void transferStackPointerToX(CPU *cpu) {
+  cpu->X = cpu->S;
+  setZeroNegative(cpu, cpu->X);
 }
 
-// 0x91
-void storeAccumulatorIndirectY(CPU *cpu) {
-  uint16_t memAddr = fetchPostIndexedIndirectYAddress(cpu);
-  cpu->Memory[memAddr] = cpu->A;
+// TXA Transfer Index X to Accumulator
+INLINE void transferXToAccumulator(CPU *cpu) {
+  cpu->A = cpu->X;
+  setZeroNegative(cpu, cpu->A);
 }
 
-// STX Store Index X in Memory
-// 0x86
-void storeXZeroPage(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu);
-  cpu->Memory[memAddr] = cpu->X;
-}
+// TXS Transfer Index X to Stack Pointer
+// Unlike the other transfers, TXS leaves the flags alone
+INLINE void transferXToStackPointer(CPU *cpu) { cpu->S = cpu->X; }
 
-// 0x96
-void storeXZeroPageY(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu) + cpu->Y;
-  cpu->Memory[memAddr] = cpu->X;
+// TYA Transfer Index Y to Accumulator
+INLINE void transferYToAccumulator(CPU *cpu) {
+  cpu->A = cpu->Y;
+  setZeroNegative(cpu, cpu->A);
+}
+
+// Every documented opcode as (opcode, mnemonic, operation, addressing mode,
+// kind of access, base cycles). This one list is expanded into the inlined
+// handlers in run() and into the name, length, cycle and addressing mode
+// tables, so none of them can drift apart from the others.
+#define OPCODE_TABLE(OP)                                                       \
+  OP(0x00, "BRK", forceBreak, Implied, IMPLIED, 7)                             \
+  OP(0x01, "ORA", orA, IndirectX, READ, 6)                                     \
+  OP(0x05, "ORA", orA, ZeroPage, READ, 3)                                      \
+  OP(0x06, "ASL", arithmeticShiftLeft, ZeroPage, MODIFY, 5)                    \
+  OP(0x08, "PHP", pushProcessorStatusOnStack, Implied, IMPLIED, 3)             \
+  OP(0x09, "ORA", orA, Immediate, READ, 2)                                     \
+  OP(0x0A, "ASL", arithmeticShiftLeft, Accumulator, ACCUMULATOR, 2)            \
+  OP(0x0D, "ORA", orA, Absolute, READ, 4)                                      \
+  OP(0x0E, "ASL", arithmeticShiftLeft, Absolute, MODIFY, 6)                    \
+  OP(0x10, "BPL", isNegativeFlagClear, Relative, BRANCH, 2)                    \
+  OP(0x11, "ORA", orA, IndirectY, READ, 5)                                     \
+  OP(0x15, "ORA", orA, ZeroPageX, READ, 4)                                     \
+  OP(0x16, "ASL", arithmeticShiftLeft, ZeroPageX, MODIFY, 6)                   \
+  OP(0x18, "CLC", clearCarry, Implied, IMPLIED, 2)                             \
+  OP(0x19, "ORA", orA, AbsoluteY, READ, 4)                                     \
+  OP(0x1D, "ORA", orA, AbsoluteX, READ, 4)                                     \
+  OP(0x1E, "ASL", arithmeticShiftLeft, AbsoluteX, MODIFY, 7)                   \
+  OP(0x20, "JSR", jumpToSubroutine, Absolute, JUMP, 6)                         \
+  OP(0x21, "AND", andMemoryWithAccumulator, IndirectX, READ, 6)                \
+  OP(0x24, "BIT", bitTest, ZeroPage, READ, 3)                                  \
+  OP(0x25, "AND", andMemoryWithAccumulator, ZeroPage, READ, 3)                 \
+  OP(0x26, "ROL", rotateLeft, ZeroPage, MODIFY, 5)                             \
+  OP(0x28, "PLP", pullProcessorStatusFromStack, Implied, IMPLIED, 4)           \
+  OP(0x29, "AND", andMemoryWithAccumulator, Immediate, READ, 2)                \
+  OP(0x2A, "ROL", rotateLeft, Accumulator, ACCUMULATOR, 2)                     \
+  OP(0x2C, "BIT", bitTest, Absolute, READ, 4)                                  \
+  OP(0x2D, "AND", andMemoryWithAccumulator, Absolute, READ, 4)                 \
+  OP(0x2E, "ROL", rotateLeft, Absolute, MODIFY, 6)                             \
+  OP(0x30, "BMI", isNegativeFlagSet, Relative, BRANCH, 2)                      \
+  OP(0x31, "AND", andMemoryWithAccumulator, IndirectY, READ, 5)                \
+  OP(0x35, "AND", andMemoryWithAccumulator, ZeroPageX, READ, 4)                \
+  OP(0x36, "ROL", rotateLeft, ZeroPageX, MODIFY, 6)                            \
+  OP(0x38, "SEC", setCarry, Implied, IMPLIED, 2)                               \
+  OP(0x39, "AND", andMemoryWithAccumulator, AbsoluteY, READ, 4)                \
+  OP(0x3D, "AND", andMemoryWithAccumulator, AbsoluteX, READ, 4)                \
+  OP(0x3E, "ROL", rotateLeft, AbsoluteX, MODIFY, 7)                            \
+  OP(0x40, "RTI", returnFromInterrupt, Implied, IMPLIED, 6)                    \
+  OP(0x41, "EOR", exclusiveOr, IndirectX, READ, 6)                             \
+  OP(0x45, "EOR", exclusiveOr, ZeroPage, READ, 3)                              \
+  OP(0x46, "LSR", logisticalShiftRight, ZeroPage, MODIFY, 5)                   \
+  OP(0x48, "PHA", pushAccumulatorOntoStack, Implied, IMPLIED, 3)               \
+  OP(0x49, "EOR", exclusiveOr, Immediate, READ, 2)                             \
+  OP(0x4A, "LSR", logisticalShiftRight, Accumulator, ACCUMULATOR, 2)           \
+  OP(0x4C, "JMP", jump, Absolute, JUMP, 3)                                     \
+  OP(0x4D, "EOR", exclusiveOr, Absolute, READ, 4)                              \
+  OP(0x4E, "LSR", logisticalShiftRight, Absolute, MODIFY, 6)                   \
+  OP(0x50, "BVC", isOverflowFlagClear, Relative, BRANCH, 2)                    \
+  OP(0x51, "EOR", exclusiveOr, IndirectY, READ, 5)                             \
+  OP(0x55, "EOR", exclusiveOr, ZeroPageX, READ, 4)                             \
+  OP(0x56, "LSR", logisticalShiftRight, ZeroPageX, MODIFY, 6)                  \
+  OP(0x58, "CLI", clearInterruptDisable, Implied, IMPLIED, 2)                  \
+  OP(0x59, "EOR", exclusiveOr, AbsoluteY, READ, 4)                             \
+  OP(0x5D, "EOR", exclusiveOr, AbsoluteX, READ, 4)                             \
+  OP(0x5E, "LSR", logisticalShiftRight, AbsoluteX, MODIFY, 7)                  \
+  OP(0x60, "RTS", returnFromSubroutine, Implied, IMPLIED, 6)                   \
+  OP(0x61, "ADC", addWithCarry, IndirectX, READ, 6)                            \
+  OP(0x65, "ADC", addWithCarry, ZeroPage, READ, 3)                             \
+  OP(0x66, "ROR", rotateRight, ZeroPage, MODIFY, 5)                            \
+  OP(0x68, "PLA", pullAccumulatorFromStack, Implied, IMPLIED, 4)               \
+  OP(0x69, "ADC", addWithCarry, Immediate, READ, 2)                            \
+  OP(0x6A, "ROR", rotateRight, Accumulator, ACCUMULATOR, 2)                    \
+  OP(0x6C, "JMP", jump, Indirect, JUMP, 5)                                     \
+  OP(0x6D, "ADC", addWithCarry, Absolute, READ, 4)                             \
+  OP(0x6E, "ROR", rotateRight, Absolute, MODIFY, 6)                            \
+  OP(0x70, "BVS", isOverflowFlagSet, Relative, BRANCH, 2)                      \
+  OP(0x71, "ADC", addWithCarry, IndirectY, READ, 5)                            \
+  OP(0x75, "ADC", addWithCarry, ZeroPageX, READ, 4)                            \
+  OP(0x76, "ROR", rotateRight, ZeroPageX, MODIFY, 6)                           \
+  OP(0x78, "SEI", setInterruptDisable, Implied, IMPLIED, 2)                    \
+  OP(0x79, "ADC", addWithCarry, AbsoluteY, READ, 4)                            \
+  OP(0x7D, "ADC", addWithCarry, AbsoluteX, READ, 4)                            \
+  OP(0x7E, "ROR", rotateRight, AbsoluteX, MODIFY, 7)                           \
+  OP(0x81, "STA", storeAccumulator, IndirectX, WRITE, 6)                       \
+  OP(0x84, "STY", storeY, ZeroPage, WRITE, 3)                                  \
+  OP(0x85, "STA", storeAccumulator, ZeroPage, WRITE, 3)                        \
+  OP(0x86, "STX", storeX, ZeroPage, WRITE, 3)                                  \
+  OP(0x88, "DEY", decrementY, Implied, IMPLIED, 2)                             \
+  OP(0x8A, "TXA", transferXToAccumulator, Implied, IMPLIED, 2)                 \
+  OP(0x8C, "STY", storeY, Absolute, WRITE, 4)                                  \
+  OP(0x8D, "STA", storeAccumulator, Absolute, WRITE, 4)                        \
+  OP(0x8E, "STX", storeX, Absolute, WRITE, 4)                                  \
+  OP(0x90, "BCC", isCarryFlagClear, Relative, BRANCH, 2)                       \
+  OP(0x91, "STA", storeAccumulator, IndirectY, WRITE, 6)                       \
+  OP(0x94, "STY", storeY, ZeroPageX, WRITE, 4)                                 \
+  OP(0x95, "STA", storeAccumulator, ZeroPageX, WRITE, 4)                       \
+  OP(0x96, "STX", storeX, ZeroPageY, WRITE, 4)                                 \
+  OP(0x98, "TYA", transferYToAccumulator, Implied, IMPLIED, 2)                 \
+  OP(0x99, "STA", storeAccumulator, AbsoluteY, WRITE, 5)                       \
+  OP(0x9A, "TXS", transferXToStackPointer, Implied, IMPLIED, 2)                \
+  OP(0x9D, "STA", storeAccumulator, AbsoluteX, WRITE, 5)                       \
+  OP(0xA0, "LDY", loadY, Immediate, READ, 2)                                   \
+  OP(0xA1, "LDA", loadAccumulator, IndirectX, READ, 6)                         \
+  OP(0xA2, "LDX", loadX, Immediate, READ, 2)                                   \
+  OP(0xA4, "LDY", loadY, ZeroPage, READ, 3)                                    \
+  OP(0xA5, "LDA", loadAccumulator, ZeroPage, READ, 3)                          \
+  OP(0xA6, "LDX", loadX, ZeroPage, READ, 3)                                    \
+  OP(0xA8, "TAY", transferAccumulatorToY, Implied, IMPLIED, 2)                 \
+  OP(0xA9, "LDA", loadAccumulator, Immediate, READ, 2)                         \
+  OP(0xAA, "TAX", transferAccumulatorToX, Implied, IMPLIED, 2)                 \
+  OP(0xAC, "LDY", loadY, Absolute, READ, 4)                                    \
+  OP(0xAD, "LDA", loadAccumulator, Absolute, READ, 4)                          \
+  OP(0xAE, "LDX", loadX, Absolute, READ, 4)                                    \
+  OP(0xB0, "BCS", isCarryFlagSet, Relative, BRANCH, 2)                         \
+  OP(0xB1, "LDA", loadAccumulator, IndirectY, READ, 5)                         \
+  OP(0xB4, "LDY", loadY, ZeroPageX, READ, 4)                                   \
+  OP(0xB5, "LDA", loadAccumulator, ZeroPageX, READ, 4)                         \
+  OP(0xB6, "LDX", loadX, ZeroPageY, READ, 4)                                   \
+  OP(0xB8, "CLV", clearOverflow, Implied, IMPLIED, 2)                          \
+  OP(0xB9, "LDA", loadAccumulator, AbsoluteY, READ, 4)                         \
+  OP(0xBA, "TSX", transferStackPointerToX, Implied, IMPLIED, 2)                \
+  OP(0xBC, "LDY", loadY, AbsoluteX, READ, 4)                                   \
+  OP(0xBD, "LDA", loadAccumulator, AbsoluteX, READ, 4)                         \
+  OP(0xBE, "LDX", loadX, AbsoluteY, READ, 4)                                   \
+  OP(0xC0, "CPY", compareWithY, Immediate, READ, 2)                            \
+  OP(0xC1, "CMP", compareWithAccumulator, IndirectX, READ, 6)                  \
+  OP(0xC4, "CPY", compareWithY, ZeroPage, READ, 3)                             \
+  OP(0xC5, "CMP", compareWithAccumulator, ZeroPage, READ, 3)                   \
+  OP(0xC6, "DEC", decrement, ZeroPage, MODIFY, 5)                              \
+  OP(0xC8, "INY", incrementY, Implied, IMPLIED, 2)                             \
+  OP(0xC9, "CMP", compareWithAccumulator, Immediate, READ, 2)                  \
+  OP(0xCA, "DEX", decrementX, Implied, IMPLIED, 2)                             \
+  OP(0xCC, "CPY", compareWithY, Absolute, READ, 4)                             \
+  OP(0xCD, "CMP", compareWithAccumulator, Absolute, READ, 4)                   \
+  OP(0xCE, "DEC", decrement, Absolute, MODIFY, 6)                              \
+  OP(0xD0, "BNE", isZeroFlagClear, Relative, BRANCH, 2)                        \
+  OP(0xD1, "CMP", compareWithAccumulator, IndirectY, READ, 5)                  \
+  OP(0xD5, "CMP", compareWithAccumulator, ZeroPageX, READ, 4)                  \
+  OP(0xD6, "DEC", decrement, ZeroPageX, MODIFY, 6)                             \
+  OP(0xD8, "CLD", clearDecimal, Implied, IMPLIED, 2)                           \
+  OP(0xD9, "CMP", compareWithAccumulator, AbsoluteY, READ, 4)                  \
+  OP(0xDD, "CMP", compareWithAccumulator, AbsoluteX, READ, 4)                  \
+  OP(0xDE, "DEC", decrement, AbsoluteX, MODIFY, 7)                             \
+  OP(0xE0, "CPX", compareWithX, Immediate, READ, 2)                            \
+  OP(0xE1, "SBC", subtractWithCarry, IndirectX, READ, 6)                       \
+  OP(0xE4, "CPX", compareWithX, ZeroPage, READ, 3)                             \
+  OP(0xE5, "SBC", subtractWithCarry, ZeroPage, READ, 3)                        \
+  OP(0xE6, "INC", increment, ZeroPage, MODIFY, 5)                              \
+  OP(0xE8, "INX", incrementX, Implied, IMPLIED, 2)                             \
+  OP(0xE9, "SBC", subtractWithCarry, Immediate, READ, 2)                       \
+  OP(0xEA, "NOP", noOperation, Implied, IMPLIED, 2)                            \
+  OP(0xEC, "CPX", compareWithX, Absolute, READ, 4)                             \
+  OP(0xED, "SBC", subtractWithCarry, Absolute, READ, 4)                        \
+  OP(0xEE, "INC", increment, Absolute, MODIFY, 6)                              \
+  OP(0xF0, "BEQ", isZeroFlagSet, Relative, BRANCH, 2)                          \
+  OP(0xF1, "SBC", subtractWithCarry, IndirectY, READ, 5)                       \
+  OP(0xF5, "SBC", subtractWithCarry, ZeroPageX, READ, 4)                       \
+  OP(0xF6, "INC", increment, ZeroPageX, MODIFY, 6)                             \
+  OP(0xF8, "SED", setDecimal, Implied, IMPLIED, 2)                             \
+  OP(0xF9, "SBC", subtractWithCarry, AbsoluteY, READ, 4)                       \
+  OP(0xFD, "SBC", subtractWithCarry, AbsoluteX, READ, 4)                       \
+  OP(0xFE, "INC", increment, AbsoluteX, MODIFY, 7)
+
+// How each kind of access wires the addressing mode to the operation. These
+// expand in place inside run(), so every opcode gets its own specialized
+// code with no calls left in it.
+#define EXECUTE_READ(cpu, operation, mode)                                     \
+  operation(cpu, read##mode(cpu, FETCH_##mode(cpu)))
+#define EXECUTE_WRITE(cpu, operation, mode)                                    \
+  writeBus(cpu, address##mode(cpu, FETCH_##mode(cpu)), operation(cpu))
+#define EXECUTE_MODIFY(cpu, operation, mode)                                   \
+  do {                                                                         \
+    uint16_t address = address##mode(cpu, FETCH_##mode(cpu));                 \
+    writeBus(cpu, address, operation(cpu, readBus(cpu, address)));             \
+  } while (0)
+#define EXECUTE_ACCUMULATOR(cpu, operation, mode)                              \
+  cpu->A = operation(cpu, cpu->A)
+#define EXECUTE_BRANCH(cpu, operation, mode)                                   \
+  do {                                                                         \
+    uint16_t at = cpu->PC - 1;                                                 \
+    branchRelative(cpu, operation(cpu));                                       \
+    IDLE_LOOP_CHECK(cpu, at);                                                  \
+    RESUME_BLOCKS(cpu);                                                        \
+  } while (0)
+#define EXECUTE_JUMP(cpu, operation, mode)                                     \
+  do {                                                                         \
+    uint16_t at = cpu->PC - 1;                                                 \
+    operation(cpu, address##mode(cpu, FETCH_##mode(cpu)));                     \
+    IDLE_LOOP_CHECK(cpu, at);                                                  \
+    RESUME_BLOCKS(cpu);                                                        \
+  } while (0)
+#define EXECUTE_IMPLIED(cpu, operation, mode) operation(cpu)
+
+// Instruction length in bytes for each addressing mode
+#define LENGTH_Implied 1
+#define LENGTH_Accumulator 1
+#define LENGTH_Immediate 2
+#define LENGTH_ZeroPage 2
+#define LENGTH_ZeroPageX 2
+#define LENGTH_ZeroPageY 2
+#define LENGTH_Relative 2
+#define LENGTH_IndirectX 2
+#define LENGTH_IndirectY 2
+#define LENGTH_Absolute 3
+#define LENGTH_AbsoluteX 3
+#define LENGTH_AbsoluteY 3
+#define LENGTH_Indirect 3
+
+// Entries left out of the tables (NULL, 0) are undocumented opcodes, which
+// run as two cycle, single byte NOPs.
+#define UNKNOWN_OPCODE_CYCLES 2
+
+// Every opcode OPCODE_TABLE leaves out, for the tables that need all 256
+// entries filled in
+#define UNKNOWN_OPCODES(X)                                                     \
+  X(0x02) X(0x03) X(0x04) X(0x07) X(0x0B) X(0x0C) X(0x0F) X(0x12) X(0x13)      \
+  X(0x14) X(0x17) X(0x1A) X(0x1B) X(0x1C) X(0x1F) X(0x22) X(0x23) X(0x27)      \
+  X(0x2B) X(0x2F) X(0x32) X(0x33) X(0x34) X(0x37) X(0x3A) X(0x3B) X(0x3C)      \
+  X(0x3F) X(0x42) X(0x43) X(0x44) X(0x47) X(0x4B) X(0x4F) X(0x52) X(0x53)      \
+  X(0x54) X(0x57) X(0x5A) X(0x5B) X(0x5C) X(0x5F) X(0x62) X(0x63) X(0x64)      \
+  X(0x67) X(0x6B) X(0x6F) X(0x72) X(0x73) X(0x74) X(0x77) X(0x7A) X(0x7B)      \
+  X(0x7C) X(0x7F) X(0x80) X(0x82) X(0x83) X(0x87) X(0x89) X(0x8B) X(0x8F)      \
+  X(0x92) X(0x93) X(0x97) X(0x9B) X(0x9C) X(0x9E) X(0x9F) X(0xA3) X(0xA7)      \
+  X(0xAB) X(0xAF) X(0xB2) X(0xB3) X(0xB7) X(0xBB) X(0xBF) X(0xC2) X(0xC3)      \
+  X(0xC7) X(0xCB) X(0xCF) X(0xD2) X(0xD3) X(0xD4) X(0xD7) X(0xDA) X(0xDB)      \
+  X(0xDC) X(0xDF) X(0xE2) X(0xE3) X(0xE7) X(0xEB) X(0xEF) X(0xF2) X(0xF3)      \
+  X(0xF4) X(0xF7) X(0xFA) X(0xFB) X(0xFC) X(0xFF)
+
+#define OP(code, mnemonic, operation, mode, kind, cycles) +1
+#define X(code) +1
+static_assert(0 OPCODE_TABLE(OP) UNKNOWN_OPCODES(X) == NUMBER_OF_INSTRUCTIONS,
+              "Every opcode is either in OPCODE_TABLE or UNKNOWN_OPCODES");
+#undef X
+#undef OP
+
+#define OP(code, mnemonic, operation, mode, kind, cycles) [code] = mnemonic,
+static const char *const nameTable[NUMBER_OF_INSTRUCTIONS] = {
+    OPCODE_TABLE(OP)};
+#undef OP
+
+#define OP(code, mnemonic, operation, mode, kind, cycles) [code] = cycles,
+static const uint8_t cycleTable[NUMBER_OF_INSTRUCTIONS] = {OPCODE_TABLE(OP)};
+#undef OP
+
+#define OP(code, mnemonic, operation, mode, kind, cycles)                      \
+  [code] = LENGTH_##mode,
+static const uint8_t lengthTable[NUMBER_OF_INSTRUCTIONS] = {OPCODE_TABLE(OP)};
+#undef OP
+
+#define OP(code, mnemonic, operation, mode, kind, cycles) [code] = Mode##mode,
+static const uint8_t modeTable[NUMBER_OF_INSTRUCTIONS] = {OPCODE_TABLE(OP)};
+#undef OP
+
+#if defined(NES_IDLE_SKIP) || defined(NES_BLOCK_CACHE)
+// The kinds of access of OPCODE_TABLE
+typedef enum {
+  AccessREAD,
+  AccessWRITE,
+  AccessMODIFY,
+  AccessACCUMULATOR,
+  AccessBRANCH,
+  AccessJUMP,
+  AccessIMPLIED,
+} AccessKind;
+
+#define OP(code, mnemonic, operation, mode, kind, cycles) [code] = Access##kind,
+static const uint8_t kindTable[NUMBER_OF_INSTRUCTIONS] = {OPCODE_TABLE(OP)};
+#undef OP
+#endif
+
+#ifdef NES_IDLE_SKIP
+// Idle loops. Games mostly wait for the next frame in a loop like
+// BIT $2002 / BPL or LDA $zp / BEQ, or a plain JMP to itself, until the
+// vblank flag or the NMI handler lets them out, and nothing of that can
+// happen before run() reaches its cycle limit. When a backward jump closes
+// a short loop that writes nothing and reads no controller, and a pass
+// through it left every register as it found it, every later pass is the
+// same one too, so the passes that fit before the limit are skipped by
+// adding up their cycles. The state afterwards is exactly what running them
+// would have left. Reading PPUSTATUS is fine: once a pass has cleared the
+// vblank flag, the next ones find it clear.
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8
+// Loops are only looked for in ROM, code in RAM could change under them
+#define IDLE_LOOP_LOWEST_ADDRESS 0x8000
+
+// A through the lazy flags, whatever NES_LAZY_FLAGS leaves in between
+#define IDLE_REGISTERS (offsetof(CPU, Cycles) - offsetof(CPU, A))
+static_assert(IDLE_REGISTERS <= IDLE_REGISTER_BYTES,
+              "The registers the idle loop detector compares don't fit");
+
+// Whether the instruction can be in the body of an idle loop. Counters
+// (INX, DEY...) never repeat, the stack instructions move S or write,
+// indexed absolute or indirect reads could reach a controller, or take an
+// extra cycle on some passes, and a branch could leave the loop halfway.
+static bool isIdleSafe(uint8_t opcode, uint16_t operand) {
+  if (nameTable[opcode] == NULL) {
+    return false;
+  }
+  switch (kindTable[opcode]) {
+  case AccessREAD:
+    switch (modeTable[opcode]) {
+    case ModeImmediate:
+    case ModeZeroPage:
+    case ModeZeroPageX:
+    case ModeZeroPageY:
+      return true;
+    case ModeAbsolute:
+      return operand != 0x4016 && operand != 0x4017;
+    default:
+      return false;
+    }
+  case AccessACCUMULATOR:
+    return true;
+  case AccessIMPLIED:
+    switch (opcode) {
+    case 0x00: // BRK
+    case 0x08: // PHP
+    case 0x28: // PLP
+    case 0x40: // RTI
+    case 0x48: // PHA
+    case 0x60: // RTS
+    case 0x68: // PLA
+    case 0x88: // DEY
+    case 0xC8: // INY
+    case 0xCA: // DEX
+    case 0xE8: // INX
+      return false;
+    default:
+      return true;
+    }
+  default:
+    return false;
+  }
 }
 
-// 0x8E
-void storeXAbsolute(CPU *cpu) {
-  uint16_t memAddr = fetchAbsoluteAddress(cpu);
-  cpu->Memory[memAddr] = cpu->X;
+// Works out whether the loop from head to the jump at backEdge can be
+// skipped, and how long one pass straight through it takes
+static void findIdleLoop(const CPU *cpu, IdleLoop *idle, uint16_t head,
+                         uint16_t backEdge) {
+  memset(idle, 0, sizeof(IdleLoop));
+  idle->BackEdge = backEdge;
+  if (head < IDLE_LOOP_LOWEST_ADDRESS ||
+      backEdge - head > 3 * IDLE_LOOP_MAX_INSTRUCTIONS) {
+    return;
+  }
+  uint8_t jump = readCode(cpu, backEdge);
+  if (jump != 0x4C && kindTable[jump] != AccessBRANCH) {
+    return;
+  }
+  int instructions = 1;
+  int cycles = cycleTable[jump];
+  if (jump != 0x4C) {
+    // Taken, maybe onto another page
+    uint16_t next = backEdge + 2;
+    cycles += 1 + ((next & 0xFF00) != (head & 0xFF00));
+  }
+  uint16_t pc = head;
+  while (pc < backEdge) {
+    uint8_t opcode = readCode(cpu, pc);
+    uint16_t operand = readCode(cpu, pc + 1) | readCode(cpu, pc + 2) << 8;
+    if (!isIdleSafe(opcode, operand) ||
+        ++instructions > IDLE_LOOP_MAX_INSTRUCTIONS) {
+      return;
+    }
+    cycles += cycleTable[opcode];
+    pc += lengthTable[opcode];
+  }
+  if (pc == backEdge) {
+    idle->Instructions = instructions;
+    idle->Cycles = cycles;
+  }
 }
 
-// STX Store Index Y in Memory
-// 0x84
-void storeYZeroPage(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu);
-  cpu->Memory[memAddr] = cpu->Y;
+// Called when the branch or JMP at backEdge has just jumped backwards.
+// Returns how many instructions it skipped, at most budget.
+static uint64_t skipIdleLoop(CPU *cpu, uint16_t backEdge, uint64_t budget,
+                             uint64_t cycleLimit) {
+  IdleLoop *idle = &cpu->Idle;
+  const uint8_t *registers = &cpu->A;
+  if (idle->BackEdge != backEdge) {
+    findIdleLoop(cpu, idle, cpu->PC, backEdge);
+  }
+#ifdef NES_TRACE
+  if (cpu->Tracer != NULL) {
+    return 0;
+  }
+#endif
+#ifdef NES_PROFILE
+  if (cpu->Profiler != NULL) {
+    return 0;
+  }
+#endif
+  // The last pass has to have gone straight through the loop, with no
+  // interrupt or exit in between, and changed nothing
+  bool repeats = idle->Taken != 0 &&
+                 cpu->Cycles - idle->Taken == idle->Cycles &&
+                 memcmp(idle->Registers, registers, IDLE_REGISTERS) == 0;
+  idle->Taken = cpu->Cycles;
+  memcpy(idle->Registers, registers, IDLE_REGISTERS);
+  if (!repeats || idle->Instructions == 0 || cpu->Cycles >= cycleLimit) {
+    return 0;
+  }
+  uint64_t passes = (cycleLimit - cpu->Cycles) / idle->Cycles;
+  if (passes > budget / idle->Instructions) {
+    passes = budget / idle->Instructions;
+  }
+  cpu->Cycles += passes * idle->Cycles;
+  idle->Taken = cpu->Cycles;
+  return passes * idle->Instructions;
+}
+
+bool isIdleLoop(const CPU *cpu, uint16_t head, uint16_t backEdge) {
+  IdleLoop idle;
+  findIdleLoop(cpu, &idle, head, backEdge);
+  return idle.Instructions != 0;
+}
+
+// Busy loops that are known not to be idle, like copies and delays, only
+// pay for the comparisons
+#define IDLE_LOOP_CHECK(cpu, at)                                               \
+  do {                                                                         \
+    if ((cpu)->PC <= (at) &&                                                   \
+        ((cpu)->Idle.BackEdge != (at) || (cpu)->Idle.Instructions != 0)) {     \
+      executed += skipIdleLoop(cpu, at, count - executed, cycleLimit);         \
+    }                                                                          \
+  } while (0)
+#else
+#define IDLE_LOOP_CHECK(cpu, at) ((void)(at))
+#endif
+
+#ifdef NES_BLOCK_CACHE
+#if !defined(__GNUC__)
+#error "The block cache needs the computed goto of GCC or Clang"
+#endif
+
+// Fused LDA/STA pairs, by the modes and opcodes of the load and the store
+#define FUSED_LOAD_STORE(X)                                                    \
+  X(Immediate, 0xA9, ZeroPage, 0x85)                                           \
+  X(Immediate, 0xA9, Absolute, 0x8D)                                           \
+  X(ZeroPage, 0xA5, ZeroPage, 0x85)                                            \
+  X(ZeroPage, 0xA5, Absolute, 0x8D)                                            \
+  X(Absolute, 0xAD, ZeroPage, 0x85)                                            \
+  X(Absolute, 0xAD, Absolute, 0x8D)
+
+// Handlers of the block cache past the one for each opcode
+enum {
+  HandlerUnknown = NUMBER_OF_INSTRUCTIONS,
+  // Sets PC after a block that doesn't end in a jump
+  HandlerEnd,
+  HandlerDexBne,
+  HandlerDeyBne,
+  HandlerInxCpxBne,
+  HandlerInyCpyBne,
+#define X(load, loadCode, store, storeCode) HandlerLda##load##Sta##store,
+  FUSED_LOAD_STORE(X)
+#undef X
+  BLOCK_HANDLERS
+};
+
+// Counting loops: the step of the counter, the compare with an immediate
+// when there is one (0 when not) and BNE, fused into one entry
+static const struct {
+  uint8_t Step;
+  uint8_t Compare;
+  uint16_t Handler;
+} loopFusions[] = {
+    {0xCA, 0x00, HandlerDexBne},
+    {0x88, 0x00, HandlerDeyBne},
+    {0xE8, 0xE0, HandlerInxCpxBne},
+    {0xC8, 0xC0, HandlerInyCpyBne},
+};
+
+static const struct {
+  uint8_t Load;
+  uint8_t Store;
+  uint16_t Handler;
+} loadStoreFusions[] = {
+#define X(load, loadCode, store, storeCode)                                    \
+  {loadCode, storeCode, HandlerLda##load##Sta##store},
+    FUSED_LOAD_STORE(X)
+#undef X
+};
+
+// Whether the instruction changes PC, so that nothing after it belongs to
+// its block
+static bool endsBlock(uint8_t opcode) {
+  return kindTable[opcode] == AccessBRANCH || kindTable[opcode] == AccessJUMP ||
+         opcode == 0x00 || opcode == 0x40 || opcode == 0x60;
+}
+
+INLINE bool isRomPage(const CPU *cpu, uint16_t address) {
+  int page = address >> BUS_PAGE_SHIFT;
+  return cpu->ReadPages[page] != NULL && cpu->WritePages[page] == NULL;
+}
+
+// Whether the length bytes from address on are ROM, mapped for reading only.
+// An instruction is never longer than a page, so its first and last byte
+// tell.
+INLINE bool isRomCode(const CPU *cpu, uint16_t address, int length) {
+  return isRomPage(cpu, address) && isRomPage(cpu, address + length - 1);
+}
+
+// Decodes the instruction in bytes, which is at pc, into entry and adds it
+// to the block
+static void decodeInstruction(Block *block, BlockEntry *entry,
+                              const uint8_t *bytes, uint16_t pc,
+                              const void *const *handlers) {
+  uint8_t opcode = bytes[0];
+  uint8_t length = getInstructionLength(opcode);
+  entry->Handler =
+      handlers[nameTable[opcode] != NULL ? opcode : HandlerUnknown];
+  entry->Operand = length == 3 ? bytes[1] | bytes[2] << 8 : bytes[1];
+  entry->Next = pc + length;
+  entry->Target = 0;
+  entry->TakenCycles = 0;
+  if (nameTable[opcode] != NULL && modeTable[opcode] == ModeRelative) {
+    entry->Target = entry->Next + (int8_t)bytes[1];
+    entry->TakenCycles =
+        1 + ((entry->Next & 0xFF00) != (entry->Target & 0xFF00));
+  }
+  block->Instructions++;
+  block->Cycles += getInstructionCycles(opcode);
 }
 
-// 0x94
-void storeYZeroPageX(CPU *cpu) {
-  uint16_t memAddr = fetchZeroPageAddress(cpu) + cpu->X;
-  cpu->Memory[memAddr] = cpu->Y;
+int readRomInstruction(const CPU *cpu, uint16_t pc, uint8_t *bytes) {
+  bytes[0] = readCode(cpu, pc);
+  int length = getInstructionLength(bytes[0]);
+  if (!isRomCode(cpu, pc, length)) {
+    return 0;
+  }
+  for (int i = 1; i < 3; i++) {
+    bytes[i] = i < length ? readCode(cpu, pc + i) : 0;
+  }
+  return length;
+}
+
+// Tries to fuse the instruction at pc with the ones after it into entry.
+// room is how many more instructions the block can take. Returns how many
+// instructions were fused, 0 when there is no match.
+static int fuseInstructions(CPU *cpu, Block *block, BlockEntry *entry,
+                            uint16_t pc, int room,
+                            const void *const *handlers) {
+  uint8_t first[3], second[3], third[3];
+  int firstLength = readRomInstruction(cpu, pc, first);
+  int secondLength = readRomInstruction(cpu, pc + firstLength, second);
+  if (room < 2 || firstLength == 0 || secondLength == 0) {
+    return 0;
+  }
+  uint16_t next = pc + firstLength + secondLength;
+  for (size_t i = 0;
+       i < sizeof(loadStoreFusions) / sizeof(loadStoreFusions[0]); i++) {
+    if (first[0] == loadStoreFusions[i].Load &&
+        second[0] == loadStoreFusions[i].Store) {
+      decodeInstruction(block, entry, first, pc, handlers);
+      entry->Handler = handlers[loadStoreFusions[i].Handler];
+      entry->Target =
+          secondLength == 3 ? second[1] | second[2] << 8 : second[1];
+      entry->Next = next;
+      block->Instructions++;
+      block->Cycles += getInstructionCycles(second[0]);
+      return 2;
+    }
+  }
+  for (size_t i = 0; i < sizeof(loopFusions) / sizeof(loopFusions[0]); i++) {
+    if (first[0] != loopFusions[i].Step) {
+      continue;
+    }
+    uint8_t *branch = second;
+    uint16_t branchAt = pc + firstLength;
+    int fused = 2;
+    if (loopFusions[i].Compare != 0) {
+      if (room < 3 || second[0] != loopFusions[i].Compare ||
+          readRomInstruction(cpu, next, third) == 0) {
+        return 0;
+      }
+      branch = third;
+      branchAt = next;
+      fused = 3;
+    }
+    if (branch[0] != 0xD0) {
+      return 0;
+    }
+    // The entry is the branch, with the cycles and instructions before it
+    decodeInstruction(block, entry, branch, branchAt, handlers);
+    entry->Handler = handlers[loopFusions[i].Handler];
+    entry->Operand = second[1];
+    block->Instructions += fused - 1;
+    block->Cycles += getInstructionCycles(first[0]) +
+                     (fused == 3 ? getInstructionCycles(second[0]) : 0);
+    return fused;
+  }
+  return 0;
+}
+
+// Decodes the block at PC, which has to be in ROM
+static Block *decodeBlock(CPU *cpu, const void *const *handlers) {
+  uint16_t pc = cpu->PC;
+  uint8_t bytes[3];
+  Block *block = blockCacheAllocate(cpu->Blocks, pc);
+  BlockEntry *entry = block->Code;
+  while (block->Instructions < BLOCK_MAX_INSTRUCTIONS &&
+         readRomInstruction(cpu, pc, bytes) != 0) {
+    int room = BLOCK_MAX_INSTRUCTIONS - block->Instructions;
+    int fused = fuseInstructions(cpu, block, entry, pc, room, handlers);
+    if (fused == 0) {
+      decodeInstruction(block, entry, bytes, pc, handlers);
+    }
+    pc = entry->Next;
+    // Fused loops end in their branch
+    if (fused == 0 ? endsBlock(bytes[0]) : entry->TakenCycles != 0) {
+      return block;
+    }
+    entry++;
+  }
+  entry->Handler = handlers[HandlerEnd];
+  entry->Next = pc;
+  return block;
+}
+
+// How the block handlers run each kind of access, with the operand decoded
+// already. Whatever changes PC ends the block.
+#define BLOCK_EXECUTE_READ(cpu, operation, mode, code)                         \
+  operation(cpu, read##mode(cpu, entry->Operand))
+#define BLOCK_EXECUTE_WRITE(cpu, operation, mode, code)                        \
+  writeBus(cpu, address##mode(cpu, entry->Operand), operation(cpu))
+#define BLOCK_EXECUTE_MODIFY(cpu, operation, mode, code)                       \
+  do {                                                                         \
+    uint16_t address = address##mode(cpu, entry->Operand);                     \
+    writeBus(cpu, address, operation(cpu, readBus(cpu, address)));             \
+  } while (0)
+#define BLOCK_EXECUTE_ACCUMULATOR(cpu, operation, mode, code)                  \
+  cpu->A = operation(cpu, cpu->A)
+#define BLOCK_EXECUTE_BRANCH(cpu, operation, mode, code)                       \
+  BLOCK_BRANCH(cpu, operation)
+#define BLOCK_EXECUTE_JUMP(cpu, operation, mode, code)                         \
+  do {                                                                         \
+    uint16_t at = entry->Next - LENGTH_##mode;                                 \
+    cpu->PC = entry->Next;                                                     \
+    operation(cpu, address##mode(cpu, entry->Operand));                        \
+    IDLE_LOOP_CHECK(cpu, at);                                                  \
+    goto nextBlock;                                                            \
+  } while (0)
+// BRK needs PC, RTS and RTI set it
+#define BLOCK_EXECUTE_IMPLIED(cpu, operation, mode, code)                      \
+  do {                                                                         \
+    if (code == 0x00 || code == 0x40 || code == 0x60) {                        \
+      cpu->PC = entry->Next;                                                   \
+      operation(cpu);                                                          \
+      goto nextBlock;                                                          \
+    }                                                                          \
+    operation(cpu);                                                            \
+  } while (0)
+
+// Code outside ROM is interpreted. Jumps and branches there look for the
+// way back into ROM, and the blocks.
+#define RESUME_BLOCKS(cpu)                                                     \
+  do {                                                                         \
+    if (resumeBlocks && isRomCode(cpu, (cpu)->PC, 3)) {                        \
+      goto nextBlock;                                                          \
+    }                                                                          \
+  } while (0)
+
+// The base cycles of a taken branch are in the block already
+#define BLOCK_BRANCH(cpu, condition)                                           \
+  do {                                                                         \
+    uint16_t at = entry->Next - 2;                                             \
+    if (condition(cpu)) {                                                      \
+      cpu->Cycles += entry->TakenCycles;                                       \
+      cpu->PC = entry->Target;                                                 \
+    } else {                                                                   \
+      cpu->PC = entry->Next;                                                   \
+    }                                                                          \
+    IDLE_LOOP_CHECK(cpu, at);                                                  \
+    goto nextBlock;                                                            \
+  } while (0)
+#else
+#define RESUME_BLOCKS(cpu) ((void)0)
+#endif
+
+const char *getInstructionName(uint8_t code) {
+  return nameTable[code] != NULL ? nameTable[code] : "???";
+}
+
+uint8_t getInstructionLength(uint8_t code) {
+  return lengthTable[code] != 0 ? lengthTable[code] : 1;
+}
+
+uint8_t getInstructionCycles(uint8_t code) {
+  return cycleTable[code] != 0 ? cycleTable[code] : UNKNOWN_OPCODE_CYCLES;
+}
+
+AddressingMode getAddressingMode(uint8_t code) { return modeTable[code]; }
+
+const char *getAddressingModeName(AddressingMode mode) {
+  static const char *const names[] = {
+      [ModeImplied] = "Implied",     [ModeAccumulator] = "Accumulator",
+      [ModeImmediate] = "Immediate", [ModeZeroPage] = "ZeroPage",
+      [ModeZeroPageX] = "ZeroPageX", [ModeZeroPageY] = "ZeroPageY",
+      [ModeAbsolute] = "Absolute",   [ModeAbsoluteX] = "AbsoluteX",
+      [ModeAbsoluteY] = "AbsoluteY", [ModeIndirect] = "Indirect",
+      [ModeIndirectX] = "IndirectX", [ModeIndirectY] = "IndirectY",
+      [ModeRelative] = "Relative",
+  };
+  return names[mode];
+}
+
+// Reads the bus like an instruction would, side effects of I/O registers
+// included
+uint8_t readMemory(CPU *cpu, uint16_t address) {
+  return readBus(cpu, address);
 }
 
-// 0x8C
-void storeYAbsolute(CPU *cpu) {
-  uint16_t memAddr = fetchAbsoluteAddress(cpu);
-  cpu->Memory[memAddr] = cpu->Y;
+// Writes the instruction at address in assembler syntax, for example
+// "LDA $0200,X", and returns its length. Reads through readCode, never the
+// I/O registers, so it is safe to call between instructions.
+int disassembleInstruction(CPU *cpu, uint16_t address, char *buffer,
+                           int size) {
+  uint8_t code = readCode(cpu, address);
+  uint8_t ll = readCode(cpu, address + 1);
+  uint8_t hh = readCode(cpu, address + 2);
+  uint16_t word = (uint16_t)hh << 8 | ll;
+  const char *name = getInstructionName(code);
+
+  switch (getAddressingMode(code)) {
+  case ModeAccumulator:
+    snprintf(buffer, size, "%s A", name);
+    break;
+  case ModeImmediate:
+    snprintf(buffer, size, "%s #$%02X", name, ll);
+    break;
+  case ModeZeroPage:
+    snprintf(buffer, size, "%s $%02X", name, ll);
+    break;
+  case ModeZeroPageX:
+    snprintf(buffer, size, "%s $%02X,X", name, ll);
+    break;
+  case ModeZeroPageY:
+    snprintf(buffer, size, "%s $%02X,Y", name, ll);
+    break;
+  case ModeAbsolute:
+    snprintf(buffer, size, "%s $%04X", name, word);
+    break;
+  case ModeAbsoluteX:
+    snprintf(buffer, size, "%s $%04X,X", name, word);
+    break;
+  case ModeAbsoluteY:
+    snprintf(buffer, size, "%s $%04X,Y", name, word);
+    break;
+  case ModeIndirect:
+    snprintf(buffer, size, "%s ($%04X)", name, word);
+    break;
+  case ModeIndirectX:
+    snprintf(buffer, size, "%s ($%02X,X)", name, ll);
+    break;
+  case ModeIndirectY:
+    snprintf(buffer, size, "%s ($%02X),Y", name, ll);
+    break;
+  case ModeRelative:
+    snprintf(buffer, size, "%s $%04X", name,
+             (uint16_t)(address + 2 + (int8_t)ll));
+    break;
+  default:
+    snprintf(buffer, size, "%s", name);
+  }
+  return getInstructionLength(code);
+}
+
+// Runs instructions until count of them have executed or cpu->Cycles has
+// reached cycleLimit, whichever comes first, and returns how many ran.
+// With GCC/Clang every opcode is reached through a computed goto and jumps
+// straight to the next opcode's label when it is done. Other compilers get
+// an equivalent switch.
+static uint64_t run(CPU *cpu, uint64_t count, uint64_t cycleLimit) {
+  uint64_t executed = 0;
+  uint8_t opcode;
+#ifdef NES_IDLE_SKIP
+  // Between calls the vblank flag, the buttons or memory may have changed,
+  // so a pass seen before doesn't say anything about the next one
+  cpu->Idle.Taken = 0;
+#endif
+
+#if defined(__GNUC__)
+#define OP(code, mnemonic, operation, mode, kind, cycles) [code] = &&op_##code,
+#define X(code) [code] = &&op_unknown,
+  static const void *dispatchTable[NUMBER_OF_INSTRUCTIONS] = {
+      OPCODE_TABLE(OP) UNKNOWN_OPCODES(X)};
+#undef X
+#undef OP
+
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (executed == count || cpu->Cycles >= cycleLimit) {                      \
+      return executed;                                                         \
+    }                                                                          \
+    executed++;                                                                \
+    opcode = readBus(cpu, cpu->PC);                                            \
+    TRACE_INSTRUCTION(cpu, opcode);                                            \
+    PROFILE_INSTRUCTION(cpu, opcode);                                          \
+    cpu->PC++;                                                                 \
+    cpu->Cycles += cycleTable[opcode];                                         \
+    goto *dispatchTable[opcode];                                               \
+  } while (0)
+
+#ifdef NES_BLOCK_CACHE
+#define OP(code, mnemonic, operation, mode, kind, cycles)                      \
+  [code] = &&block_##code,
+#define X(load, loadCode, store, storeCode)                                    \
+  [HandlerLda##load##Sta##store] = &&fused_lda_##load##_sta_##store,
+  static const void *blockHandlers[BLOCK_HANDLERS] = {
+      OPCODE_TABLE(OP) FUSED_LOAD_STORE(X)
+      [HandlerUnknown] = &&block_unknown,
+      [HandlerEnd] = &&block_end,
+      [HandlerDexBne] = &&fused_dex_bne,
+      [HandlerDeyBne] = &&fused_dey_bne,
+      [HandlerInxCpxBne] = &&fused_inx_cpx_bne,
+      [HandlerInyCpyBne] = &&fused_iny_cpy_bne};
+#undef X
+#undef OP
+  Block *block;
+  // Only read in a block, which sets it first
+  BlockEntry *entry = NULL;
+  bool resumeBlocks = false;
+  // A whole block fits while executed and Cycles are below these
+  uint64_t blockCountLimit =
+      count >= BLOCK_MAX_INSTRUCTIONS ? count - BLOCK_MAX_INSTRUCTIONS + 1 : 0;
+  uint64_t blockCycleLimit =
+      cycleLimit > BLOCK_MAX_CYCLES ? cycleLimit - BLOCK_MAX_CYCLES : 0;
+#ifdef NES_JIT
+  // Set when native code has just given the CPU back
+  bool jitReturned = false;
+#endif
+  bool interpreted = cpu->Blocks == NULL;
+#ifdef NES_TRACE
+  interpreted = interpreted || cpu->Tracer != NULL;
+#endif
+#ifdef NES_PROFILE
+  interpreted = interpreted || cpu->Profiler != NULL;
+#endif
+  if (!interpreted) {
+    goto nextBlock;
+  }
+#endif
+  DISPATCH();
+
+#define OP(code, mnemonic, operation, mode, kind, cycles)                      \
+  op_##code : EXECUTE_##kind(cpu, operation, mode);                            \
+  DISPATCH();
+  OPCODE_TABLE(OP)
+#undef OP
+
+op_unknown:
+  cpu->Cycles += UNKNOWN_OPCODE_CYCLES;
+  DISPATCH();
+
+#ifdef NES_BLOCK_CACHE
+  // A whole block runs before the counts are looked at again, so the last
+  // few instructions of the run, where the next block might not fit, are
+  // left to the interpreter
+nextBlock:
+  if (executed >= blockCountLimit || cpu->Cycles >= blockCycleLimit) {
+    resumeBlocks = false;
+    DISPATCH();
+  }
+#ifdef NES_JIT
+  // Native code goes from translation to translation by itself. Whatever
+  // made it come back is then run by the blocks once, otherwise an access
+  // it leaves to the interpreter would send it straight back in.
+  if (cpu->Jit != NULL) {
+    if (!jitReturned && jitCacheFind(cpu->Jit, cpu->PC)) {
+      JitRun native = {.Executed = executed,
+                       .CountLimit = blockCountLimit,
+                       .CycleLimit = blockCycleLimit};
+      jitCacheRun(cpu->Jit, cpu, &native);
+      executed = native.Executed;
+      if (native.AtBackEdge) {
+        IDLE_LOOP_CHECK(cpu, native.BackEdge);
+      }
+      jitReturned = true;
+      goto nextBlock;
+    }
+    jitReturned = false;
+  }
+#endif
+  block = blockCacheFind(cpu->Blocks, cpu->PC);
+  if (block == NULL) {
+    if (!isRomCode(cpu, cpu->PC, 3)) {
+      resumeBlocks = true;
+      DISPATCH();
+    }
+    block = decodeBlock(cpu, blockHandlers);
+  }
+#ifdef NES_JIT
+  if (cpu->Jit != NULL && !block->Untranslatable &&
+      (++block->Runs & (JIT_HOT_RUNS - 1)) == 0 &&
+      !jitCacheFind(cpu->Jit, block->Start)) {
+    block->Untranslatable = !jitCacheTranslate(cpu->Jit, cpu, block->Start);
+  }
+#endif
+  executed += block->Instructions;
+  cpu->Cycles += block->Cycles;
+  entry = block->Code;
+  goto *entry->Handler;
+
+#define OP(code, mnemonic, operation, mode, kind, cycles)                      \
+  block_##code : BLOCK_EXECUTE_##kind(cpu, operation, mode, code);             \
+  entry++;                                                                     \
+  goto *entry->Handler;
+  OPCODE_TABLE(OP)
+#undef OP
+
+#define X(load, loadCode, store, storeCode)                                    \
+  fused_lda_##load##_sta_##store : loadAccumulator(                            \
+      cpu, read##load(cpu, entry->Operand));                                   \
+  writeBus(cpu, address##store(cpu, entry->Target), cpu->A);                   \
+  entry++;                                                                     \
+  goto *entry->Handler;
+  FUSED_LOAD_STORE(X)
+#undef X
+
+fused_dex_bne:
+  decrementX(cpu);
+  BLOCK_BRANCH(cpu, isZeroFlagClear);
+fused_dey_bne:
+  decrementY(cpu);
+  BLOCK_BRANCH(cpu, isZeroFlagClear);
+fused_inx_cpx_bne:
+  incrementX(cpu);
+  compareWithX(cpu, entry->Operand);
+  BLOCK_BRANCH(cpu, isZeroFlagClear);
+fused_iny_cpy_bne:
+  incrementY(cpu);
+  compareWithY(cpu, entry->Operand);
+  BLOCK_BRANCH(cpu, isZeroFlagClear);
+
+block_unknown:
+  entry++;
+  goto *entry->Handler;
+block_end:
+  cpu->PC = entry->Next;
+  goto nextBlock;
+#endif
+#undef DISPATCH
+#else
+  while (executed < count && cpu->Cycles < cycleLimit) {
+    executed++;
+    opcode = readBus(cpu, cpu->PC);
+    TRACE_INSTRUCTION(cpu, opcode);
+    PROFILE_INSTRUCTION(cpu, opcode);
+    cpu->PC++;
+    cpu->Cycles += cycleTable[opcode];
+    switch (opcode) {
+#define OP(code, mnemonic, operation, mode, kind, cycles)                      \
+  case code:                                                                   \
+    EXECUTE_##kind(cpu, operation, mode);                                      \
+    break;
+      OPCODE_TABLE(OP)
+#undef OP
+    default:
+      cpu->Cycles += UNKNOWN_OPCODE_CYCLES;
+      break;
+    }
+  }
+  return executed;
+#endif
 }
 
-// TAX Transfer Accumulator to Index X
-// 0xAA
-void transferAccumulatorToX(CPU *cpu) {
-  uint8_t result = cpu->X;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->X = result;
+uint64_t runInstructions(CPU *cpu, uint64_t count) {
+  return run(cpu, count, UINT64_MAX);
 }
 
-// TAY Transfer Accumulator to Index Y
-// 0xA8
-void transferAccumulatorToY(CPU *cpu) {
-  uint8_t result = cpu->Y;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->Y = result;
+uint64_t runCycles(CPU *cpu, uint64_t cycles) {
+  return run(cpu, UINT64_MAX, cpu->Cycles + cycles);
 }
 
-// TSX Transfer Stack Pointer to Index X
-// 0xBA
-void transferStackPointerToX(CPU *cpu) {
-  uint8_t result = cpu->S;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->X = result;
+// Frames are laid on a fixed grid counted from power-on, so the cycles an
+// instruction overshoots one frame by are taken out of the next one. Every
+// frame ends with the vertical blank, which raises an NMI if PPUCTRL asks for
+// one; that is when games read their controllers.
+uint64_t runFrame(CPU *cpu) {
+  uint64_t frame = cpu->Cycles * 2 / NTSC_HALF_CYCLES_PER_FRAME + 1;
+  uint64_t frameEnd = (frame * NTSC_HALF_CYCLES_PER_FRAME + 1) / 2;
+  uint64_t executed = run(cpu, UINT64_MAX, frameEnd - NTSC_VBLANK_CYCLES);
+  cpu->PpuStatus |= 0x80;
+  if (cpu->PpuControl & 0x80) {
+    interrupt(cpu, 0xFFFA, 0x20);
+    cpu->Cycles += 7;
+  }
+  executed += run(cpu, UINT64_MAX, frameEnd);
+  cpu->PpuStatus &= 0x7F;
+  return executed;
 }
 
-// TXA Transfer Index X to Accumulator
-// 0x8A
-void transferXToAccumulator(CPU *cpu) {
-  uint8_t result = cpu->X;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->A = result;
-}
+void executeInstruction(CPU *cpu) { runInstructions(cpu, 1); }
 
-// TXS Trasnfer Index X to Stack Pointer
-// 0x9A
-void transferXToStackPointer(CPU *cpu) {
-  uint8_t result = cpu->X;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->S = result;
+// Sets PC to the address stored in the reset vector, as the CPU does on
+// power-on.
+void jumpToResetVector(CPU *cpu) {
+  uint16_t ll = readBus(cpu, 0xFFFC);
+  uint16_t hh = readBus(cpu, 0xFFFD);
+  cpu->PC = (hh << 8) + ll;
 }
 
-// TYA Transfer Index Y to Accumulator
-// 0x98
-void transferYToAccumulator(CPU *cpu) {
-  uint8_t result = cpu->Y;
-  setZeroFlagIfZero(cpu, result);
-  setNegativeFlagIfNegative(cpu, result);
-  cpu->A = result;
+// The reset sequence: three stack accesses that only move S, interrupts
+// disabled, and PC loaded from the reset vector, 7 cycles in all. Reset also
+// clears PPUCTRL, so no NMI arrives before the game enables it again.
+void resetProcessor(CPU *cpu) {
+  cpu->S -= 3;
+  cpu->P = cpu->P | 0x04;
+  cpu->PpuControl = 0;
+  cpu->Cycles += 7;
+  jumpToResetVector(cpu);
 }
 
-// void initializeInstructionArray() {
-//   instructions[0] =
-//       (Instruction){.execute = *transferYToAccumulator, .name = "BRK"};
-// }
-
-void initializeInstructionArray() {
-  for (int i = 0; i < 256; i++) {
-    instructions[i] = (Instruction){.name = "???"};
-  }
-
-  instructions[0x00] = (Instruction){.execute = forceBreak, .name = "BRK"};
-  instructions[0x01] =
-      (Instruction){.execute = orAIndirectX, .name = "ORA (oper,X)"};
-  instructions[0x05] =
-      (Instruction){.execute = orAZeroPage, .name = "ORA oper"};
-  instructions[0x06] =
-      (Instruction){.execute = arithmeticShiftLeftZeroPage, .name = "ASL oper"};
-  instructions[0x08] =
-      (Instruction){.execute = pushProcessorStatusOnStack, .name = "PHP"};
-  instructions[0x09] =
-      (Instruction){.execute = orAImmediate, .name = "ORA #oper"};
-  instructions[0x0A] =
-      (Instruction){.execute = arithmeticShiftLeftAccumulator, .name = "ASL"};
-  instructions[0x0D] =
-      (Instruction){.execute = orAAbsolute, .name = "ORA oper"};
-  instructions[0x0E] =
-      (Instruction){.execute = arithmeticShiftLeftAbsolute, .name = "ASL opr"};
-  instructions[0x10] =
-      (Instruction){.execute = branchOnPlusRelative, .name = "BPL oper"};
-  instructions[0x11] =
-      (Instruction){.execute = orAIndirectY, .name = "ORA (oper),Y"};
-  instructions[0x15] =
-      (Instruction){.execute = orAZeroPageX, .name = "ORA oper,X"};
-  instructions[0x16] = (Instruction){.execute = arithmeticShiftLeftZeroPageX,
-                                     .name = "ASL oper,X"};
-  instructions[0x18] = (Instruction){.execute = clearCarry, .name = "CLC"};
-  instructions[0x19] =
-      (Instruction){.execute = orAAbsoluteY, .name = "ORA oper,Y"};
-  instructions[0x1D] =
-      (Instruction){.execute = orAAbsoluteX, .name = "ORA oper,X"};
-  instructions[0x1E] = (Instruction){.execute = arithmeticShiftLeftAbsoluteX,
-                                     .name = "ASL oper,X"};
-  instructions[0x20] =
-      (Instruction){.execute = jumpSubRoutineAbsolute, .name = "JSR"};
-  instructions[0x21] =
-      (Instruction){.execute = andIndirectX, .name = "AND (oper,X)"};
-  instructions[0x24] =
-      (Instruction){.execute = bitTestZeroPage, .name = "BIT oper"};
-  instructions[0x25] =
-      (Instruction){.execute = andZeroPage, .name = "AND oper"};
-  instructions[0x26] =
-      (Instruction){.execute = rotateLeftZeroPage, .name = "ROL oper"};
-  instructions[0x28] =
-      (Instruction){.execute = pullProcessorStatusFromStack, .name = "PLP"};
-  instructions[0x29] =
-      (Instruction){.execute = andImmediate, .name = "AND #oper"};
-  instructions[0x2A] =
-      (Instruction){.execute = rotateLeftAccumulator, .name = "ROL A"};
-  instructions[0x2C] =
-      (Instruction){.execute = bitTestAbsolute, .name = "BIT oper"};
-  instructions[0x2D] =
-      (Instruction){.execute = andAbsolute, .name = "AND oper"};
-  instructions[0x2E] =
-      (Instruction){.execute = rotateLeftAbsolute, .name = "ROL oper"};
-  instructions[0x30] =
-      (Instruction){.execute = branchOnMinusRelative, .name = "BMI"};
-  instructions[0x31] =
-      (Instruction){.execute = andIndirectY, .name = "AND (oper),Y"};
-  instructions[0x35] =
-      (Instruction){.execute = andZeroPageX, .name = "AND oper,X"};
-  instructions[0x36] =
-      (Instruction){.execute = rotateLeftZeroPageX, .name = "ROL oper,X"};
-  instructions[0x38] = (Instruction){.execute = setCarry, .name = "SEC"};
-  instructions[0x39] =
-      (Instruction){.execute = andAbsoluteY, .name = "AND oper,Y"};
-  instructions[0x3D] =
-      (Instruction){.execute = andAbsoluteX, .name = "AND oper,X"};
-  instructions[0x3E] =
-      (Instruction){.execute = rotateLeftAbsoluteX, .name = "ROL oper,X"};
-  instructions[0x40] =
-      (Instruction){.execute = returnFromInterrupt, .name = "RTI"};
-  instructions[0x41] =
-      (Instruction){.execute = exclusiveOrIndirectX, .name = "EOR (oper,X)"};
-  instructions[0x45] =
-      (Instruction){.execute = exclusiveOrZeroPage, .name = "EOR oper"};
-  instructions[0x46] = (Instruction){.execute = logisticalShiftRightZeroPage,
-                                     .name = "LSR oper"};
-  instructions[0x48] =
-      (Instruction){.execute = pushAccumulatorOntoStack, .name = "PHA"};
-  instructions[0x49] =
-      (Instruction){.execute = exclusiveOrImmediate, .name = "EOR #oper"};
-  instructions[0x4A] = (Instruction){.execute = logisticalShiftRightAccumulator,
-                                     .name = "LSR A"};
-  instructions[0x4C] = (Instruction){.execute = jumpAbsolute, .name = "JMP"};
-  instructions[0x4D] =
-      (Instruction){.execute = exclusiveOrAbsolute, .name = "EOR oper"};
-  instructions[0x4E] = (Instruction){.execute = logisticalShiftRightAbsolute,
-                                     .name = "LSR oper"};
-  instructions[0x50] = (Instruction){.execute = branchOnOverflowClearRelative,
-                                     .name = "BVC oper"};
-  instructions[0x51] =
-      (Instruction){.execute = exclusiveOrIndirectY, .name = "EOR (oper),Y"};
-  instructions[0x55] =
-      (Instruction){.execute = exclusiveOrZeroPageX, .name = "EOR oper,X"};
-  instructions[0x56] = (Instruction){.execute = logisticalShiftRightZeroPageX,
-                                     .name = "LSR oper,X"};
-  instructions[0x58] =
-      (Instruction){.execute = clearInterruptDisable, .name = "CLI"};
-  instructions[0x59] =
-      (Instruction){.execute = exclusiveOrAbsoluteY, .name = "EOR oper,Y"};
-  instructions[0x5D] =
-      (Instruction){.execute = exclusiveOrAbsoluteX, .name = "EOR oper,X"};
-  instructions[0x5E] = (Instruction){.execute = logisticalShiftRightAbsoluteX,
-                                     .name = "LSR oper,X"};
-  instructions[0x60] =
-      (Instruction){.execute = returnFromSubroutine, .name = "RTS"};
-  instructions[0x61] =
-      (Instruction){.execute = addWithCarryIndirectX, .name = "ADC (oper,X)"};
-  instructions[0x65] =
-      (Instruction){.execute = addWithCarryZeroPage, .name = "ADC oper"};
-  instructions[0x66] =
-      (Instruction){.execute = rotateRightZeroPage, .name = "ROR oper"};
-  instructions[0x68] =
-      (Instruction){.execute = pullAccumulatorFromStack, .name = "PLA"};
-  instructions[0x69] =
-      (Instruction){.execute = addWithCarryImmediate, .name = "ADC #oper"};
-  instructions[0x6A] =
-      (Instruction){.execute = rotateRightAccumulator, .name = "ROR A"};
-  instructions[0x6C] =
-      (Instruction){.execute = jumpIndirect, .name = "JMP (oper)"};
-  instructions[0x6D] =
-      (Instruction){.execute = addWithCarryAbsolute, .name = "ADC oper"};
-  instructions[0x6E] =
-      (Instruction){.execute = rotateRightAbsolute, .name = "ROR oper"};
-  instructions[0x70] =
-      (Instruction){.execute = branchOnOverflowSetRelative, .name = "BVS"};
-  instructions[0x71] =
-      (Instruction){.execute = addWithCarryIndirectY, .name = "ADC (oper),Y"};
-  instructions[0x75] =
-      (Instruction){.execute = addWithCarryZeroPageX, .name = "ADC oper,X"};
-  instructions[0x76] =
-      (Instruction){.execute = rotateRightZeroPageX, .name = "ROR oper,X"};
-  instructions[0x78] =
-      (Instruction){.execute = setInterruptDisable, .name = "SEI"};
-  instructions[0x79] =
-      (Instruction){.execute = addWithCarryAbsoluteY, .name = "ADC oper,Y"};
-  instructions[0x7D] =
-      (Instruction){.execute = addWithCarryAbsoluteX, .name = "ADC oper,X"};
-  instructions[0x7E] =
-      (Instruction){.execute = rotateRightAbsoluteX, .name = "ROR oper,X"};
-  instructions[0x81] = (Instruction){.execute = storeAccumulatorIndirectX,
-                                     .name = "STA (oper,X)"};
-  instructions[0x84] =
-      (Instruction){.execute = storeYZeroPage, .name = "STY oper"};
-  instructions[0x85] =
-      (Instruction){.execute = storeAccumulatorZeroPage, .name = "STA oper"};
-  instructions[0x86] =
-      (Instruction){.execute = storeXZeroPage, .name = "STX oper"};
-  instructions[0x88] = (Instruction){.execute = decrementY, .name = "DEY"};
-  instructions[0x8A] =
-      (Instruction){.execute = transferXToAccumulator, .name = "TXA"};
-  instructions[0x8C] =
-      (Instruction){.execute = storeYAbsolute, .name = "STY oper"};
-  instructions[0x8D] =
-      (Instruction){.execute = storeAccumulatorAbsolute, .name = "STA oper"};
-  instructions[0x8E] =
-      (Instruction){.execute = storeXAbsolute, .name = "STX oper"};
-  instructions[0x90] =
-      (Instruction){.execute = branchOnClearCarryRelative, .name = "BCC oper"};
-  instructions[0x91] = (Instruction){.execute = storeAccumulatorIndirectY,
-                                     .name = "STA (oper),Y"};
-  instructions[0x94] =
-      (Instruction){.execute = storeYZeroPageX, .name = "STY oper,X"};
-  instructions[0x95] =
-      (Instruction){.execute = storeAccumulatorZeroPageX, .name = "STA oper,X"};
-  instructions[0x96] =
-      (Instruction){.execute = storeXZeroPageY, .name = "STX oper,Y"};
-  instructions[0x98] =
-      (Instruction){.execute = transferYToAccumulator, .name = "TYA"};
-  instructions[0x99] =
-      (Instruction){.execute = storeAccumulatorAbsoluteY, .name = "STA oper,Y"};
-  instructions[0x9A] =
-      (Instruction){.execute = transferXToStackPointer, .name = "TXS"};
-  instructions[0x9D] =
-      (Instruction){.execute = storeAccumulatorAbsoluteX, .name = "STA oper,X"};
-  instructions[0xA0] =
-      (Instruction){.execute = loadYImmediate, .name = "LDY #oper"};
-  instructions[0xA1] = (Instruction){.execute = loadAccumulatorIndirectX,
-                                     .name = "LDA (oper,X)"};
-  instructions[0xA2] =
-      (Instruction){.execute = loadXImmediate, .name = "LDX #oper"};
-  instructions[0xA4] =
-      (Instruction){.execute = loadYZeroPage, .name = "LDY oper"};
-  instructions[0xA5] =
-      (Instruction){.execute = loadAccumulatorZeroPage, .name = "LDA oper"};
-  instructions[0xA6] =
-      (Instruction){.execute = loadXZeroPage, .name = "LDX oper"};
-  instructions[0xA8] =
-      (Instruction){.execute = transferAccumulatorToY, .name = "TAY"};
-  instructions[0xA9] =
-      (Instruction){.execute = loadAccumulatorImmediate, .name = "LDA #oper"};
-  instructions[0xAA] =
-      (Instruction){.execute = transferAccumulatorToX, .name = "TAX"};
-  instructions[0xAC] =
-      (Instruction){.execute = loadYAbsolute, .name = "LDY oper"};
-  instructions[0xAD] =
-      (Instruction){.execute = loadAccumulatorAbsolute, .name = "LDA oper"};
-  instructions[0xAE] =
-      (Instruction){.execute = loadXAbsolute, .name = "LDX oper"};
-  instructions[0xB0] =
-      (Instruction){.execute = branchOnCarrySetRelative, .name = "BCS oper"};
-  instructions[0xB1] = (Instruction){.execute = loadAccumulatorIndirectY,
-                                     .name = "LDA (oper),Y"};
-  instructions[0xB4] =
-      (Instruction){.execute = loadYZeroPageX, .name = "LDY oper,X"};
-  instructions[0xB5] =
-      (Instruction){.execute = loadAccumulatorZeroPageX, .name = "LDA oper,X"};
-  instructions[0xB6] =
-      (Instruction){.execute = loadXZeroPageY, .name = "LDX oper,Y"};
-  instructions[0xB8] = (Instruction){.execute = clearOverflow, .name = "CLV"};
-  instructions[0xB9] =
-      (Instruction){.execute = loadAccumulatorAbsoluteY, .name = "LDA oper,Y"};
-  instructions[0xBA] =
-      (Instruction){.execute = transferStackPointerToX, .name = "TSX"};
-  instructions[0xBC] =
-      (Instruction){.execute = loadYAbsoluteX, .name = "LDY oper,X"};
-  instructions[0xBD] =
-      (Instruction){.execute = loadAccumulatorAbsoluteX, .name = "LDA oper,X"};
-  instructions[0xBE] =
-      (Instruction){.execute = loadXAbsoluteY, .name = "LDX oper,Y"};
-  instructions[0xC0] =
-      (Instruction){.execute = compareWithYImmediate, .name = "CPY #oper"};
-  instructions[0xC1] = (Instruction){.execute = compareWithAccumulatorIndirectX,
-                                     .name = "CMP (oper,X)"};
-  instructions[0xC4] =
-      (Instruction){.execute = compareWithYZeroPage, .name = "CPY oper"};
-  instructions[0xC5] = (Instruction){.execute = compareWithAccumulatorZeroPage,
-                                     .name = "CMP oper"};
-  instructions[0xC6] =
-      (Instruction){.execute = decrementZeroPage, .name = "DEC oper"};
-  instructions[0xC8] = (Instruction){.execute = incrementY, .name = "INY"};
-  instructions[0xC9] = (Instruction){.execute = compareWithAccumulatorImmediate,
-                                     .name = "CMP #oper"};
-  instructions[0xCA] = (Instruction){.execute = decrementX, .name = "DEX"};
-  instructions[0xCC] =
-      (Instruction){.execute = compareWithYAbsolute, .name = "CPY oper"};
-  instructions[0xCD] = (Instruction){.execute = compareWithAccumulatorAbsolute,
-                                     .name = "CMP oper"};
-  instructions[0xCE] =
-      (Instruction){.execute = decrementAbsolute, .name = "DEC oper"};
-  instructions[0xD0] =
-      (Instruction){.execute = branchOnNotEqualRelative, .name = "BNE oper"};
-  instructions[0xD1] = (Instruction){.execute = compareWithAccumulatorIndirectY,
-                                     .name = "CMP (oper),Y"};
-  instructions[0xD5] = (Instruction){.execute = compareWithAccumulatorZeroPageX,
-                                     .name = "CMP oper,X"};
-  instructions[0xD6] =
-      (Instruction){.execute = decrementZeroPageX, .name = "DEC oper,X"};
-  instructions[0xD8] = (Instruction){.execute = clearDecimal, .name = "CLD"};
-  instructions[0xD9] = (Instruction){.execute = compareWithAccumulatorAbsoluteY,
-                                     .name = "CMP oper,Y"};
-  instructions[0xDD] = (Instruction){.execute = compareWithAccumulatorAbsoluteX,
-                                     .name = "CMP oper,X"};
-  instructions[0xDE] =
-      (Instruction){.execute = decrementAbsoluteX, .name = "DEC oper,X"};
-  instructions[0xE0] =
-      (Instruction){.execute = compareWithXImmediate, .name = "CPX #oper"};
-  instructions[0xE1] = (Instruction){.execute = subtractWithCarryIndirectX,
-                                     .name = "SBC (oper,X)"};
-  instructions[0xE4] =
-      (Instruction){.execute = compareWithXZeroPage, .name = "CPX oper"};
-  instructions[0xE5] =
-      (Instruction){.execute = subtractWithCarryZeroPage, .name = "SBC oper"};
-  instructions[0xE6] =
-      (Instruction){.execute = incrementZeroPage, .name = "INC oper"};
-  instructions[0xE8] = (Instruction){.execute = incrementX, .name = "INX"};
-  instructions[0xE9] =
-      (Instruction){.execute = subtractWithCarryImmediate, .name = "SBC #oper"};
-  instructions[0xEA] = (Instruction){.execute = noOperation, .name = "NOP"};
-  instructions[0xEC] =
-      (Instruction){.execute = compareWithXAbsolute, .name = "CPX oper"};
-  instructions[0xED] =
-      (Instruction){.execute = subtractWithCarryAbsolute, .name = "SBC oper"};
-  instructions[0xEE] =
-      (Instruction){.execute = incrementAbsolute, .name = "INC oper"};
-  instructions[0xF0] =
-      (Instruction){.execute = branchOnEqualRelative, .name = "BEQ oper"};
-  instructions[0xF1] = (Instruction){.execute = subtractWithCarryIndirectY,
-                                     .name = "SBC (oper),Y"};
-  instructions[0xF5] = (Instruction){.execute = subtractWithCarryZeroPageX,
-                                     .name = "SBC oper,X"};
-  instructions[0xF6] =
-      (Instruction){.execute = incrementZeroPageX, .name = "INC oper,X"};
-  instructions[0xF8] = (Instruction){.execute = setDecimal, .name = "SED"};
-  instructions[0xF9] = (Instruction){.execute = subtractWithCarryAbsoluteY,
-                                     .name = "SBC oper,Y"};
-  instructions[0xFD] = (Instruction){.execute = subtractWithCarryAbsoluteX,
-                                     .name = "SBC oper,X"};
-  instructions[0xFE] =
-      (Instruction){.execute = incrementAbsoluteX, .name = "INC oper,X"};
-}
-
-char *getInstructionName(uint8_t code) {
-  printf("Trying to get instruction for code: %u\n", code);
-  char *name = instructions[code].name;
-  printf("Name: %s\n", name);
-  return name;
-}
-
-void executeInstruction(CPU *cpu) {
-  uint8_t instructionCode = readBus(cpu, cpu->PC);
-  Instruction instruction = instructions[instructionCode];
-  printf("%s", instruction.name);
-}
-
-// void executeInstruction(CPU *cpu) {
-//   uint8_t instruction = readBus(cpu, cpu->PC);
-//   printf("PC: 0x%04x ", cpu->PC);
-//   printf("NESMEM: 0x%04x ", cpu->PC - 0xBFF0);
-//   printf("Instruction: 0x%02x ", instruction);
-//   printf("N:%d ", (cpu->P & 0x80) >> 7);
-//   printf("V:%d ", (cpu->P & 0x40) >> 6);
-//   printf("U:%d ", (cpu->P & 0x20) >> 5);
-//   printf("B:%d ", (cpu->P & 0x10) >> 4);
-//   printf("D:%d ", (cpu->P & 0x08) >> 3);
-//   printf("I:%d ", (cpu->P & 0x04) >> 2);
-//   printf("Z:%d ", (cpu->P & 0x02) >> 1);
-//   printf("C:%d ", cpu->P & 0x01);
-//   cpu->PC++;
-//   switch (instruction) {
-//   case (0x00):
-//     printf("BRK");
-//     forceBreak(cpu);
-//     break;
-//   case (0x01):
-//     printf("ORA (oper,X)");
-//     orAIndirectX(cpu);
-//     break;
-//   case (0x05):
-//     printf("ORA oper");
-//     orAZeroPage(cpu);
-//     break;
-//   case (0x06):
-//     printf("ASL oper");
-//     arithmeticShiftLeftZeroPage(cpu);
-//     break;
-//   case (0x08):
-//     printf("PHP");
-//     pushProcessorStatusOnStack(cpu);
-//     break;
-//   case (0x09):
-//     printf("ORA #oper");
-//     orAImmediate(cpu);
-//     break;
-//   case (0x0A):
-//     printf("ASL");
-//     arithmeticShiftLeftAccumulator(cpu);
-//     break;
-//   case (0x0D):
-//     printf("ORA oper");
-//     orAAbsolute(cpu);
-//     break;
-//   case (0x0E):
-//     printf("ASL opr");
-//     arithmeticShiftLeftAbsolute(cpu);
-//     break;
-//   case (0x10):
-//     printf("BPL oper");
-//     branchOnPlusRelative(cpu);
-//     break;
-//   case (0x11):
-//     printf("ORA (oper),Y");
-//     orAIndirectY(cpu);
-//     break;
-//   case (0x15):
-//     printf("ORA oper,X");
-//     orAZeroPageX(cpu);
-//     break;
-//   case (0x16):
-//     printf("ASL oper,X");
-//     arithmeticShiftLeftZeroPageX(cpu);
-//     break;
-//   case (0x18):
-//     printf("CLC");
-//     clearCarry(cpu);
-//     break;
-//   case (0x19):
-//     printf("ORA oper,Y");
-//     orAAbsoluteY(cpu);
-//     break;
-//   case (0x1D):
-//     printf("ORA oper,X");
-//     orAAbsoluteX(cpu);
-//     break;
-//   case (0x1E):
-//     printf("ASL oper,X");
-//     arithmeticShiftLeftAbsoluteX(cpu);
-//     break;
-//   case (0x20):
-//     printf("JSR");
-//     jumpSubRoutineAbsolute(cpu);
-//     break;
-//   case (0x21):
-//     printf("AND (oper,X)");
-//     andIndirectX(cpu);
-//     break;
-//   case (0x24):
-//     printf("BIT oper");
-//     bitTestZeroPage(cpu);
-//     break;
-//   case (0x25):
-//     printf("AND oper");
-//     andZeroPage(cpu);
-//     break;
-//   case (0x26):
-//     printf("ROL oper");
-//     rotateLeftZeroPage(cpu);
-//     break;
-//   case (0x28):
-//     printf("PLP");
-//     pullProcessorStatusFromStack(cpu);
-//     break;
-//   case (0x29):
-//     printf("AND #oper");
-//     andImmediate(cpu);
-//     break;
-//   case (0x2A):
-//     printf("ROL A");
-//     rotateLeftAccumulator(cpu);
-//     break;
-//   case (0x2C):
-//     printf("BIT oper");
-//     bitTestAbsolute(cpu);
-//     break;
-//   case (0x2D):
-//     printf("AND oper");
-//     andAbsolute(cpu);
-//     break;
-//   case (0x2E):
-//     printf("ROL oper");
-//     rotateLeftAbsolute(cpu);
-//     break;
-//   case (0x30):
-//     printf("BMI");
-//     branchOnMinusRelative(cpu);
-//     break;
-//   case (0x31):
-//     printf("AND (oper),Y");
-//     andIndirectY(cpu);
-//     break;
-//   case (0x35):
-//     printf("AND oper,X");
-//     andZeroPageX(cpu);
-//     break;
-//   case (0x36):
-//     printf("ROL oper,X");
-//     rotateLeftZeroPageX(cpu);
-//     break;
-//   case (0x38):
-//     printf("SEC");
-//     setCarry(cpu);
-//     break;
-//   case (0x39):
-//     printf("AND oper,Y");
-//     andAbsoluteY(cpu);
-//     break;
-//   case (0x3D):
-//     printf("AND oper,X");
-//     andAbsoluteX(cpu);
-//     break;
-//   case (0x3E):
-//     printf("ROL oper,X");
-//     rotateLeftAbsoluteX(cpu);
-//     break;
-//   case (0x40):
-//     printf("RTI");
-//     returnFromInterrupt(cpu);
-//     break;
-//   case (0x41):
-//     printf("EOR (oper,X)");
-//     exclusiveOrIndirectX(cpu);
-//     break;
-//   case (0x45):
-//     printf("EOR oper");
-//     exclusiveOrZeroPage(cpu);
-//     break;
-//   case (0x46):
-//     printf("LSR oper");
-//     logisticalShiftRightZeroPage(cpu);
-//     break;
-//   case (0x48):
-//     printf("PHA");
-//     pushAccumulatorOntoStack(cpu);
-//     break;
-//   case (0x49):
-//     printf("EOR #oper");
-//     exclusiveOrImmediate(cpu);
-//     break;
-//   case (0x4A):
-//     printf("LSR A");
-//     logisticalShiftRightAccumulator(cpu);
-//     break;
-//   case (0x4C):
-//     printf("JMP");
-//     jumpAbsolute(cpu);
-//     break;
-//   case (0x4D):
-//     printf("EOR oper");
-//     exclusiveOrAbsolute(cpu);
-//     break;
-//   case (0x4E):
-//     printf("LSR oper");
-//     logisticalShiftRightAbsolute(cpu);
-//     break;
-//   case (0x50):
-//     printf("BVC oper");
-//     branchOnOverflowClearRelative(cpu);
-//     break;
-//   case (0x51):
-//     printf("EOR (oper),Y");
-//     exclusiveOrIndirectY(cpu);
-//     break;
-//   case (0x55):
-//     printf("EOR oper,X");
-//     exclusiveOrZeroPageX(cpu);
-//     break;
-//   case (0x56):
-//     printf("LSR oper,X");
-//     logisticalShiftRightZeroPageX(cpu);
-//     break;
-//   case (0x58):
-//     printf("CLI");
-//     clearInterruptDisable(cpu);
-//     break;
-//   case (0x59):
-//     printf("EOR oper,Y");
-//     exclusiveOrAbsoluteY(cpu);
-//     break;
-//   case (0x5D):
-//     printf("EOR oper,X");
-//     exclusiveOrAbsoluteX(cpu);
-//     break;
-//   case (0x5E):
-//     printf("LSR oper,X");
-//     logisticalShiftRightAbsoluteX(cpu);
-//     break;
-//   case (0x60):
-//     printf("RTS");
-//     returnFromSubroutine(cpu);
-//     break;
-//   case (0x61):
-//     printf("ADC (oper,X)");
-//     addWithCarryIndirectX(cpu);
-//     break;
-//   case (0x65):
-//     printf("ADC oper");
-//     addWithCarryZeroPage(cpu);
-//     break;
-//   case (0x66):
-//     printf("ROR oper");
-//     rotateRightZeroPage(cpu);
-//     break;
-//   case (0x68):
-//     printf("PLA");
-//     pullAccumulatorFromStack(cpu);
-//     break;
-//   case (0x69):
-//     printf("ADC #oper");
-//     addWithCarryImmediate(cpu);
-//     break;
-//   case (0x6A):
-//     printf("ROR A");
-//     rotateRightAccumulator(cpu);
-//     break;
-//   case (0x6C):
-//     printf("JMP (oper)");
-//     jumpIndirect(cpu);
-//     break;
-//   case (0x6D):
-//     printf("ADC oper");
-//     addWithCarryAbsolute(cpu);
-//     break;
-//   case (0x6E):
-//     printf("ROR oper");
-//     rotateRightAbsolute(cpu);
-//     break;
-//   case (0x70):
-//     printf("BVS");
-//     branchOnOverflowSetRelative(cpu);
-//     break;
-//   case (0x71):
-//     printf("ADC (oper),Y");
-//     addWithCarryIndirectY(cpu);
-//     break;
-//   case (0x75):
-//     printf("ADC oper,X");
-//     addWithCarryZeroPageX(cpu);
-//     break;
-//   case (0x76):
-//     printf("ROR oper,X");
-//     rotateRightZeroPageX(cpu);
-//     break;
-//   case (0x78):
-//     printf("SEI");
-//     setInterruptDisable(cpu);
-//     break;
-//   case (0x79):
-//     printf("ADC oper,Y");
-//     addWithCarryAbsoluteY(cpu);
-//     break;
-//   case (0x7D):
-//     printf("ADC oper,X");
-//     addWithCarryAbsoluteX(cpu);
-//     break;
-//   case (0x7E):
-//     printf("ROR oper,X");
-//     rotateRightAbsoluteX(cpu);
-//     break;
-//   case (0x81):
-//     printf("STA (oper,X)");
-//     storeAccumulatorIndirectX(cpu);
-//     break;
-//   case (0x84):
-//     printf("STY oper");
-//     storeYZeroPage(cpu);
-//     break;
-//   case (0x85):
-//     printf("STA oper");
-//     storeAccumulatorZeroPage(cpu);
-//     break;
-//   case (0x86):
-//     printf("STX oper");
-//     storeXZeroPage(cpu);
-//     break;
-//   case (0x88):
-//     printf("DEY");
-//     decrementY(cpu);
-//     break;
-//   case (0x8A):
-//     printf("TXA");
-//     transferXToAccumulator(cpu);
-//     break;
-//   case (0x8C):
-//     printf("STY oper");
-//     storeYAbsolute(cpu);
-//     break;
-//   case (0x8D):
-//     printf("STA oper");
-//     storeAccumulatorAbsolute(cpu);
-//     break;
-//   case (0x8E):
-//     printf("STX oper");
-//     storeXAbsolute(cpu);
-//     break;
-//   case (0x90):
-//     printf("BCC oper");
-//     branchOnClearCarryRelative(cpu);
-//     break;
-//   case (0x91):
-//     printf("STA (oper),Y");
-//     storeAccumulatorIndirectY(cpu);
-//     break;
-//   case (0x94):
-//     printf("STY oper,X");
-//     storeYZeroPageX(cpu);
-//     break;
-//   case (0x95):
-//     printf("STA oper,X");
-//     storeAccumulatorZeroPageX(cpu);
-//     break;
-//   case (0x96):
-//     printf("STX oper,Y");
-//     storeXZeroPageY(cpu);
-//     break;
-//   case (0x98):
-//     printf("TYA");
-//     transferYToAccumulator(cpu);
-//     break;
-//   case (0x99):
-//     printf("STA oper,Y");
-//     storeAccumulatorAbsoluteY(cpu);
-//     break;
-//   case (0x9A):
-//     printf("TXS");
-//     transferXToStackPointer(cpu);
-//     break;
-//   case (0x9D):
-//     printf("STA oper,X");
-//     storeAccumulatorAbsoluteX(cpu);
-//     break;
-//   case (0xA0):
-//     printf("LDY #oper");
-//     loadYImmediate(cpu);
-//     break;
-//   case (0xA1):
-//     printf("LDA (oper,X)");
-//     loadAccumulatorIndirectX(cpu);
-//     break;
-//   case (0xA2):
-//     printf("LDX #oper");
-//     loadXImmediate(cpu);
-//     break;
-//   case (0xA4):
-//     printf("LDY oper");
-//     loadYZeroPage(cpu);
-//     break;
-//   case (0xA5):
-//     printf("LDA oper");
-//     loadAccumulatorZeroPage(cpu);
-//     break;
-//   case (0xA6):
-//     printf("LDX oper");
-//     loadXZeroPage(cpu);
-//     break;
-//   case (0xA8):
-//     printf("TAY");
-//     transferAccumulatorToY(cpu);
-//     break;
-//   case (0xA9):
-//     printf("LDA #oper");
-//     loadAccumulatorImmediate(cpu);
-//     break;
-//   case (0xAA):
-//     printf("TAX");
-//     transferAccumulatorToX(cpu);
-//     break;
-//   case (0xAC):
-//     printf("LDY oper");
-//     loadYAbsolute(cpu);
-//     break;
-//   case (0xAD):
-//     printf("LDA oper");
-//     loadAccumulatorAbsolute(cpu);
-//     break;
-//   case (0xAE):
-//     printf("LDX oper");
-//     loadXAbsolute(cpu);
-//     break;
-//   case (0xB0):
-//     printf("BCS oper");
-//     branchOnCarrySetRelative(cpu);
-//     break;
-//   case (0xB1):
-//     printf("LDA (oper),Y");
-//     loadAccumulatorIndirectY(cpu);
-//     break;
-//   case (0xB4):
-//     printf("LDY oper,X");
-//     loadYZeroPageX(cpu);
-//     break;
-//   case (0xB5):
-//     printf("LDA oper,X");
-//     loadAccumulatorZeroPageX(cpu);
-//     break;
-//   case (0xB6):
-//     printf("LDX oper,Y");
-//     loadXZeroPageY(cpu);
-//     break;
-//   case (0xB8):
-//     printf("CLV");
-//     clearOverflow(cpu);
-//     break;
-//   case (0xB9):
-//     printf("LDA oper,Y");
-//     loadAccumulatorAbsoluteY(cpu);
-//     break;
-//   case (0xBA):
-//     printf("TSX");
-//     transferStackPointerToX(cpu);
-//     break;
-//   case (0xBC):
-//     printf("LDY oper,X");
-//     loadYAbsoluteX(cpu);
-//     break;
-//   case (0xBD):
-//     printf("LDA oper,X");
-//     loadAccumulatorAbsoluteX(cpu);
-//     break;
-//   case (0xBE):
-//     printf("LDX oper,Y");
-//     loadXAbsoluteY(cpu);
-//     break;
-//   case (0xC0):
-//     printf("CPY #oper");
-//     compareWithYImmediate(cpu);
-//     break;
-//   case (0xC1):
-//     printf("CMP (oper,X)");
-//     compareWithAccumulatorIndirectX(cpu);
-//     break;
-//   case (0xC4):
-//     printf("CPY oper");
-//     compareWithYZeroPage(cpu);
-//     break;
-//   case (0xC5):
-//     printf("CMP oper");
-//     compareWithAccumulatorZeroPage(cpu);
-//     break;
-//   case (0xC6):
-//     printf("DEC oper");
-//     decrementZeroPage(cpu);
-//     break;
-//   case (0xC8):
-//     printf("INY");
-//     incrementY(cpu);
-//     break;
-//   case (0xC9):
-//     printf("CMP #oper");
-//     compareWithAccumulatorImmediate(cpu);
-//     break;
-//   case (0xCA):
-//     printf("DEX");
-//     decrementX(cpu);
-//     break;
-//   case (0xCC):
-//     printf("CPY oper");
-//     compareWithYAbsolute(cpu);
-//     break;
-//   case (0xCD):
-//     printf("CMP oper");
-//     compareWithAccumulatorAbsolute(cpu);
-//     break;
-//   case (0xCE):
-//     printf("DEC oper");
-//     decrementAbsolute(cpu);
-//     break;
-//   case (0xD0):
-//     printf("BNE oper");
-//     branchOnNotEqualRelative(cpu);
-//     break;
-//   case (0xD1):
-//     printf("CMP (oper),Y");
-//     compareWithAccumulatorIndirectY(cpu);
-//     break;
-//   case (0xD5):
-//     printf("CMP oper,X");
-//     compareWithAccumulatorZeroPageX(cpu);
-//     break;
-//   case (0xD6):
-//     printf("DEC oper,X");
-//     decrementZeroPageX(cpu);
-//     break;
-//   case (0xD8):
-//     printf("CLD");
-//     clearDecimal(cpu);
-//     break;
-//   case (0xD9):
-//     printf("CMP oper,Y");
-//     compareWithAccumulatorAbsoluteY(cpu);
-//     break;
-//   case (0xDD):
-//     printf("CMP oper,X");
-//     compareWithAccumulatorAbsoluteX(cpu);
-//     break;
-//   case (0xDE):
-//     printf("DEC oper,X");
-//     decrementAbsoluteX(cpu);
-//     break;
-//   case (0xE0):
-//     printf("CPX #oper");
-//     compareWithXImmediate(cpu);
-//     break;
-//   case (0xE1):
-//     printf("SBC (oper,X)");
-//     subtractWithCarryIndirectX(cpu);
-//     break;
-//   case (0xE4):
-//     printf("CPX oper");
-//     compareWithXZeroPage(cpu);
-//     break;
-//   case (0xE5):
-//     printf("SBC oper");
-//     subtractWithCarryZeroPage(cpu);
-//     break;
-//   case (0xE6):
-//     printf("INC oper");
-//     incrementZeroPage(cpu);
-//     break;
-//   case (0xE8):
-//     printf("INX");
-//     incrementX(cpu);
-//     break;
-//   case (0xE9):
-//     printf("SBC #oper");
-//     subtractWithCarryImmediate(cpu);
-//     break;
-//   case (0xEA):
-//     printf("NOP");
-//     noOperation(cpu);
-//     break;
-//   case (0xEC):
-//     printf("CPX oper");
-//     compareWithXAbsolute(cpu);
-//     break;
-//   case (0xED):
-//     printf("SBC oper");
-//     subtractWithCarryAbsolute(cpu);
-//     break;
-//   case (0xEE):
-//     printf("INC oper");
-//     incrementAbsolute(cpu);
-//     break;
-//   case (0xF0):
-//     printf("BEQ oper");
-//     branchOnEqualRelative(cpu);
-//     break;
-//   case (0xF1):
-//     printf("SBC (oper),Y");
-//     subtractWithCarryIndirectY(cpu);
-//     break;
-//   case (0xF5):
-//     printf("SBC oper,X");
-//     subtractWithCarryZeroPageX(cpu);
-//     break;
-//   case (0xF6):
-//     printf("INC oper,X");
-//     incrementZeroPageX(cpu);
-//     break;
-//   case (0xF8):
-//     printf("SED");
-//     setDecimal(cpu);
-//     break;
-//   case (0xF9):
-//     printf("SBC oper,Y");
-//     subtractWithCarryAbsoluteY(cpu);
-//     break;
-//   case (0xFD):
-//     printf("SBC oper,X");
-//     subtractWithCarryAbsoluteX(cpu);
-//     break;
-//   case (0xFE):
-//     printf("INC oper,X");
-//     incrementAbsoluteX(cpu);
-//     break;
-//   default:
-//     printf("UNKNOWN.");
-//     break;
-//   }
-// }
-
+// Interactive stepper: prints each instruction and waits for enter
 void execute(CPU *cpu) {
-  // fetch init vector, and set PT to its value
-  uint16_t ll = readBus(cpu, cpu->PC);
-  cpu->PC++;
-  uint16_t hh = readBus(cpu, cpu->PC);
-  uint16_t result = (hh << 8) + ll;
-  printf("INIT VECTOR: 0x%02x\n", result);
-  cpu->PC = result;
+  char line[32];
+  printf("INIT VECTOR: 0x%02x\n", cpu->PC);
   while (true) {
+    disassembleInstruction(cpu, cpu->PC, line, sizeof(line));
+    printf("%04X  %s", cpu->PC, line);
     executeInstruction(cpu);
     getchar();
   }
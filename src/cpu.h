@@ -1,11 +1,86 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "profile.h"
+#include "stack.h"
+#include "trace.h"
+#include <stdalign.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+// NTSC CPU time per frame is 29780.5 cycles. It is kept in half cycles so
+// consecutive frames alternate between 29780 and 29781 cycles.
+#define NTSC_HALF_CYCLES_PER_FRAME 59561
+#define NTSC_CPU_CLOCK_HZ 1789773
+// Vertical blank lasts 20 scanlines of 341 PPU dots, 3 dots per CPU cycle
+#define NTSC_VBLANK_CYCLES 2273
+
+#define CACHE_LINE_SIZE 64
+#define NES_RAM_SIZE 0x0800
+#define PRG_RAM_SIZE 0x2000
+// The bus is mapped in 2KiB pages: the size of the internal RAM, and small
+// enough for the 8KiB PRG banks of common mappers.
+#define BUS_PAGE_SHIFT 11
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_SHIFT)
+#define BUS_PAGE_COUNT (0x10000 >> BUS_PAGE_SHIFT)
+
+// Standard controller buttons, in the order the pad shifts them out
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
+
+// Addressing modes of the opcode table in cpu.c
+typedef enum {
+  ModeImplied,
+  ModeAccumulator,
+  ModeImmediate,
+  ModeZeroPage,
+  ModeZeroPageX,
+  ModeZeroPageY,
+  ModeAbsolute,
+  ModeAbsoluteX,
+  ModeAbsoluteY,
+  ModeIndirect,
+  ModeIndirectX,
+  ModeIndirectY,
+  ModeRelative,
+} AddressingMode;
+
 typedef struct CPU CPU;
+typedef struct BlockCache BlockCache;
+typedef struct JitCache JitCache;
+
+#ifdef NES_IDLE_SKIP
+// Room for the registers, from A up to Cycles, that have to repeat for a
+// loop to be idle
+#define IDLE_REGISTER_BYTES 16
+
+// What the idle loop detector in cpu.c knows about the backward jump it saw
+// last
+typedef struct {
+  uint16_t BackEdge;
+  // One pass through the loop, 0 instructions when it can't be skipped
+  uint8_t Instructions;
+  uint8_t Cycles;
+  // When the jump was last taken, and the registers then
+  uint64_t Taken;
+  uint8_t Registers[IDLE_REGISTER_BYTES];
+} IdleLoop;
+#endif
 typedef uint8_t (*ReadBus)(CPU *, uint16_t);
+typedef void (*WriteBus)(CPU *, uint16_t, uint8_t);
 
 struct CPU {
+  // Hot state. Everything the interpreter touches on every instruction is
+  // kept together at the start, so a running CPU only keeps a handful of
+  // cache lines busy besides the RAM and ROM it actually reads.
   // Accumulator
-  uint8_t A;
+  alignas(CACHE_LINE_SIZE) uint8_t A;
   // Register X
   uint8_t X;
   // Register Y
@@ -19,24 +94,108 @@ struct CPU {
   // 2 Interrupt Disable (I)
   // 1 Zero Flag (Z)
   // 0 Carry Flag (C)
+  // With NES_LAZY_FLAGS only I and D are kept here, use getProcessorStatus
+  // to read the whole register.
   uint8_t P;
   uint8_t S;
   // Program Counter
   uint16_t PC;
-  // 64KiB, full address space, with the following mapping:
-  // 0x0000-0x07FF is the actual RAM addresses, and then they are mirrored 3
-  // times, till 0x1FFF
-  uint8_t Memory[65536];
-  // Emulator specific fields
-  uint8_t *GameData;
-  uint8_t MapperType;
+#ifdef NES_LAZY_FLAGS
+  // What N, Z, C and V are derived from. Z is set when the low byte of
+  // ZeroNegative is zero, N when bit 7 or 8 of it is set (bit 8 is for BIT,
+  // which takes N from a different value than Z). V is bit 7 of Overflow.
+  uint16_t ZeroNegative;
+  uint8_t Carry;
+  uint8_t Overflow;
+#endif
+  // CPU cycles elapsed since power-on
+  uint64_t Cycles;
   ReadBus ReadBus;
+  WriteBus WriteBus;
+  // Memory behind each BUS_PAGE_SIZE page of the address space. Pages that
+  // are NULL (the I/O registers, and ROM for writes) are handled by the
+  // ReadBus and WriteBus callbacks instead.
+  uint8_t *ReadPages[BUS_PAGE_COUNT];
+  uint8_t *WritePages[BUS_PAGE_COUNT];
+
+  // Emulator specific fields
+  // PRG ROM inside the ROM file, as sized by its header. Only ever read, so
+  // several CPUs running the same game can share one copy.
+  const uint8_t *PrgRom;
+  uint64_t PrgRomSize;
+  // 8KiB of cartridge RAM at $6000-$7FFF, NULL when the cartridge has none
+  uint8_t *PrgRam;
+  uint16_t MapperType;
+  // I/O registers. Only what games need to boot and read their input is
+  // there: the NMI enable bit of PPUCTRL, the vblank flag of PPUSTATUS and
+  // the two controller ports.
+  uint8_t PpuControl;
+  uint8_t PpuStatus;
+  uint8_t ControllerStrobe;
+  // Buttons held on each port, a mask of BUTTON_* bits
+  uint8_t Buttons[2];
+  uint8_t ControllerShift[2];
+#ifdef NES_IDLE_SKIP
+  IdleLoop Idle;
+#endif
+#ifdef NES_BLOCK_CACHE
+  // Decoded ROM code, see block.h. NULL runs everything in the interpreter.
+  BlockCache *Blocks;
+#endif
+#ifdef NES_JIT
+  // Hot blocks translated to machine code, see jit.h. NULL runs them from the
+  // block cache.
+  JitCache *Jit;
+#endif
+#ifdef NES_TRACE
+  // Instruction trace sink, NULL when not tracing
+  Trace *Tracer;
+#endif
+#ifdef NES_PROFILE
+  // Opcode and PC counters and the shadow call stack, NULL when not
+  // profiling
+  Profile *Profiler;
+  CallStack *Calls;
+#endif
+
+  // The 2KiB of internal RAM, mirrored 3 times up to $1FFF
+  alignas(CACHE_LINE_SIZE) uint8_t Ram[NES_RAM_SIZE];
 };
 
 void initProcessor(CPU *cpu);
 uint8_t getStackPointerValue(CPU *cpu);
+uint8_t getProcessorStatus(CPU *cpu);
+void setProcessorStatus(CPU *cpu, uint8_t status);
 uint8_t getCurrentInstruction(CPU *cpu);
-void setAndPrintMapper(CPU *cpu, uint8_t mapperNumber);
-char *getInstructionName(uint8_t);
-void initializeInstructionArray();
+void setMapper(CPU *cpu, uint16_t mapperNumber);
+// Copy the CPU to and from sizeof(CPU) bytes of state. Loading keeps the
+// CPU's own ROM, PRG RAM, block cache, JIT and tracer and maps the pages
+// again.
+void saveProcessorState(const CPU *cpu, uint8_t *state);
+void loadProcessorState(CPU *cpu, const uint8_t *state);
+const char *getInstructionName(uint8_t code);
+uint8_t getInstructionLength(uint8_t code);
+uint8_t getInstructionCycles(uint8_t code);
+AddressingMode getAddressingMode(uint8_t code);
+const char *getAddressingModeName(AddressingMode mode);
+uint8_t readMemory(CPU *cpu, uint16_t address);
+int disassembleInstruction(CPU *cpu, uint16_t address, char *buffer,
+                           int size);
+uint64_t runInstructions(CPU *cpu, uint64_t count);
+uint64_t runCycles(CPU *cpu, uint64_t cycles);
+uint64_t runFrame(CPU *cpu);
+void executeInstruction(CPU *cpu);
+#ifdef NES_IDLE_SKIP
+// Whether run() could fast-forward the loop from head to the jump at backEdge
+bool isIdleLoop(const CPU *cpu, uint16_t head, uint16_t backEdge);
+#endif
+#ifdef NES_BLOCK_CACHE
+// Reads the instruction at pc from ROM into bytes, zero filled to 3. Returns
+// its length, or 0 if it isn't all in ROM.
+int readRomInstruction(const CPU *cpu, uint16_t pc, uint8_t *bytes);
+#endif
+void jumpToResetVector(CPU *cpu);
+void resetProcessor(CPU *cpu);
 void execute(CPU *cpu);
+
+#endif
@@ -3,120 +3,151 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void detectGameFormat(CPU *cpu) {
-  uint8_t byteSeven = cpu->Memory[7];
-  if ((byteSeven & 0x0C) == 0x04) {
-    printf("Archaic iNES format detected.\n");
-    return;
+void printMapperName(uint16_t mapperNumber) {
+  switch (mapperNumber) {
+  case 0:
+    printf("NROM Mapper recognized!\n");
+    break;
+  case 4:
+    printf("Nintendo MMC3 Mapper recognized!\n");
+    break;
+  default:
+    printf("Unrecognized mapper.\n");
   }
-  bool endBytesEmpty = true;
-  int i = 12;
-  while (i < 16) {
-    if (cpu->Memory[i] != 0) {
-      endBytesEmpty = false;
-    }
-    i++;
-  }
-  if (((byteSeven & 0x0C) == 0x00) && endBytesEmpty) {
-    printf("Archaic iNES format detected.\n");
-    return;
+}
+
+static const char *tvSystemName(TvSystem tvSystem) {
+  switch (tvSystem) {
+  case TvSystemNtsc:
+    return "NTSC";
+  case TvSystemPal:
+    return "PAL";
+  case TvSystemMultiRegion:
+    return "Dual Compatible";
+  case TvSystemDendy:
+    return "Dendy";
   }
-  printf("Unknown game format detected.\n");
+  return "Unknown";
 }
 
-void readGameHeader(CPU *cpu) {
-  uint8_t *nes = cpu->Memory;
-  printf("HEADER START: %.3s\n", nes);
-  printf("PRG ROM Size: %d KBs.\n", cpu->Memory[4] * 16);
-  printf("CHR ROM Size: %d KBs.\n", cpu->Memory[5] * 8);
+static const char *consoleName(ConsoleType console) {
+  switch (console) {
+  case ConsoleNes:
+    return "NES";
+  case ConsoleVsSystem:
+    return "VS Unisystem";
+  case ConsolePlayChoice10:
+    return "PlayChoice-10";
+  case ConsoleExtended:
+    return "Extended console type";
+  }
+  return "Unknown";
+}
 
-  // Flags 6
-  printf("Flags 6: %d\n", cpu->Memory[6]);
-  if ((cpu->Memory[6] & 0x01) == 0x01) {
+void printGameHeader(const NesHeader *header) {
+  printf("%s format detected.\n", romFormatName(header->Format));
+  printf("PRG ROM Size: %llu KBs.\n",
+         (unsigned long long)header->PrgRomSize / 1024);
+  printf("CHR ROM Size: %llu KBs.\n",
+         (unsigned long long)header->ChrRomSize / 1024);
+  if (header->ChrRamSize > 0) {
+    printf("CHR RAM Size: %u KBs.\n", header->ChrRamSize / 1024);
+  }
+  if (header->VerticalMirroring) {
     printf("Nametable arrangement: horizontal\n");
   } else {
     printf("Nametable arrangement: vertical\n");
   }
-  if ((cpu->Memory[6] & 0x02) == 0x02) {
+  if (header->Battery) {
     printf("Battery-backed PRG RAM detected.\n"); // usually $6000
   } else {
     printf("No persistent memory detected.\n");
   }
-  if ((cpu->Memory[6] & 0x04) == 0x04) {
+  if (header->Trainer) {
     printf("512-byte trainer is present!\n");
-  } else {
-    printf("No trainer present.\n");
   }
-  if ((cpu->Memory[6] & 0x08) == 0x08) {
+  if (header->FourScreen) {
     printf("Using alternative nametable layout!\n");
-  } else {
-    printf("Regular nametable layout.\n");
   }
+  printf("Console: %s\n", consoleName(header->Console));
+  printMapperName(header->Mapper);
+  printf("Mapper number: %d", header->Mapper);
+  if (header->Format == RomFormatNes2) {
+    printf(", submapper %d", header->Submapper);
+  }
+  printf("\n");
+  printf("PRG RAM size: %u KBs, %u KBs battery-backed\n",
+         header->PrgRamSize / 1024, header->PrgNvramSize / 1024);
+  printf("TV System: %s\n", tvSystemName(header->TvSystem));
+}
 
-  // Flags 7
-  printf("Flags 7: %d\n", cpu->Memory[7]);
-  if ((cpu->Memory[7] & 0x01) == 0x01) {
-    printf("VS Unisystem ON\n");
-  } else {
-    printf("VS Unisystem OFF\n");
+// Maps a ROM file and checks it against its header. The caller releases the
+// result. Returns NULL, saying why, if the file is not a usable iNES image.
+RomImage *openGame(const char *fileName) {
+  printf("Attempting to load game: %s\n", fileName);
+  const char *error;
+  RomImage *image = romImageOpen(fileName, &error);
+  if (image == NULL) {
+    printf("%s\n", error);
+    return NULL;
   }
-  if ((cpu->Memory[7] & 0x02) == 0x02) {
-    printf("PlayChoice-10 is on.\n");
-  } else {
-    printf("PlayChoice-10 is off.\n");
+  printf("Filesize: %zu bytes\n", romImageSize(image));
+  return image;
+}
+
+// Opens the ROM file, prints what its header says and creates a machine
+// ready to run it. Returns NULL if that fails.
+NesMachine *loadGame(const char *fileName) {
+  RomImage *image = openGame(fileName);
+  if (image == NULL) {
+    return NULL;
   }
+  printGameHeader(romImageHeader(image));
+  NesMachine *machine = nesMachineCreateFromImage(image);
+  romImageRelease(image);
+  return machine;
+}
 
-  uint8_t mapperNumber =
-      (cpu->Memory[7] & 0xF0) + ((cpu->Memory[6] & 0xF0) >> 4);
-  cpu->MapperType = mapperNumber;
-  setAndPrintMapper(cpu, mapperNumber);
-  printf("Mapper number: %d\n", mapperNumber);
-  // Flags 8
-  printf("PRG RAM size: 0x%02x\n", cpu->Memory[8]);
-  // Flags 9
-  printf("Flags 9: %d\n", cpu->Memory[9]);
-  if ((cpu->Memory[9] & 0x01) == 1) {
-    printf("TV System: PAL\n");
-  } else {
-    printf("TV System NTSC\n");
+// Writes the machine's state to fileName. Returns false, saying why, if it
+// could not.
+bool saveStateFile(NesMachine *machine, const char *fileName) {
+  size_t size = nesMachineStateSize(machine);
+  uint8_t *state = malloc(size);
+  FILE *file = fopen(fileName, "wb");
+  bool ok = state != NULL && file != NULL &&
+            nesMachineSaveState(machine, state, size) &&
+            fwrite(state, 1, size, file) == size;
+  if (file != NULL && fclose(file) != 0) {
+    ok = false;
   }
-  // Flags 10
-  printf("Flags 10: %d\n", cpu->Memory[10]);
-  if ((cpu->Memory[10] & 0x02) == 0x00) {
-    printf("TV System: NTSC\n");
-  } else if ((cpu->Memory[10] & 0x02) == 0x01) {
-    printf("TV System: PAL\n");
-  } else {
-    printf("TV System: Dual Compatible!\n");
+  free(state);
+  if (!ok) {
+    printf("Could not save the state to %s.\n", fileName);
   }
-  uint8_t *ripper = cpu->Memory + 11;
-  printf("RIPPER NAME: %.5s\n", ripper);
+  return ok;
 }
 
-void* loadGame(CPU *cpu, char fileName[]) {
-  printf("Attempting to load game: %s\n", fileName);
+// Restores the state saved in fileName. The machine is left alone if the
+// file doesn't hold a state of this game from this build.
+bool loadStateFile(NesMachine *machine, const char *fileName) {
+  size_t size = nesMachineStateSize(machine);
+  uint8_t *state = malloc(size + 1);
   FILE *file = fopen(fileName, "rb");
-  if (file == NULL) {
-    printf("File not found.\n");
-    return NULL;
+  if (state == NULL || file == NULL) {
+    printf("Could not open the state %s.\n", fileName);
+    if (file != NULL) {
+      fclose(file);
+    }
+    free(state);
+    return false;
   }
-  printf("Opened the file successfully.\n");
-  //
-  // Set cursor to end of file to read length
-  fseek(file, 0, SEEK_END);
-  long fileSize = ftell(file);
-
-  // Reset cursor to begining
-  fseek(file, 0, SEEK_SET);
-
-  printf("Filesize: %ld bytes\n", fileSize);
-  cpu->GameData = malloc(fileSize);
-  fread(cpu->GameData, sizeof(uint8_t), (fileSize), file);
-  printf("Read file successfully!\n");
-
-  initProcessor(cpu);
-  readGameHeader(cpu);
-  detectGameFormat(cpu);
-  execute(cpu);
+  // Reading one byte more than expected catches files that are too long
+  size_t bytesRead = fread(state, 1, size + 1, file);
   fclose(file);
+  bool ok = nesMachineLoadState(machine, state, bytesRead);
+  free(state);
+  if (!ok) {
+    printf("%s is not a state of this game from this build.\n", fileName);
+  }
+  return ok;
 }
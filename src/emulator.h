@@ -1,6 +1,16 @@
-#include "cpu.h"
+#ifndef EMULATOR_H
+#define EMULATOR_H
 
-void detectGameFormat(CPU *cpu);
-void printMapperName(uint8_t mapperNumber);
-void readGameHeader(CPU *cpu);
-void* loadGame(CPU *cpu, char fileName[]);
+#include "nes.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void printMapperName(uint16_t mapperNumber);
+void printGameHeader(const NesHeader *header);
+RomImage *openGame(const char *fileName);
+NesMachine *loadGame(const char *fileName);
+bool saveStateFile(NesMachine *machine, const char *fileName);
+bool loadStateFile(NesMachine *machine, const char *fileName);
+
+#endif
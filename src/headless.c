@@ -0,0 +1,294 @@
+// Headless front end: runs a ROM without SDL as fast as possible and reports
+// how fast the core went.
+#include "emulator.h"
+#include "input.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_REWIND_BUDGET_KIB 8192
+#define PROFILE_HOTSPOTS 40
+
+void printUsage(char *program) {
+  printf("Usage: %s <rom> [--frames N | --instructions N] "
+         "[--load-state FILE] [--save-state FILE] [--rewind SECONDS "
+         "[--rewind-budget KIB]] [--run-ahead FRAMES] [--input SCRIPT | "
+         "--replay MOVIE] [--record MOVIE]",
+         program);
+#ifdef NES_TRACE
+  printf(" [--trace FILE]");
+#endif
+#ifdef NES_PROFILE
+  printf(" [--profile FILE] [--flamegraph FILE]");
+#endif
+  printf("\nRuns %d frames, or the length of the input, when no budget is "
+         "given.\n",
+         DEFAULT_FRAMES);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  uint64_t frames = DEFAULT_FRAMES;
+  uint64_t instructionBudget = 0;
+  char *loadState = NULL;
+  char *saveState = NULL;
+  double rewindSeconds = 0;
+  size_t rewindBudgetKib = DEFAULT_REWIND_BUDGET_KIB;
+  int runAheadFrames = 0;
+  char *inputScript = NULL;
+  char *replayMovie = NULL;
+  char *recordMovie = NULL;
+  bool framesGiven = false;
+#ifdef NES_TRACE
+  char *traceFile = NULL;
+#endif
+#ifdef NES_PROFILE
+  char *profileFile = NULL;
+  char *flameGraphFile = NULL;
+#endif
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = strtoull(argv[++i], NULL, 10);
+      instructionBudget = 0;
+      framesGiven = true;
+    } else if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+      instructionBudget = strtoull(argv[++i], NULL, 10);
+      frames = 0;
+    } else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) {
+      loadState = argv[++i];
+    } else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+      saveState = argv[++i];
+    } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+      rewindSeconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--rewind-budget") == 0 && i + 1 < argc) {
+      rewindBudgetKib = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+      runAheadFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      inputScript = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayMovie = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordMovie = argv[++i];
+#ifdef NES_TRACE
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      traceFile = argv[++i];
+#endif
+#ifdef NES_PROFILE
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profileFile = argv[++i];
+    } else if (strcmp(argv[i], "--flamegraph") == 0 && i + 1 < argc) {
+      flameGraphFile = argv[++i];
+#endif
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  bool hasInput = inputScript != NULL || replayMovie != NULL;
+  if ((inputScript != NULL && replayMovie != NULL) ||
+      (instructionBudget > 0 &&
+       (hasInput || recordMovie != NULL || rewindSeconds > 0 ||
+        runAheadFrames > 0))) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  NesMachine *machine = loadGame(argv[1]);
+  if (machine == NULL) {
+    return 1;
+  }
+  // Everything below is released at cleanup, whether the run got there or
+  // failed on the way
+  int status = 1;
+  CPU *cpu = nesMachineGetCpu(machine);
+  InputScript input = {0};
+  InputScript recording = {0};
+  Rewind *rewind = NULL;
+  RunAhead *runAhead = NULL;
+  if (loadState != NULL && !loadStateFile(machine, loadState)) {
+    goto cleanup;
+  }
+  uint64_t movieRomHash;
+  if ((inputScript != NULL && !loadInputScript(inputScript, &input)) ||
+      (replayMovie != NULL &&
+       !loadInputMovie(replayMovie, &input, &movieRomHash))) {
+    goto cleanup;
+  }
+  if (replayMovie != NULL && movieRomHash != nesMachineRomHash(machine)) {
+    printf("%s was recorded with a different ROM.\n", replayMovie);
+    goto cleanup;
+  }
+  if (hasInput && !framesGiven) {
+    frames = input.FrameCount;
+  }
+  bool recorded = true;
+  if (rewindSeconds > 0) {
+    double framesPerSecond =
+        2.0 * NTSC_CPU_CLOCK_HZ / NTSC_HALF_CYCLES_PER_FRAME;
+    rewind = rewindCreate(machine, rewindBudgetKib * 1024,
+                          rewindSeconds * framesPerSecond + 1,
+                          REWIND_KEYFRAME_INTERVAL);
+    if (rewind == NULL) {
+      printf("The rewind budget is too small.\n");
+      goto cleanup;
+    }
+  }
+  if (runAheadFrames > 0) {
+    runAhead = runAheadCreate(machine, runAheadFrames);
+    if (runAhead == NULL) {
+      goto cleanup;
+    }
+  }
+#ifdef NES_TRACE
+  if (traceFile != NULL) {
+    cpu->Tracer = traceOpen(traceFile);
+    if (cpu->Tracer == NULL) {
+      goto cleanup;
+    }
+  }
+#endif
+
+#ifdef NES_PROFILE
+  if (profileFile != NULL || flameGraphFile != NULL) {
+    cpu->Profiler = profileCreate();
+    cpu->Calls = callStackCreate(cpu->PC, cpu->Cycles);
+    if (cpu->Profiler == NULL || cpu->Calls == NULL) {
+      goto cleanup;
+    }
+  }
+#endif
+
+  uint64_t startCycles = cpu->Cycles;
+  uint64_t instructions = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  double captureSeconds = 0;
+  if (instructionBudget > 0) {
+    instructions = nesMachineRunInstructions(machine, instructionBudget);
+  } else if (rewind != NULL || runAhead != NULL || hasInput ||
+             recordMovie != NULL) {
+    // Captures are timed on their own, to see what rewind costs
+    for (uint64_t frame = 0; frame < frames; frame++) {
+      // Past the end of the input every button is released
+      uint8_t buttons = frame < input.FrameCount ? input.Buttons[frame] : 0;
+      nesMachineSetButtons(machine, 0, buttons);
+      if (recordMovie != NULL && recorded) {
+        recorded = appendInputFrame(&recording, buttons);
+      }
+      if (runAhead != NULL) {
+        instructions += runAheadFrame(runAhead, machine, NULL, NULL);
+      } else {
+        instructions += nesMachineRunFrames(machine, 1);
+      }
+      if (rewind == NULL) {
+        continue;
+      }
+      struct timespec captureStart;
+      clock_gettime(CLOCK_MONOTONIC, &captureStart);
+      rewindCapture(rewind, machine);
+      captureSeconds += secondsSince(&captureStart);
+    }
+  } else {
+    instructions = nesMachineRunFrames(machine, frames);
+  }
+
+  double wallSeconds = secondsSince(&start);
+#ifdef NES_TRACE
+  // Waits for the writer thread, so it is not part of the timed run
+  traceClose(cpu->Tracer);
+  cpu->Tracer = NULL;
+#endif
+#ifdef NES_PROFILE
+  if (profileFile != NULL) {
+    FILE *report = fopen(profileFile, "w");
+    if (report != NULL) {
+      profileReport(cpu->Profiler, cpu, report, PROFILE_HOTSPOTS);
+      callStackReport(cpu->Calls, cpu->Cycles, report, PROFILE_HOTSPOTS);
+      fclose(report);
+    } else {
+      printf("Could not create %s\n", profileFile);
+    }
+  }
+  if (flameGraphFile != NULL) {
+    FILE *folded = fopen(flameGraphFile, "w");
+    if (folded == NULL || !callStackWriteFolded(cpu->Calls, cpu->Cycles,
+                                                folded)) {
+      printf("Could not write %s\n", flameGraphFile);
+    }
+    if (folded != NULL) {
+      fclose(folded);
+    }
+  }
+#endif
+  uint64_t cycles = cpu->Cycles - startCycles;
+  uint32_t ramHash = hashBytes(cpu->Ram, sizeof(cpu->Ram));
+  bool saved = saveState == NULL || saveStateFile(machine, saveState);
+  if (recordMovie != NULL && !recorded) {
+    printf("Ran out of memory for the recording.\n");
+    saved = false;
+  } else if (recordMovie != NULL) {
+    saved = saveInputMovie(recordMovie, &recording,
+                           nesMachineRomHash(machine)) &&
+            saved;
+  }
+  double emulatedSeconds = (double)cycles / NTSC_CPU_CLOCK_HZ;
+
+  printf("\n");
+  printf("Instructions: %llu\n", (unsigned long long)instructions);
+  printf("Cycles: %llu\n", (unsigned long long)cycles);
+  if (frames > 0) {
+    printf("Frames: %llu\n", (unsigned long long)frames);
+  }
+  printf("Wall time: %.3f s\n", wallSeconds);
+  printf("Instructions per second: %.0f (%.2f MIPS)\n",
+         instructions / wallSeconds, instructions / wallSeconds / 1e6);
+  printf("Emulated time: %.3f s\n", emulatedSeconds);
+  printf("Speed: %.2fx real time\n", emulatedSeconds / wallSeconds);
+  printf("RAM hash: %08x\n", ramHash);
+  if (runAheadFrames > 0) {
+    printf("Run-ahead: %d frames, included in the instructions but not in "
+           "the emulated time\n",
+           runAheadFrames);
+  }
+  if (rewind != NULL) {
+    size_t kept = rewindFrameCount(rewind);
+    printf("Rewind: %zu frames kept in %zu KiB (%.0f bytes per frame)\n",
+           kept, rewindBytesUsed(rewind) / 1024,
+           kept > 0 ? (double)rewindBytesUsed(rewind) / kept : 0.0);
+    if (frames > 0) {
+      printf("Rewind capture: %.2f us per frame, %.2f%% of the run\n",
+             captureSeconds / frames * 1e6,
+             100 * captureSeconds / wallSeconds);
+    }
+  }
+  status = saved ? 0 : 1;
+
+cleanup:
+#ifdef NES_TRACE
+  traceClose(cpu->Tracer);
+  cpu->Tracer = NULL;
+#endif
+#ifdef NES_PROFILE
+  profileDestroy(cpu->Profiler);
+  callStackDestroy(cpu->Calls);
+  cpu->Profiler = NULL;
+  cpu->Calls = NULL;
+#endif
+  rewindDestroy(rewind);
+  runAheadDestroy(runAhead);
+  freeInputScript(&recording);
+  freeInputScript(&input);
+  nesMachineDestroy(machine);
+  return status;
+}
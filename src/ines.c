@@ -0,0 +1,113 @@
+#include "ines.h"
+#include <string.h>
+
+// NES 2.0 extends the 8-bit bank counts with a nibble of byte 9. A nibble of
+// $F switches to an exponent and multiplier instead: 2^E * (MM * 2 + 1)
+// bytes, for ROMs that are not a whole number of banks.
+static uint64_t nes2RomSize(uint8_t low, uint8_t high, uint64_t bankSize) {
+  if (high == 0x0F) {
+    uint8_t exponent = low >> 2;
+    uint64_t multiplier = (low & 0x03) * 2 + 1;
+    return exponent < 58 ? multiplier << exponent : 0;
+  }
+  return ((uint64_t)high << 8 | low) * bankSize;
+}
+
+// RAM sizes are stored as shift counts: 64 << n bytes, 0 for none
+static uint32_t nes2RamSize(uint8_t shift) {
+  return shift == 0 ? 0 : (uint32_t)64 << shift;
+}
+
+static void parseINes(const uint8_t *data, NesHeader *header) {
+  if (header->Format == RomFormatINes) {
+    header->Mapper |= data[7] & 0xF0;
+    header->Console = data[7] & 0x03;
+    header->TvSystem = (data[9] & 0x01) ? TvSystemPal : TvSystemNtsc;
+    // 0 means 8KiB, for compatibility with dumps that predate the field
+    header->PrgRamSize = (data[8] == 0 ? 1 : data[8]) * 0x2000;
+  } else {
+    header->PrgRamSize = 0x2000;
+  }
+  if (header->Battery) {
+    header->PrgNvramSize = header->PrgRamSize;
+    header->PrgRamSize = 0;
+  }
+  header->PrgRomSize = (uint64_t)data[4] * PRG_BANK_SIZE;
+  header->ChrRomSize = (uint64_t)data[5] * CHR_BANK_SIZE;
+  header->ChrRamSize = header->ChrRomSize == 0 ? CHR_BANK_SIZE : 0;
+}
+
+static void parseNes2(const uint8_t *data, NesHeader *header) {
+  header->Mapper |= (data[7] & 0xF0) | (uint16_t)(data[8] & 0x0F) << 8;
+  header->Submapper = data[8] >> 4;
+  header->PrgRomSize = nes2RomSize(data[4], data[9] & 0x0F, PRG_BANK_SIZE);
+  header->ChrRomSize = nes2RomSize(data[5], data[9] >> 4, CHR_BANK_SIZE);
+  header->PrgRamSize = nes2RamSize(data[10] & 0x0F);
+  header->PrgNvramSize = nes2RamSize(data[10] >> 4);
+  header->ChrRamSize = nes2RamSize(data[11] & 0x0F);
+  header->ChrNvramSize = nes2RamSize(data[11] >> 4);
+  header->Console = data[7] & 0x03;
+  header->TvSystem = data[12] & 0x03;
+  if (header->Console == ConsoleVsSystem) {
+    header->VsPpuType = data[13] & 0x0F;
+    header->VsHardwareType = data[13] >> 4;
+  } else if (header->Console == ConsoleExtended) {
+    header->ExtendedConsoleType = data[13] & 0x0F;
+  }
+  header->MiscRomCount = data[14] & 0x03;
+  header->DefaultExpansionDevice = data[15] & 0x3F;
+}
+
+// Follows the detection order recommended on the NESdev wiki. A NES 2.0
+// identifier is only trusted if the sizes it implies fit in the file, since
+// some old dumps have junk in byte 7.
+static RomFormat detectFormat(const uint8_t *data, size_t fileSize) {
+  uint8_t identifier = data[7] & 0x0C;
+  if (identifier == 0x08) {
+    uint64_t prgSize = nes2RomSize(data[4], data[9] & 0x0F, PRG_BANK_SIZE);
+    uint64_t chrSize = nes2RomSize(data[5], data[9] >> 4, CHR_BANK_SIZE);
+    if (INES_HEADER_SIZE + prgSize + chrSize <= fileSize) {
+      return RomFormatNes2;
+    }
+  }
+  if (identifier == 0x00 &&
+      data[12] == 0 && data[13] == 0 && data[14] == 0 && data[15] == 0) {
+    return RomFormatINes;
+  }
+  return RomFormatArchaicINes;
+}
+
+bool parseNesHeader(const uint8_t *data, size_t fileSize, NesHeader *header) {
+  memset(header, 0, sizeof(NesHeader));
+  if (fileSize < INES_HEADER_SIZE || memcmp(data, "NES\x1A", 4) != 0) {
+    return false;
+  }
+  header->Format = detectFormat(data, fileSize);
+  header->Mapper = data[6] >> 4;
+  header->VerticalMirroring = data[6] & 0x01;
+  header->Battery = data[6] & 0x02;
+  header->Trainer = data[6] & 0x04;
+  header->FourScreen = data[6] & 0x08;
+  if (header->Format == RomFormatNes2) {
+    parseNes2(data, header);
+  } else {
+    parseINes(data, header);
+  }
+  return true;
+}
+
+size_t prgRomOffset(const NesHeader *header) {
+  return INES_HEADER_SIZE + (header->Trainer ? INES_TRAINER_SIZE : 0);
+}
+
+const char *romFormatName(RomFormat format) {
+  switch (format) {
+  case RomFormatArchaicINes:
+    return "Archaic iNES";
+  case RomFormatINes:
+    return "iNES";
+  case RomFormatNes2:
+    return "NES 2.0";
+  }
+  return "Unknown";
+}
@@ -0,0 +1,79 @@
+#ifndef INES_H
+#define INES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
+#define PRG_BANK_SIZE 0x4000
+// The smallest PRG ROM bank any board switches
+#define PRG_WINDOW_SIZE 0x2000
+#define CHR_BANK_SIZE 0x2000
+
+typedef enum {
+  // iNES from before bytes 7-15 were defined. Only the low nibble of the
+  // mapper number can be trusted, the rest of the header often holds a
+  // ripper's signature.
+  RomFormatArchaicINes,
+  RomFormatINes,
+  RomFormatNes2,
+} RomFormat;
+
+typedef enum {
+  ConsoleNes,
+  ConsoleVsSystem,
+  ConsolePlayChoice10,
+  // NES 2.0 only, see ExtendedConsoleType
+  ConsoleExtended,
+} ConsoleType;
+
+typedef enum {
+  TvSystemNtsc,
+  TvSystemPal,
+  // Runs on both
+  TvSystemMultiRegion,
+  TvSystemDendy,
+} TvSystem;
+
+// Everything an iNES or NES 2.0 header says. Sizes are in bytes. Fields that
+// only NES 2.0 has are 0 for older formats.
+typedef struct {
+  RomFormat Format;
+  uint16_t Mapper;
+  uint8_t Submapper;
+  uint64_t PrgRomSize;
+  uint64_t ChrRomSize;
+  uint32_t PrgRamSize;
+  // Battery backed PRG RAM. iNES can't tell the two apart, so there all of
+  // PrgRamSize counts as persistent when Battery is set.
+  uint32_t PrgNvramSize;
+  // Cartridges without CHR ROM have CHR RAM instead, 8KiB unless NES 2.0
+  // says otherwise
+  uint32_t ChrRamSize;
+  uint32_t ChrNvramSize;
+  // Hard-wired mirroring, horizontal arrangement when set
+  bool VerticalMirroring;
+  bool Battery;
+  bool Trainer;
+  bool FourScreen;
+  ConsoleType Console;
+  TvSystem TvSystem;
+  // Byte 13: the PPU and hardware type of a Vs. System, or the console type
+  // of ConsoleExtended
+  uint8_t VsPpuType;
+  uint8_t VsHardwareType;
+  uint8_t ExtendedConsoleType;
+  uint8_t MiscRomCount;
+  uint8_t DefaultExpansionDevice;
+} NesHeader;
+
+// Fills header from the first 16 bytes of an iNES file of fileSize bytes.
+// Returns false if they don't start with the iNES magic.
+bool parseNesHeader(const uint8_t *data, size_t fileSize, NesHeader *header);
+// Where the PRG ROM starts in the file, after the header and the trainer
+size_t prgRomOffset(const NesHeader *header);
+const char *romFormatName(RomFormat format);
+
+#endif
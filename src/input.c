@@ -0,0 +1,180 @@
+#include "input.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same order as the FCEUX movie format, highest BUTTON_* bit first
+static const char buttonLetters[] = "RLDUTSBA";
+
+static bool parseButtons(const char *field, uint8_t *buttons) {
+  if (strlen(field) != 8) {
+    return false;
+  }
+  *buttons = 0;
+  for (int i = 0; i < 8; i++) {
+    if (field[i] == buttonLetters[i]) {
+      *buttons |= 0x80 >> i;
+    } else if (field[i] != '.') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool appendFrames(InputScript *script, uint64_t count,
+                         uint8_t buttons) {
+  if (script->FrameCount + count > script->Capacity) {
+    uint64_t capacity = script->Capacity < 1024 ? 1024 : script->Capacity;
+    while (capacity < script->FrameCount + count) {
+      capacity *= 2;
+    }
+    uint8_t *grown = realloc(script->Buttons, capacity);
+    if (grown == NULL) {
+      return false;
+    }
+    script->Buttons = grown;
+    script->Capacity = capacity;
+  }
+  memset(script->Buttons + script->FrameCount, buttons, count);
+  script->FrameCount += count;
+  return true;
+}
+
+bool appendInputFrame(InputScript *script, uint8_t buttons) {
+  return appendFrames(script, 1, buttons);
+}
+
+bool loadInputScript(const char *fileName, InputScript *script) {
+  memset(script, 0, sizeof(InputScript));
+  FILE *file = fopen(fileName, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open input script %s\n", fileName);
+    return false;
+  }
+
+  char line[128];
+  int lineNumber = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    lineNumber++;
+    char field[16];
+    unsigned long long count;
+    char *text = line + strspn(line, " \t");
+    if (*text == '#' || *text == '\n' || *text == '\0') {
+      continue;
+    }
+    uint8_t buttons;
+    ok = sscanf(text, "%llu %15s", &count, field) == 2 &&
+         parseButtons(field, &buttons) && appendFrames(script, count, buttons);
+    if (!ok) {
+      fprintf(stderr, "%s:%d: expected \"<frames> RLDUTSBA\"\n", fileName,
+              lineNumber);
+    }
+  }
+  fclose(file);
+  if (!ok) {
+    freeInputScript(script);
+  }
+  return ok;
+}
+
+// Movies are written byte by byte in little endian order, so they play on
+// any machine and any build: the magic, a version byte, the ROM hash as 8
+// bytes, then runs of frames holding the same buttons, each a buttons byte
+// followed by the run length as a LEB128 varint.
+static const char movieMagic[8] = "NESMOVIE";
+#define MOVIE_VERSION 1
+
+static bool writeVarint(FILE *file, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (fputc(byte | (value != 0 ? 0x80 : 0), file) == EOF) {
+      return false;
+    }
+  } while (value != 0);
+  return true;
+}
+
+static bool readVarint(FILE *file, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = fgetc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool saveInputMovie(const char *fileName, const InputScript *script,
+                    uint64_t romHash) {
+  FILE *file = fopen(fileName, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not create movie %s\n", fileName);
+    return false;
+  }
+  bool ok = fwrite(movieMagic, sizeof(movieMagic), 1, file) == 1 &&
+            fputc(MOVIE_VERSION, file) != EOF;
+  for (int i = 0; ok && i < 8; i++) {
+    ok = fputc(romHash >> (i * 8) & 0xFF, file) != EOF;
+  }
+  for (uint64_t frame = 0; ok && frame < script->FrameCount;) {
+    uint8_t buttons = script->Buttons[frame];
+    uint64_t run = 1;
+    while (frame + run < script->FrameCount &&
+           script->Buttons[frame + run] == buttons) {
+      run++;
+    }
+    ok = fputc(buttons, file) != EOF && writeVarint(file, run);
+    frame += run;
+  }
+  if (fclose(file) != 0 || !ok) {
+    fprintf(stderr, "Could not write movie %s\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+bool loadInputMovie(const char *fileName, InputScript *script,
+                    uint64_t *romHash) {
+  memset(script, 0, sizeof(InputScript));
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open movie %s\n", fileName);
+    return false;
+  }
+  char magic[sizeof(movieMagic)];
+  bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+            memcmp(magic, movieMagic, sizeof(magic)) == 0 &&
+            fgetc(file) == MOVIE_VERSION;
+  *romHash = 0;
+  for (int i = 0; ok && i < 8; i++) {
+    int byte = fgetc(file);
+    ok = byte != EOF;
+    *romHash |= (uint64_t)(byte & 0xFF) << (i * 8);
+  }
+  int buttons;
+  while (ok && (buttons = fgetc(file)) != EOF) {
+    uint64_t run;
+    // A run can't be longer than a day of frames, anything more is a
+    // broken file rather than a movie
+    ok = readVarint(file, &run) && run <= 24 * 60 * 60 * 61 &&
+         appendFrames(script, run, buttons);
+  }
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "%s is not a movie this build can play\n", fileName);
+    freeInputScript(script);
+  }
+  return ok;
+}
+
+void freeInputScript(InputScript *script) {
+  free(script->Buttons);
+  memset(script, 0, sizeof(InputScript));
+}
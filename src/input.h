@@ -0,0 +1,39 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Controller input for a whole run, one mask of BUTTON_* bits per frame for
+// port 0. Scripts are text, one line per stretch of frames:
+//
+//   # frames RLDUTSBA
+//   120 ........
+//   5   ....T...
+//
+// The second field lists the buttons held, Right, Left, Down, Up, sTart,
+// Select, B and A, with '.' for a button that is up.
+//
+// The same input can be recorded as a movie: a compact binary file made for
+// replaying a run exactly. Machines are deterministic, so a movie played
+// from power-on on the ROM it was recorded with always ends the same way.
+typedef struct {
+  uint8_t *Buttons;
+  uint64_t FrameCount;
+  uint64_t Capacity;
+} InputScript;
+
+// Returns false, with a message on stderr, if the file can't be read or has a
+// malformed line.
+bool loadInputScript(const char *fileName, InputScript *script);
+// Adds a frame at the end, for recording. script must start zeroed.
+bool appendInputFrame(InputScript *script, uint8_t buttons);
+// romHash is nesMachineRomHash of the machine the movie was recorded on.
+// Both return false, with a message on stderr, if they fail.
+bool saveInputMovie(const char *fileName, const InputScript *script,
+                    uint64_t romHash);
+bool loadInputMovie(const char *fileName, InputScript *script,
+                    uint64_t *romHash);
+void freeInputScript(InputScript *script);
+
+#endif
@@ -0,0 +1,1259 @@
+// x86-64 translation of hot blocks, see jit.h. Only built when NES_JIT is
+// enabled.
+#include "jit.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__)
+#error "The JIT emits x86-64 code"
+#endif
+#ifndef NES_LAZY_FLAGS
+#error "The JIT keeps the flags the way NES_LAZY_FLAGS does"
+#endif
+
+// ------------- x86-64 ENCODING -------------
+enum {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// Where the 6502 lives while native code runs. RAX, RCX and RDX are scratch:
+// the operand, its address and the page it is on. The ABI leaves RBX, RBP
+// and R12 to R15 to the caller, the entry code saves them.
+#define HOST_CPU RDI
+#define HOST_RUN RSI
+#define HOST_A R8
+#define HOST_X R9
+#define HOST_Y R10
+#define HOST_ZERO_NEGATIVE R11
+#define HOST_CARRY RBP
+#define HOST_EXECUTED RBX
+#define HOST_CYCLES R12
+#define HOST_CYCLE_LIMIT R13
+#define HOST_COUNT_LIMIT R14
+#define HOST_CACHE R15
+
+// Operand sizes besides 32 bits
+#define WIDE 0x01
+// 8 bits. SPL to DIL need a REX prefix, which doesn't change AL to BL.
+#define BYTE 0x02
+#define SHORT 0x04
+
+// Arithmetic and logic operations, as the /digit of the immediate forms
+enum {
+  AluAdd = 0,
+  AluOr = 1,
+  AluAnd = 4,
+  AluSub = 5,
+  AluXor = 6,
+  AluCmp = 7,
+};
+
+enum {
+  ShiftLeft = 4,
+  ShiftRight = 5,
+};
+
+enum {
+  ConditionAboveEqual = 0x3,
+  ConditionZero = 0x4,
+  ConditionNotZero = 0x5,
+  ConditionBelowEqual = 0x6,
+};
+
+typedef struct {
+  uint8_t *Code;
+  uint32_t Size;
+  uint32_t Capacity;
+  // Set when the code didn't fit, which makes it useless
+  bool Overflow;
+} Emitter;
+
+// [Base + (Index << Scale) + Displacement], Index -1 for none
+typedef struct {
+  int Base;
+  int Index;
+  int Scale;
+  int32_t Displacement;
+} Memory;
+
+static Memory at(int base, int32_t displacement) {
+  return (Memory){base, -1, 0, displacement};
+}
+
+static Memory indexed(int base, int index, int scale, int32_t displacement) {
+  return (Memory){base, index, scale, displacement};
+}
+
+static void emit8(Emitter *e, uint8_t byte) {
+  if (e->Size == e->Capacity) {
+    e->Overflow = true;
+    return;
+  }
+  e->Code[e->Size++] = byte;
+}
+
+static void emit16(Emitter *e, uint16_t value) {
+  emit8(e, value);
+  emit8(e, value >> 8);
+}
+
+static void emit32(Emitter *e, uint32_t value) {
+  emit16(e, value);
+  emit16(e, value >> 16);
+}
+
+static void emit64(Emitter *e, uint64_t value) {
+  emit32(e, value);
+  emit32(e, value >> 32);
+}
+
+static void emitPrefixes(Emitter *e, int size, int reg, int index, int base) {
+  if (size & SHORT) {
+    emit8(e, 0x66);
+  }
+  uint8_t rex = (size & WIDE ? 0x08 : 0) | (reg & 8) >> 1 | (index & 8) >> 2 |
+                (base & 8) >> 3;
+  if (rex != 0 || size & BYTE) {
+    emit8(e, 0x40 | rex);
+  }
+}
+
+static void emitOpcode(Emitter *e, uint16_t opcode) {
+  if (opcode > 0xFF) {
+    emit8(e, opcode >> 8);
+  }
+  emit8(e, opcode);
+}
+
+// opcode with two register operands. reg is the register or the /digit
+// extension of the opcode.
+static void emitRegister(Emitter *e, int size, uint16_t opcode, int reg,
+                         int rm) {
+  emitPrefixes(e, size, reg, 0, rm);
+  emitOpcode(e, opcode);
+  emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// opcode with a register and a memory operand. Always in the longest form,
+// a SIB byte and a 32 bit displacement, which works with any registers.
+static void emitMemory(Emitter *e, int size, uint16_t opcode, int reg,
+                       Memory memory) {
+  // RSP in the index field means no index
+  int index = memory.Index < 0 ? RSP : memory.Index;
+  emitPrefixes(e, size, reg, index, memory.Base);
+  emitOpcode(e, opcode);
+  emit8(e, 0x84 | (reg & 7) << 3);
+  emit8(e, memory.Scale << 6 | (index & 7) << 3 | (memory.Base & 7));
+  emit32(e, memory.Displacement);
+}
+
+static void emitAlu(Emitter *e, int operation, int dst, int src) {
+  emitRegister(e, 0, operation << 3 | 0x01, src, dst);
+}
+
+static void emitAluImmediate(Emitter *e, int size, int operation, int dst,
+                             int32_t value) {
+  emitRegister(e, size, 0x81, operation, dst);
+  emit32(e, value);
+}
+
+static void emitMove(Emitter *e, int dst, int src) {
+  emitRegister(e, 0, 0x89, src, dst);
+}
+
+static void emitMoveImmediate(Emitter *e, int dst, uint32_t value) {
+  emitPrefixes(e, 0, 0, 0, dst);
+  emit8(e, 0xB8 | (dst & 7));
+  emit32(e, value);
+}
+
+static void emitMoveImmediate64(Emitter *e, int dst, uint64_t value) {
+  emitPrefixes(e, WIDE, 0, 0, dst);
+  emit8(e, 0xB8 | (dst & 7));
+  emit64(e, value);
+}
+
+static void emitShift(Emitter *e, int operation, int dst, uint8_t count) {
+  emitRegister(e, 0, 0xC1, operation, dst);
+  emit8(e, count);
+}
+
+static void emitZeroExtendByte(Emitter *e, int dst, int src) {
+  emitRegister(e, BYTE, 0x0FB6, dst, src);
+}
+
+static void emitZeroExtendWord(Emitter *e, int dst, int src) {
+  emitRegister(e, 0, 0x0FB7, dst, src);
+}
+
+static void emitLoadByte(Emitter *e, int dst, Memory memory) {
+  emitMemory(e, 0, 0x0FB6, dst, memory);
+}
+
+static void emitLoadWord(Emitter *e, int dst, Memory memory) {
+  emitMemory(e, 0, 0x0FB7, dst, memory);
+}
+
+static void emitLoad64(Emitter *e, int dst, Memory memory) {
+  emitMemory(e, WIDE, 0x8B, dst, memory);
+}
+
+static void emitStoreByte(Emitter *e, Memory memory, int src) {
+  emitMemory(e, BYTE, 0x88, src, memory);
+}
+
+static void emitStoreWord(Emitter *e, Memory memory, int src) {
+  emitMemory(e, SHORT, 0x89, src, memory);
+}
+
+static void emitStore64(Emitter *e, Memory memory, int src) {
+  emitMemory(e, WIDE, 0x89, src, memory);
+}
+
+static void emitStoreByteImmediate(Emitter *e, Memory memory, uint8_t value) {
+  emitMemory(e, 0, 0xC6, 0, memory);
+  emit8(e, value);
+}
+
+static void emitStoreWordImmediate(Emitter *e, Memory memory,
+                                   uint16_t value) {
+  emitMemory(e, SHORT, 0xC7, 0, memory);
+  emit16(e, value);
+}
+
+static void emitPush(Emitter *e, int reg) {
+  emitPrefixes(e, 0, 0, 0, reg);
+  emit8(e, 0x50 | (reg & 7));
+}
+
+static void emitPop(Emitter *e, int reg) {
+  emitPrefixes(e, 0, 0, 0, reg);
+  emit8(e, 0x58 | (reg & 7));
+}
+
+// Conditional jump to a place not known yet. Returns where its target goes,
+// for patchJump.
+static uint32_t emitJumpIf(Emitter *e, int condition) {
+  emit8(e, 0x0F);
+  emit8(e, 0x80 | condition);
+  uint32_t patch = e->Size;
+  emit32(e, 0);
+  return patch;
+}
+
+// Points the jump at patch to the next code emitted
+static void patchJump(Emitter *e, uint32_t patch) {
+  if (!e->Overflow) {
+    int32_t offset = e->Size - (patch + 4);
+    memcpy(e->Code + patch, &offset, sizeof(offset));
+  }
+}
+
+// Jumps to code outside this emitter: the shared code of the cache
+static void emitJumpTo(Emitter *e, const uint8_t *target) {
+  emit8(e, 0xE9);
+  emit32(e, (uint32_t)(target - (e->Code + e->Size + 4)));
+}
+
+static void emitJumpIfTo(Emitter *e, int condition, const uint8_t *target) {
+  emit8(e, 0x0F);
+  emit8(e, 0x80 | condition);
+  emit32(e, (uint32_t)(target - (e->Code + e->Size + 4)));
+}
+
+// ------------- SHARED CODE -------------
+// Lists code of the cache in the perf map
+static void addToPerfMap(JitCache *cache, const uint8_t *code, uint32_t size,
+                         const char *name) {
+  if (cache->PerfMap < 0) {
+    return;
+  }
+  char line[64];
+  int length = snprintf(line, sizeof(line), "%" PRIxPTR " %" PRIx32 " %s\n",
+                        (uintptr_t)code, size, name);
+  // One write per line, so machines on other threads can't tear it
+  if (write(cache->PerfMap, line, length) != length) {
+    close(cache->PerfMap);
+    cache->PerfMap = -1;
+  }
+}
+
+// The first slot holds the code every translation shares: entering from C,
+// going back to it and finding the translation to go on with.
+static void emitSharedCode(JitCache *cache) {
+  Emitter e = {cache->Code, 0, JIT_SLOT_SIZE, false};
+  static const int saved[] = {RBX, RBP, R12, R13, R14, R15};
+  int savedCount = sizeof(saved) / sizeof(saved[0]);
+
+  // Enter(cpu, run, code) loads the 6502 into registers and jumps to code
+  cache->Enter = (JitEntry)(void *)e.Code;
+  for (int i = 0; i < savedCount; i++) {
+    emitPush(&e, saved[i]);
+  }
+  emitLoadByte(&e, HOST_A, at(HOST_CPU, offsetof(CPU, A)));
+  emitLoadByte(&e, HOST_X, at(HOST_CPU, offsetof(CPU, X)));
+  emitLoadByte(&e, HOST_Y, at(HOST_CPU, offsetof(CPU, Y)));
+  emitLoadWord(&e, HOST_ZERO_NEGATIVE,
+               at(HOST_CPU, offsetof(CPU, ZeroNegative)));
+  emitLoadByte(&e, HOST_CARRY, at(HOST_CPU, offsetof(CPU, Carry)));
+  emitLoad64(&e, HOST_CYCLES, at(HOST_CPU, offsetof(CPU, Cycles)));
+  emitLoad64(&e, HOST_EXECUTED, at(HOST_RUN, offsetof(JitRun, Executed)));
+  emitLoad64(&e, HOST_CYCLE_LIMIT, at(HOST_RUN, offsetof(JitRun, CycleLimit)));
+  emitLoad64(&e, HOST_COUNT_LIMIT, at(HOST_RUN, offsetof(JitRun, CountLimit)));
+  emitMoveImmediate64(&e, HOST_CACHE, (uintptr_t)cache);
+  // jmp rdx
+  emitRegister(&e, 0, 0xFF, 4, RDX);
+  uint32_t enterSize = e.Size;
+
+  // Leave stores the registers back and returns to C. PC is set already.
+  cache->Leave = e.Code + e.Size;
+  emitStoreByte(&e, at(HOST_CPU, offsetof(CPU, A)), HOST_A);
+  emitStoreByte(&e, at(HOST_CPU, offsetof(CPU, X)), HOST_X);
+  emitStoreByte(&e, at(HOST_CPU, offsetof(CPU, Y)), HOST_Y);
+  emitStoreWord(&e, at(HOST_CPU, offsetof(CPU, ZeroNegative)),
+                HOST_ZERO_NEGATIVE);
+  emitStoreByte(&e, at(HOST_CPU, offsetof(CPU, Carry)), HOST_CARRY);
+  emitStore64(&e, at(HOST_CPU, offsetof(CPU, Cycles)), HOST_CYCLES);
+  emitStore64(&e, at(HOST_RUN, offsetof(JitRun, Executed)), HOST_EXECUTED);
+  for (int i = savedCount - 1; i >= 0; i--) {
+    emitPop(&e, saved[i]);
+  }
+  emit8(&e, 0xC3);
+  uint32_t leaveSize = e.Size - enterSize;
+
+  // Dispatch goes on with the translation for the PC in ECX, if there is
+  // one and it fits in what is left of the run. The same test as run()'s.
+  cache->Dispatch = e.Code + e.Size;
+  emitStoreWord(&e, at(HOST_CPU, offsetof(CPU, PC)), RCX);
+  emitRegister(&e, WIDE, 0x39, HOST_COUNT_LIMIT, HOST_EXECUTED);
+  emitJumpIfTo(&e, ConditionAboveEqual, cache->Leave);
+  emitRegister(&e, WIDE, 0x39, HOST_CYCLE_LIMIT, HOST_CYCLES);
+  emitJumpIfTo(&e, ConditionAboveEqual, cache->Leave);
+  emitLoadWord(&e, RAX, indexed(HOST_CACHE, RCX, 1, offsetof(JitCache, Index)));
+  emitRegister(&e, 0, 0x85, RAX, RAX);
+  emitJumpIfTo(&e, ConditionZero, cache->Leave);
+  emitShift(&e, ShiftLeft, RAX, JIT_SLOT_SHIFT);
+  // add rax, [cache->Code]
+  emitMemory(&e, WIDE, 0x03, RAX, at(HOST_CACHE, offsetof(JitCache, Code)));
+  // jmp rax
+  emitRegister(&e, 0, 0xFF, 4, RAX);
+  uint32_t dispatchSize = e.Size - enterSize - leaveSize;
+
+  addToPerfMap(cache, e.Code, enterSize, "nes_jit_enter");
+  addToPerfMap(cache, cache->Leave, leaveSize, "nes_jit_leave");
+  addToPerfMap(cache, cache->Dispatch, dispatchSize, "nes_jit_dispatch");
+}
+
+// ------------- TRANSLATION -------------
+#define JIT_OPERATIONS(X)                                                      \
+  X(ADC) X(AND) X(ASL) X(BCC) X(BCS) X(BEQ) X(BIT) X(BMI) X(BNE) X(BPL)        \
+  X(BRK) X(BVC) X(BVS) X(CLC) X(CLD) X(CLI) X(CLV) X(CMP) X(CPX) X(CPY)        \
+  X(DEC) X(DEX) X(DEY) X(EOR) X(INC) X(INX) X(INY) X(JMP) X(JSR) X(LDA)        \
+  X(LDX) X(LDY) X(LSR) X(NOP) X(ORA) X(PHA) X(PHP) X(PLA) X(PLP) X(ROL)        \
+  X(ROR) X(RTI) X(RTS) X(SBC) X(SEC) X(SED) X(SEI) X(STA) X(STX) X(STY)        \
+  X(TAX) X(TAY) X(TSX) X(TXA) X(TXS) X(TYA)
+
+typedef enum {
+#define X(name) Jit##name,
+  JIT_OPERATIONS(X)
+#undef X
+  JitUnknown
+} JitOperation;
+
+static const char *const operationNames[] = {
+#define X(name) #name,
+    JIT_OPERATIONS(X)
+#undef X
+};
+
+static JitOperation findOperation(uint8_t opcode) {
+  const char *name = getInstructionName(opcode);
+  for (int i = 0; i < JitUnknown; i++) {
+    if (strcmp(name, operationNames[i]) == 0) {
+      return i;
+    }
+  }
+  return JitUnknown;
+}
+
+// Kinds of memory access
+enum {
+  AccessRead,
+  AccessWrite,
+  AccessModify,
+};
+
+// Leaving before an instruction, when its access turns out to need the
+// interpreter
+typedef struct {
+  uint32_t Patch;
+  uint16_t Pc;
+  uint8_t Instructions;
+  uint16_t Cycles;
+} SideExit;
+
+// Enough room for any instruction, and then for the code that ends the
+// translation after it
+#define INSTRUCTION_ROOM 256
+#define SIDE_EXIT_ROOM 48
+#define MAX_SIDE_EXITS (2 * BLOCK_MAX_INSTRUCTIONS)
+
+typedef struct {
+  JitCache *Cache;
+  const CPU *Cpu;
+  Emitter Code;
+  // The instruction being translated, and the instructions and base cycles
+  // before it
+  uint16_t Pc;
+  int Instructions;
+  int Cycles;
+  SideExit Exits[MAX_SIDE_EXITS];
+  int ExitCount;
+} Translation;
+
+typedef enum {
+  // Translated, the next instruction follows
+  TranslatedNext,
+  // Translated along with where to go after it
+  TranslatedEnd,
+  // Left to the interpreter
+  NotTranslated,
+} Translated;
+
+// Zero page addressing goes straight to cpu->Ram, which is where the zero
+// page is on every mapper
+static bool isZeroPageRam(const CPU *cpu) {
+  return cpu->ReadPages[0] == cpu->Ram && cpu->WritePages[0] == cpu->Ram;
+}
+
+static Memory ram(int32_t address) {
+  return at(HOST_CPU, offsetof(CPU, Ram) + address);
+}
+
+static void emitCount(Emitter *e, int instructions, int cycles) {
+  if (instructions != 0) {
+    emitAluImmediate(e, WIDE, AluAdd, HOST_EXECUTED, instructions);
+  }
+  if (cycles != 0) {
+    emitAluImmediate(e, WIDE, AluAdd, HOST_CYCLES, cycles);
+  }
+}
+
+// Goes on at pc, natively if possible
+static void emitChain(Translation *t, uint16_t pc) {
+  emitMoveImmediate(&t->Code, RCX, pc);
+  emitJumpTo(&t->Code, t->Cache->Dispatch);
+}
+
+// Returns to C, which goes on at pc
+static void emitLeave(Translation *t, uint16_t pc) {
+  emitStoreWordImmediate(&t->Code, at(HOST_CPU, offsetof(CPU, PC)), pc);
+  emitJumpTo(&t->Code, t->Cache->Leave);
+}
+
+// Returns to C after the jump at backEdge, for the idle loop detector
+static void emitLeaveAtBackEdge(Translation *t, uint16_t backEdge) {
+  Emitter *e = &t->Code;
+  emitStoreWordImmediate(e, at(HOST_RUN, offsetof(JitRun, BackEdge)),
+                         backEdge);
+  emitStoreByteImmediate(e, at(HOST_RUN, offsetof(JitRun, AtBackEdge)), 1);
+  emitJumpTo(e, t->Cache->Leave);
+}
+
+// Goes on at target after the jump at t->Pc. Loops that the idle loop
+// detector could skip are left to run(), every other one stays native.
+static void emitJump(Translation *t, uint16_t target) {
+#ifdef NES_IDLE_SKIP
+  if (target <= t->Pc && isIdleLoop(t->Cpu, target, t->Pc)) {
+    emitStoreWordImmediate(&t->Code, at(HOST_CPU, offsetof(CPU, PC)), target);
+    emitLeaveAtBackEdge(t, t->Pc);
+    return;
+  }
+#endif
+  emitChain(t, target);
+}
+
+static void emitSideExitIf(Translation *t, int condition) {
+  SideExit *exit = &t->Exits[t->ExitCount++];
+  exit->Patch = emitJumpIf(&t->Code, condition);
+  exit->Pc = t->Pc;
+  exit->Instructions = t->Instructions;
+  exit->Cycles = t->Cycles;
+}
+
+// Where the byte at an address known when translating is. The address is
+// folded into the code: relative to the CPU when it is in its RAM, or
+// loaded into RDX. Returns false if there is no memory behind it, and the
+// bus callbacks have to handle the access.
+static bool emitStaticLocation(Translation *t, uint16_t address, int access,
+                               Memory *memory) {
+  const CPU *cpu = t->Cpu;
+  int page = address >> BUS_PAGE_SHIFT;
+  uint8_t *read = cpu->ReadPages[page];
+  uint8_t *write = cpu->WritePages[page];
+  uint8_t *host = access == AccessRead    ? read
+                  : access == AccessWrite ? write
+                  : read == write         ? read
+                                          : NULL;
+  if (host == NULL) {
+    return false;
+  }
+  host += address & (BUS_PAGE_SIZE - 1);
+  const uint8_t *base = (const uint8_t *)cpu;
+  if (host >= base && host < base + sizeof(CPU)) {
+    *memory = at(HOST_CPU, host - base);
+  } else {
+    emitMoveImmediate64(&t->Code, RDX, (uintptr_t)host);
+    *memory = at(RDX, 0);
+  }
+  return true;
+}
+
+// Finds the page of the address in ECX in the page tables at run time, and
+// leaves before the instruction if it has no memory behind it
+static Memory emitDynamicLocation(Translation *t, int access) {
+  Emitter *e = &t->Code;
+  int32_t reads = offsetof(CPU, ReadPages);
+  int32_t writes = offsetof(CPU, WritePages);
+  emitMove(e, RDX, RCX);
+  emitShift(e, ShiftRight, RDX, BUS_PAGE_SHIFT);
+  if (access == AccessModify) {
+    // Both ways have to be the same memory
+    emitLoad64(e, RAX, indexed(HOST_CPU, RDX, 3, writes));
+    emitLoad64(e, RDX, indexed(HOST_CPU, RDX, 3, reads));
+    emitRegister(e, WIDE, 0x39, RDX, RAX);
+    emitSideExitIf(t, ConditionNotZero);
+  } else {
+    int32_t pages = access == AccessRead ? reads : writes;
+    emitLoad64(e, RDX, indexed(HOST_CPU, RDX, 3, pages));
+  }
+  emitRegister(e, WIDE, 0x85, RDX, RDX);
+  emitSideExitIf(t, ConditionZero);
+  emitAluImmediate(e, 0, AluAnd, RCX, BUS_PAGE_SIZE - 1);
+  return indexed(RDX, RCX, 0, 0);
+}
+
+// ECX = (operand + index) & 0xFF
+static void emitZeroPageIndex(Emitter *e, int index, uint16_t operand) {
+  emitMove(e, RCX, index);
+  emitAluImmediate(e, 0, AluAdd, RCX, operand);
+  emitZeroExtendByte(e, RCX, RCX);
+}
+
+// Reads that carry into the next page take a cycle more
+static void emitPageCrossPenalty(Translation *t, int index, uint8_t low) {
+  Emitter *e = &t->Code;
+  if (low == 0) {
+    return;
+  }
+  emitAluImmediate(e, 0, AluCmp, index, 0xFF - low);
+  uint32_t noCross = emitJumpIf(e, ConditionBelowEqual);
+  emitAluImmediate(e, WIDE, AluAdd, HOST_CYCLES, 1);
+  patchJump(e, noCross);
+}
+
+// Where the operand of an instruction in memory is, with the code that
+// works it out. Returns false if the access has to go through the bus
+// callbacks.
+static bool emitOperandLocation(Translation *t, AddressingMode mode,
+                                uint16_t operand, int access,
+                                Memory *memory) {
+  Emitter *e = &t->Code;
+  bool zeroPageRam = isZeroPageRam(t->Cpu);
+  switch (mode) {
+  case ModeZeroPage:
+  case ModeAbsolute:
+    return emitStaticLocation(t, operand, access, memory);
+  case ModeZeroPageX:
+  case ModeZeroPageY:
+    if (!zeroPageRam) {
+      return false;
+    }
+    emitZeroPageIndex(e, mode == ModeZeroPageX ? HOST_X : HOST_Y, operand);
+    *memory = indexed(HOST_CPU, RCX, 0, offsetof(CPU, Ram));
+    return true;
+  case ModeAbsoluteX:
+  case ModeAbsoluteY: {
+    int index = mode == ModeAbsoluteX ? HOST_X : HOST_Y;
+    emitMove(e, RCX, index);
+    emitAluImmediate(e, 0, AluAdd, RCX, operand);
+    emitZeroExtendWord(e, RCX, RCX);
+    *memory = emitDynamicLocation(t, access);
+    if (access == AccessRead) {
+      emitPageCrossPenalty(t, index, operand & 0xFF);
+    }
+    return true;
+  }
+  case ModeIndirectX:
+    if (!zeroPageRam) {
+      return false;
+    }
+    emitZeroPageIndex(e, HOST_X, operand);
+    emitLoadByte(e, RAX, indexed(HOST_CPU, RCX, 0, offsetof(CPU, Ram)));
+    emitAluImmediate(e, 0, AluAdd, RCX, 1);
+    emitZeroExtendByte(e, RCX, RCX);
+    emitLoadByte(e, RCX, indexed(HOST_CPU, RCX, 0, offsetof(CPU, Ram)));
+    emitShift(e, ShiftLeft, RCX, 8);
+    emitAlu(e, AluOr, RCX, RAX);
+    *memory = emitDynamicLocation(t, access);
+    return true;
+  case ModeIndirectY:
+    if (!zeroPageRam) {
+      return false;
+    }
+    emitLoadByte(e, RCX, ram(operand & 0xFF));
+    emitLoadByte(e, RAX, ram((operand + 1) & 0xFF));
+    emitShift(e, ShiftLeft, RAX, 8);
+    emitAlu(e, AluOr, RCX, RAX);
+    emitAlu(e, AluAdd, RCX, HOST_Y);
+    emitZeroExtendWord(e, RCX, RCX);
+    *memory = emitDynamicLocation(t, access);
+    if (access == AccessRead) {
+      // The pointer's low byte plus Y carries into bit 8
+      emitLoadByte(e, RAX, ram(operand & 0xFF));
+      emitAlu(e, AluAdd, RAX, HOST_Y);
+      emitShift(e, ShiftRight, RAX, 8);
+      emitRegister(e, WIDE, 0x01, RAX, HOST_CYCLES);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Puts the operand of a read in EAX
+static bool emitReadOperand(Translation *t, AddressingMode mode,
+                            uint16_t operand) {
+  if (mode == ModeImmediate) {
+    emitMoveImmediate(&t->Code, RAX, operand);
+    return true;
+  }
+  Memory memory;
+  if (!emitOperandLocation(t, mode, operand, AccessRead, &memory)) {
+    return false;
+  }
+  emitLoadByte(&t->Code, RAX, memory);
+  return true;
+}
+
+static void emitSetZeroNegative(Emitter *e, int reg) {
+  emitMove(e, HOST_ZERO_NEGATIVE, reg);
+}
+
+// ADC of EAX, SBC being ADC of its complement
+static void emitAddWithCarry(Emitter *e) {
+  emitMove(e, RCX, HOST_A);
+  emitAlu(e, AluAdd, RCX, RAX);
+  emitAlu(e, AluAdd, RCX, HOST_CARRY);
+  emitMove(e, HOST_CARRY, RCX);
+  emitShift(e, ShiftRight, HOST_CARRY, 8);
+  emitZeroExtendByte(e, RCX, RCX);
+  // V is bit 7 of (A ^ result) & (operand ^ result)
+  emitMove(e, RDX, HOST_A);
+  emitAlu(e, AluXor, RDX, RCX);
+  emitAlu(e, AluXor, RAX, RCX);
+  emitAlu(e, AluAnd, RAX, RDX);
+  emitStoreByte(e, at(HOST_CPU, offsetof(CPU, Overflow)), RAX);
+  emitMove(e, HOST_A, RCX);
+  emitSetZeroNegative(e, RCX);
+}
+
+// CMP, CPX and CPY of EAX
+static void emitCompare(Emitter *e, int reg) {
+  emitMove(e, RCX, reg);
+  emitAlu(e, AluSub, RCX, RAX);
+  // setae bpl, carry when there was no borrow
+  emitRegister(e, BYTE, 0x0F90 | ConditionAboveEqual, 0, HOST_CARRY);
+  emitZeroExtendByte(e, HOST_CARRY, HOST_CARRY);
+  emitZeroExtendByte(e, RCX, RCX);
+  emitSetZeroNegative(e, RCX);
+}
+
+static void emitBitTest(Emitter *e) {
+  emitMove(e, RCX, RAX);
+  emitAlu(e, AluAnd, RCX, HOST_A);
+  emitMove(e, RDX, RAX);
+  emitAluImmediate(e, 0, AluAnd, RDX, 0x80);
+  emitShift(e, ShiftLeft, RDX, 1);
+  emitAlu(e, AluOr, RCX, RDX);
+  emitSetZeroNegative(e, RCX);
+  emitShift(e, ShiftLeft, RAX, 1);
+  emitStoreByte(e, at(HOST_CPU, offsetof(CPU, Overflow)), RAX);
+}
+
+// The read-modify-write operations, on EAX. They leave RCX and RDX alone,
+// which may hold the address to write the result back to.
+static void emitModify(Emitter *e, JitOperation operation) {
+  switch (operation) {
+  case JitASL:
+    emitMove(e, HOST_CARRY, RAX);
+    emitShift(e, ShiftRight, HOST_CARRY, 7);
+    emitShift(e, ShiftLeft, RAX, 1);
+    emitZeroExtendByte(e, RAX, RAX);
+    break;
+  case JitLSR:
+    emitMove(e, HOST_CARRY, RAX);
+    emitAluImmediate(e, 0, AluAnd, HOST_CARRY, 1);
+    emitShift(e, ShiftRight, RAX, 1);
+    break;
+  case JitROL:
+    emitShift(e, ShiftLeft, RAX, 1);
+    emitAlu(e, AluOr, RAX, HOST_CARRY);
+    emitMove(e, HOST_CARRY, RAX);
+    emitShift(e, ShiftRight, HOST_CARRY, 8);
+    emitZeroExtendByte(e, RAX, RAX);
+    break;
+  case JitROR:
+    emitShift(e, ShiftLeft, HOST_CARRY, 8);
+    emitAlu(e, AluOr, RAX, HOST_CARRY);
+    emitMove(e, HOST_CARRY, RAX);
+    emitAluImmediate(e, 0, AluAnd, HOST_CARRY, 1);
+    emitShift(e, ShiftRight, RAX, 1);
+    break;
+  case JitINC:
+    emitAluImmediate(e, 0, AluAdd, RAX, 1);
+    emitZeroExtendByte(e, RAX, RAX);
+    break;
+  default:
+    emitAluImmediate(e, 0, AluSub, RAX, 1);
+    emitZeroExtendByte(e, RAX, RAX);
+    break;
+  }
+  emitSetZeroNegative(e, RAX);
+}
+
+// INX, DEX, INY and DEY
+static void emitStep(Emitter *e, int reg, int operation) {
+  emitAluImmediate(e, 0, operation, reg, 1);
+  emitZeroExtendByte(e, reg, reg);
+  emitSetZeroNegative(e, reg);
+}
+
+static void emitTransfer(Emitter *e, int dst, int src) {
+  emitMove(e, dst, src);
+  emitSetZeroNegative(e, dst);
+}
+
+static Memory stackSlot(void) {
+  return indexed(HOST_CPU, RCX, 0, offsetof(CPU, Ram) + 0x0100);
+}
+
+// ECX = S, before a push
+static void emitLoadStackPointer(Emitter *e) {
+  emitLoadByte(e, RCX, at(HOST_CPU, offsetof(CPU, S)));
+}
+
+// Moves ECX to the next slot of a pull
+static void emitStackUp(Emitter *e) {
+  emitAluImmediate(e, 0, AluAdd, RCX, 1);
+  emitZeroExtendByte(e, RCX, RCX);
+}
+
+static void emitStackDown(Emitter *e) {
+  emitAluImmediate(e, 0, AluSub, RCX, 1);
+  emitZeroExtendByte(e, RCX, RCX);
+}
+
+static void emitStoreStackPointer(Emitter *e) {
+  emitStoreByte(e, at(HOST_CPU, offsetof(CPU, S)), RCX);
+}
+
+// Branches end the translation: both ways out count the instructions up to
+// and including the branch
+static void emitBranch(Translation *t, JitOperation operation,
+                       const uint8_t *bytes) {
+  Emitter *e = &t->Code;
+  uint16_t next = t->Pc + 2;
+  uint16_t target = next + (int8_t)bytes[1];
+  int instructions = t->Instructions + 1;
+  int cycles = t->Cycles + getInstructionCycles(bytes[0]);
+  int takenCycles = 1 + ((next & 0xFF00) != (target & 0xFF00));
+  int taken = ConditionNotZero;
+  switch (operation) {
+  case JitBNE:
+  case JitBEQ:
+    emitRegister(e, 0, 0xF7, 0, HOST_ZERO_NEGATIVE);
+    emit32(e, 0xFF);
+    taken = operation == JitBNE ? ConditionNotZero : ConditionZero;
+    break;
+  case JitBMI:
+  case JitBPL:
+    emitRegister(e, 0, 0xF7, 0, HOST_ZERO_NEGATIVE);
+    emit32(e, 0x180);
+    taken = operation == JitBMI ? ConditionNotZero : ConditionZero;
+    break;
+  case JitBCS:
+  case JitBCC:
+    emitRegister(e, 0, 0x85, HOST_CARRY, HOST_CARRY);
+    taken = operation == JitBCS ? ConditionNotZero : ConditionZero;
+    break;
+  default:
+    emitMemory(e, 0, 0xF6, 0, at(HOST_CPU, offsetof(CPU, Overflow)));
+    emit8(e, 0x80);
+    taken = operation == JitBVS ? ConditionNotZero : ConditionZero;
+    break;
+  }
+  uint32_t jump = emitJumpIf(e, taken);
+  emitCount(e, instructions, cycles);
+  emitChain(t, next);
+  patchJump(e, jump);
+  emitCount(e, instructions, cycles + takenCycles);
+  emitJump(t, target);
+}
+
+static Translated translateInstruction(Translation *t, const uint8_t *bytes) {
+  Emitter *e = &t->Code;
+  uint8_t opcode = bytes[0];
+  AddressingMode mode = getAddressingMode(opcode);
+  uint16_t operand =
+      getInstructionLength(opcode) == 3 ? bytes[1] | bytes[2] << 8 : bytes[1];
+  int instructions = t->Instructions + 1;
+  int cycles = t->Cycles + getInstructionCycles(opcode);
+  JitOperation operation = findOperation(opcode);
+  Memory memory = at(HOST_CPU, 0);
+
+  switch (operation) {
+  case JitADC:
+  case JitSBC:
+  case JitAND:
+  case JitORA:
+  case JitEOR:
+  case JitBIT:
+  case JitCMP:
+  case JitCPX:
+  case JitCPY:
+  case JitLDA:
+  case JitLDX:
+  case JitLDY:
+    if (!emitReadOperand(t, mode, operand)) {
+      return NotTranslated;
+    }
+    break;
+  case JitSTA:
+  case JitSTX:
+  case JitSTY:
+    if (!emitOperandLocation(t, mode, operand, AccessWrite, &memory)) {
+      return NotTranslated;
+    }
+    break;
+  case JitASL:
+  case JitLSR:
+  case JitROL:
+  case JitROR:
+  case JitINC:
+  case JitDEC:
+    if (mode == ModeAccumulator) {
+      emitMove(e, RAX, HOST_A);
+      emitModify(e, operation);
+      emitMove(e, HOST_A, RAX);
+      return TranslatedNext;
+    }
+    if (!emitOperandLocation(t, mode, operand, AccessModify, &memory)) {
+      return NotTranslated;
+    }
+    emitLoadByte(e, RAX, memory);
+    emitModify(e, operation);
+    emitStoreByte(e, memory, RAX);
+    return TranslatedNext;
+  default:
+    break;
+  }
+
+  switch (operation) {
+  case JitADC:
+    emitAddWithCarry(e);
+    break;
+  case JitSBC:
+    emitAluImmediate(e, 0, AluXor, RAX, 0xFF);
+    emitAddWithCarry(e);
+    break;
+  case JitAND:
+    emitAlu(e, AluAnd, HOST_A, RAX);
+    emitSetZeroNegative(e, HOST_A);
+    break;
+  case JitORA:
+    emitAlu(e, AluOr, HOST_A, RAX);
+    emitSetZeroNegative(e, HOST_A);
+    break;
+  case JitEOR:
+    emitAlu(e, AluXor, HOST_A, RAX);
+    emitSetZeroNegative(e, HOST_A);
+    break;
+  case JitBIT:
+    emitBitTest(e);
+    break;
+  case JitCMP:
+    emitCompare(e, HOST_A);
+    break;
+  case JitCPX:
+    emitCompare(e, HOST_X);
+    break;
+  case JitCPY:
+    emitCompare(e, HOST_Y);
+    break;
+  case JitLDA:
+    emitTransfer(e, HOST_A, RAX);
+    break;
+  case JitLDX:
+    emitTransfer(e, HOST_X, RAX);
+    break;
+  case JitLDY:
+    emitTransfer(e, HOST_Y, RAX);
+    break;
+  case JitSTA:
+    emitStoreByte(e, memory, HOST_A);
+    break;
+  case JitSTX:
+    emitStoreByte(e, memory, HOST_X);
+    break;
+  case JitSTY:
+    emitStoreByte(e, memory, HOST_Y);
+    break;
+  case JitCLC:
+    emitMoveImmediate(e, HOST_CARRY, 0);
+    break;
+  case JitSEC:
+    emitMoveImmediate(e, HOST_CARRY, 1);
+    break;
+  case JitCLV:
+    emitStoreByteImmediate(e, at(HOST_CPU, offsetof(CPU, Overflow)), 0);
+    break;
+  case JitCLI:
+  case JitCLD:
+  case JitSEI:
+  case JitSED: {
+    uint8_t bit = operation == JitCLI || operation == JitSEI ? 0x04 : 0x08;
+    bool set = operation == JitSEI || operation == JitSED;
+    emitMemory(e, 0, 0x80, set ? AluOr : AluAnd,
+               at(HOST_CPU, offsetof(CPU, P)));
+    emit8(e, set ? bit : (uint8_t)~bit);
+    break;
+  }
+  case JitNOP:
+    break;
+  case JitINX:
+    emitStep(e, HOST_X, AluAdd);
+    break;
+  case JitINY:
+    emitStep(e, HOST_Y, AluAdd);
+    break;
+  case JitDEX:
+    emitStep(e, HOST_X, AluSub);
+    break;
+  case JitDEY:
+    emitStep(e, HOST_Y, AluSub);
+    break;
+  case JitTAX:
+    emitTransfer(e, HOST_X, HOST_A);
+    break;
+  case JitTAY:
+    emitTransfer(e, HOST_Y, HOST_A);
+    break;
+  case JitTXA:
+    emitTransfer(e, HOST_A, HOST_X);
+    break;
+  case JitTYA:
+    emitTransfer(e, HOST_A, HOST_Y);
+    break;
+  case JitTSX:
+    emitLoadByte(e, HOST_X, at(HOST_CPU, offsetof(CPU, S)));
+    emitSetZeroNegative(e, HOST_X);
+    break;
+  case JitTXS:
+    emitStoreByte(e, at(HOST_CPU, offsetof(CPU, S)), HOST_X);
+    break;
+  case JitPHA:
+    emitLoadStackPointer(e);
+    emitStoreByte(e, stackSlot(), HOST_A);
+    emitStackDown(e);
+    emitStoreStackPointer(e);
+    break;
+  case JitPLA:
+    emitLoadStackPointer(e);
+    emitStackUp(e);
+    emitStoreStackPointer(e);
+    emitLoadByte(e, HOST_A, stackSlot());
+    emitSetZeroNegative(e, HOST_A);
+    break;
+  case JitBCC:
+  case JitBCS:
+  case JitBEQ:
+  case JitBNE:
+  case JitBMI:
+  case JitBPL:
+  case JitBVC:
+  case JitBVS:
+    emitBranch(t, operation, bytes);
+    return TranslatedEnd;
+  case JitJMP:
+    if (mode == ModeIndirect) {
+      // The pointer's high byte never carries
+      uint16_t high = (operand & 0xFF00) | (uint8_t)(operand + 1);
+      if (!emitStaticLocation(t, operand, AccessRead, &memory)) {
+        return NotTranslated;
+      }
+      emitLoadByte(e, RAX, memory);
+      if (!emitStaticLocation(t, high, AccessRead, &memory)) {
+        return NotTranslated;
+      }
+      emitLoadByte(e, RCX, memory);
+      emitShift(e, ShiftLeft, RCX, 8);
+      emitAlu(e, AluOr, RCX, RAX);
+      emitCount(e, instructions, cycles);
+      // Where it goes is only known now, so run() looks at it
+      emitStoreWord(e, at(HOST_CPU, offsetof(CPU, PC)), RCX);
+      emitLeaveAtBackEdge(t, t->Pc);
+      return TranslatedEnd;
+    }
+    emitCount(e, instructions, cycles);
+    emitJump(t, operand);
+    return TranslatedEnd;
+  case JitJSR: {
+    // The address pushed is the last byte of the JSR
+    uint16_t returnAddress = t->Pc + 2;
+    emitLoadStackPointer(e);
+    emitStoreByteImmediate(e, stackSlot(), returnAddress >> 8);
+    emitStackDown(e);
+    emitStoreByteImmediate(e, stackSlot(), returnAddress & 0xFF);
+    emitStackDown(e);
+    emitStoreStackPointer(e);
+    emitCount(e, instructions, cycles);
+    emitJump(t, operand);
+    return TranslatedEnd;
+  }
+  case JitRTS:
+    emitLoadStackPointer(e);
+    emitStackUp(e);
+    emitLoadByte(e, RAX, stackSlot());
+    emitStackUp(e);
+    emitLoadByte(e, RDX, stackSlot());
+    emitStoreStackPointer(e);
+    emitShift(e, ShiftLeft, RDX, 8);
+    emitAlu(e, AluOr, RAX, RDX);
+    emitAluImmediate(e, 0, AluAdd, RAX, 1);
+    emitZeroExtendWord(e, RCX, RAX);
+    emitCount(e, instructions, cycles);
+    emitJumpTo(e, t->Cache->Dispatch);
+    return TranslatedEnd;
+  default:
+    // BRK, RTI, PHP, PLP and the undocumented opcodes
+    return NotTranslated;
+  }
+  return TranslatedNext;
+}
+
+// Translates the block at start into slot. Returns false if nothing could
+// be.
+static bool translate(JitCache *cache, const CPU *cpu, uint16_t start,
+                      int slot) {
+  Translation t = {.Cache = cache, .Cpu = cpu};
+  t.Code.Code = cache->Code + ((size_t)slot << JIT_SLOT_SHIFT);
+  t.Code.Capacity = JIT_SLOT_SIZE;
+  Emitter *e = &t.Code;
+  emitStore64(e,
+              at(HOST_CACHE, offsetof(JitCache, Stamps) +
+                                 (slot - 1) * sizeof(cache->Stamps[0])),
+              HOST_CYCLES);
+  uint16_t pc = start;
+  Translated result = TranslatedNext;
+  uint8_t bytes[3];
+  while (t.Instructions < BLOCK_MAX_INSTRUCTIONS &&
+         e->Size + INSTRUCTION_ROOM + (t.ExitCount + 2) * SIDE_EXIT_ROOM <=
+             e->Capacity &&
+         readRomInstruction(cpu, pc, bytes)) {
+    uint32_t size = e->Size;
+    int exitCount = t.ExitCount;
+    t.Pc = pc;
+    result = translateInstruction(&t, bytes);
+    if (result == NotTranslated) {
+      e->Size = size;
+      t.ExitCount = exitCount;
+      break;
+    }
+    t.Instructions++;
+    t.Cycles += getInstructionCycles(bytes[0]);
+    pc += getInstructionLength(bytes[0]);
+    if (result == TranslatedEnd) {
+      break;
+    }
+  }
+  if (t.Instructions == 0) {
+    return false;
+  }
+  if (result != TranslatedEnd) {
+    emitCount(e, t.Instructions, t.Cycles);
+    if (result == NotTranslated) {
+      emitLeave(&t, pc);
+    } else {
+      emitChain(&t, pc);
+    }
+  }
+  for (int i = 0; i < t.ExitCount; i++) {
+    SideExit *exit = &t.Exits[i];
+    patchJump(e, exit->Patch);
+    emitCount(e, exit->Instructions, exit->Cycles);
+    emitLeave(&t, exit->Pc);
+  }
+  if (e->Overflow) {
+    return false;
+  }
+  char name[16];
+  snprintf(name, sizeof(name), "nes_%04X", start);
+  addToPerfMap(cache, e->Code, e->Size, name);
+  return true;
+}
+
+// ------------- CACHE -------------
+#define JIT_CODE_SIZE ((size_t)(JIT_SLOTS + 1) << JIT_SLOT_SHIFT)
+
+JitCache *jitCacheCreate(void) {
+  JitCache *cache = calloc(1, sizeof(JitCache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  // Written while translating and executable otherwise, never both
+  void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(cache);
+    return NULL;
+  }
+  cache->Code = code;
+  // The perf map is only written when asked for with NES_PERF_MAP=1
+  cache->PerfMap = -1;
+  const char *perfMap = getenv("NES_PERF_MAP");
+  if (perfMap != NULL && strcmp(perfMap, "1") == 0) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    cache->PerfMap = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  }
+  emitSharedCode(cache);
+  if (mprotect(code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0) {
+    jitCacheDestroy(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void jitCacheDestroy(JitCache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  if (cache->PerfMap >= 0) {
+    close(cache->PerfMap);
+  }
+  munmap(cache->Code, JIT_CODE_SIZE);
+  free(cache);
+}
+
+// Forgets the translation in slot, unless its address has moved on to
+// another one
+static void dropSlot(JitCache *cache, int slot) {
+  uint16_t start = cache->Starts[slot - 1];
+  if (cache->Index[start] == slot) {
+    cache->Index[start] = 0;
+  }
+}
+
+void jitCacheMap(JitCache *cache, const CPU *cpu) {
+  if (memcmp(cache->ReadPages, cpu->ReadPages, sizeof(cache->ReadPages)) ==
+          0 &&
+      memcmp(cache->WritePages, cpu->WritePages, sizeof(cache->WritePages)) ==
+          0) {
+    return;
+  }
+  for (uint32_t slot = 1; slot <= cache->Used; slot++) {
+    dropSlot(cache, slot);
+  }
+  cache->Used = 0;
+  memcpy(cache->ReadPages, cpu->ReadPages, sizeof(cache->ReadPages));
+  memcpy(cache->WritePages, cpu->WritePages, sizeof(cache->WritePages));
+}
+
+// A free slot, or the one entered least recently
+static int allocateSlot(JitCache *cache) {
+  if (cache->Used < JIT_SLOTS) {
+    return ++cache->Used;
+  }
+  int oldest = 1;
+  for (int slot = 2; slot <= JIT_SLOTS; slot++) {
+    if (cache->Stamps[slot - 1] < cache->Stamps[oldest - 1]) {
+      oldest = slot;
+    }
+  }
+  dropSlot(cache, oldest);
+  cache->Evicted++;
+  return oldest;
+}
+
+// Tries the first instruction at pc out in a scratch buffer, to find out
+// whether translate() would get anywhere without taking a slot for it
+static bool canTranslate(JitCache *cache, const CPU *cpu, uint16_t pc) {
+  uint8_t bytes[3];
+  if (!readRomInstruction(cpu, pc, bytes)) {
+    return false;
+  }
+  uint8_t scratch[INSTRUCTION_ROOM + MAX_SIDE_EXITS * SIDE_EXIT_ROOM];
+  Translation t = {.Cache = cache, .Cpu = cpu};
+  t.Code.Code = scratch;
+  t.Code.Capacity = sizeof(scratch);
+  t.Pc = pc;
+  return translateInstruction(&t, bytes) != NotTranslated;
+}
+
+bool jitCacheTranslate(JitCache *cache, const CPU *cpu, uint16_t pc) {
+  // With every slot taken a new translation evicts one, which a block that
+  // starts with an I/O access or BRK would do for nothing
+  if (!canTranslate(cache, cpu, pc)) {
+    return false;
+  }
+  int slot = allocateSlot(cache);
+  uint8_t *code = cache->Code + ((size_t)slot << JIT_SLOT_SHIFT);
+  if (mprotect(code, JIT_SLOT_SIZE, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  bool translated = translate(cache, cpu, pc, slot);
+  if (mprotect(code, JIT_SLOT_SIZE, PROT_READ | PROT_EXEC) != 0) {
+    translated = false;
+  }
+  if (!translated) {
+    if (slot == (int)cache->Used) {
+      cache->Used--;
+    } else {
+      // Empty, and so the first to go
+      cache->Stamps[slot - 1] = 0;
+    }
+    return false;
+  }
+  cache->Index[pc] = slot;
+  cache->Starts[slot - 1] = pc;
+  cache->Stamps[slot - 1] = cpu->Cycles;
+  cache->Translated++;
+  return true;
+}
+
+void jitCacheRun(JitCache *cache, CPU *cpu, JitRun *run) {
+  cache->Enter(cpu, run,
+               cache->Code + ((size_t)cache->Index[cpu->PC] << JIT_SLOT_SHIFT));
+}
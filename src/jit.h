@@ -0,0 +1,96 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "block.h"
+#include "cpu.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Dynamic recompiler (cmake -DNES_JIT=ON, x86-64 only). Blocks of ROM code
+// that the block cache has run JIT_HOT_RUNS times are translated into x86-64
+// machine code, with the registers and flags kept in host registers. The
+// translations jump from one to the next through a table indexed by PC, so a
+// hot loop runs without coming back to run() at all, and only return when
+// the next block has no translation, the instruction or cycle budget of the
+// run could run out in it, or the code needs the interpreter:
+//  - an access to a page without memory behind it (I/O and mapper
+//    registers, writes to ROM), found when translating or at run time
+//  - an instruction that isn't translated (BRK, RTI, PHP, PLP and the
+//    undocumented opcodes)
+//  - a backward jump that could close an idle loop, so that the idle loop
+//    detector still sees it
+// The state is then exactly what the interpreter would have left.
+//
+// Like the block cache, only ROM is translated, so nothing the CPU writes
+// can change code under a translation, and everything is dropped when the
+// memory map changes, which is what bank switching does. Translations live
+// in fixed size slots of one executable mapping; when they are all taken,
+// the one that ran least recently makes room for the next.
+//
+// With NES_PERF_MAP=1 in the environment, every translation is also listed
+// in /tmp/perf-<pid>.map, so perf can tell which 6502 code the time spent in
+// them went to.
+
+// Runs of a block before it is translated. A power of two.
+#define JIT_HOT_RUNS 32
+#define JIT_SLOTS 255
+#define JIT_SLOT_SHIFT 12
+#define JIT_SLOT_SIZE (1 << JIT_SLOT_SHIFT)
+
+// What run() hands to native code and gets back
+typedef struct {
+  uint64_t Executed;
+  // Another block is only started while Executed and the CPU's Cycles are
+  // below these, the same limits run() keeps to
+  uint64_t CountLimit;
+  uint64_t CycleLimit;
+  // Set when native code stopped right after the jump at BackEdge, which may
+  // close an idle loop
+  uint16_t BackEdge;
+  bool AtBackEdge;
+} JitRun;
+
+typedef void (*JitEntry)(CPU *cpu, JitRun *run, const uint8_t *code);
+
+struct JitCache {
+  // Slot + 1 of the translation of the code at each address, 0 when none
+  uint16_t Index[BLOCK_ADDRESSES];
+  // CPU cycle count when each translation was last entered, for eviction
+  uint64_t Stamps[JIT_SLOTS];
+  uint16_t Starts[JIT_SLOTS];
+  uint32_t Used;
+  // The mapping: the shared entry, dispatch and exit code in the first slot
+  // and the translations in the others
+  uint8_t *Code;
+  JitEntry Enter;
+  const uint8_t *Dispatch;
+  const uint8_t *Leave;
+  uint32_t Translated;
+  uint32_t Evicted;
+  // The memory map the translations were made for
+  uint8_t *ReadPages[BUS_PAGE_COUNT];
+  uint8_t *WritePages[BUS_PAGE_COUNT];
+  int PerfMap;
+};
+
+#ifdef NES_JIT
+
+// NULL if the host won't give out executable memory
+JitCache *jitCacheCreate(void);
+void jitCacheDestroy(JitCache *cache);
+// Drops every translation if the CPU's memory map isn't the one they were
+// made for
+void jitCacheMap(JitCache *cache, const CPU *cpu);
+// Translates the block at pc. Returns false if not even its first
+// instruction can be translated.
+bool jitCacheTranslate(JitCache *cache, const CPU *cpu, uint16_t pc);
+// Runs the translation at the CPU's PC and the ones it leads to
+void jitCacheRun(JitCache *cache, CPU *cpu, JitRun *run);
+
+static inline bool jitCacheFind(const JitCache *cache, uint16_t pc) {
+  return cache->Index[pc] != 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,350 @@
+#include "library.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Directories nested deeper than this are not scanned
+#define MAX_SCAN_DEPTH 16
+// While there is nothing from a previous run to show, the scan publishes
+// what it found every this many ROMs
+#define PUBLISH_BATCH_SIZE 256
+
+typedef struct {
+  // Lower case file name, what searches match against
+  char *Key;
+  char *Path;
+  RomInfo Info;
+} LibraryEntry;
+
+typedef struct {
+  LibraryEntry *Items;
+  size_t Count;
+  size_t Capacity;
+} EntryList;
+
+struct RomLibrary {
+  // Guards Index, the sorted list searches use
+  pthread_mutex_t Lock;
+  EntryList Index;
+  // Only touched by the scan thread while it runs
+  RomCache *Cache;
+  char **Directories;
+  int DirectoryCount;
+  pthread_t Scanner;
+  bool ScanStarted;
+  // Set when the index came from the cache, and is replaced as a whole
+  // once the scan is done
+  bool Preloaded;
+  atomic_bool ScanDone;
+  atomic_bool StopScan;
+  atomic_size_t FilesScanned;
+};
+
+static void freeEntries(EntryList *list) {
+  for (size_t i = 0; i < list->Count; i++) {
+    free(list->Items[i].Key);
+    free(list->Items[i].Path);
+  }
+  free(list->Items);
+  list->Items = NULL;
+  list->Count = 0;
+  list->Capacity = 0;
+}
+
+static bool appendEntry(EntryList *list, const char *path,
+                        const RomInfo *info) {
+  if (list->Count == list->Capacity) {
+    size_t capacity = list->Capacity == 0 ? 64 : list->Capacity * 2;
+    LibraryEntry *items = realloc(list->Items, capacity * sizeof(LibraryEntry));
+    if (items == NULL) {
+      return false;
+    }
+    list->Items = items;
+    list->Capacity = capacity;
+  }
+  const char *name = strrchr(path, '/');
+  name = name != NULL ? name + 1 : path;
+  LibraryEntry *entry = &list->Items[list->Count];
+  entry->Key = strdup(name);
+  entry->Path = strdup(path);
+  if (entry->Key == NULL || entry->Path == NULL) {
+    free(entry->Key);
+    free(entry->Path);
+    return false;
+  }
+  for (char *c = entry->Key; *c != '\0'; c++) {
+    *c = tolower((unsigned char)*c);
+  }
+  entry->Info = *info;
+  list->Count++;
+  return true;
+}
+
+static int compareEntries(const void *a, const void *b) {
+  const LibraryEntry *left = a;
+  const LibraryEntry *right = b;
+  int order = strcmp(left->Key, right->Key);
+  return order != 0 ? order : strcmp(left->Path, right->Path);
+}
+
+// Moves the entries of batch into the sorted list
+static bool mergeEntries(EntryList *list, EntryList *batch) {
+  size_t count = list->Count + batch->Count;
+  LibraryEntry *items = malloc(count * sizeof(LibraryEntry));
+  if (items == NULL) {
+    return false;
+  }
+  qsort(batch->Items, batch->Count, sizeof(LibraryEntry), compareEntries);
+  size_t i = 0;
+  size_t j = 0;
+  for (size_t k = 0; k < count; k++) {
+    if (j == batch->Count ||
+        (i < list->Count &&
+         compareEntries(&list->Items[i], &batch->Items[j]) <= 0)) {
+      items[k] = list->Items[i++];
+    } else {
+      items[k] = batch->Items[j++];
+    }
+  }
+  free(list->Items);
+  list->Items = items;
+  list->Count = count;
+  list->Capacity = count;
+  batch->Count = 0;
+  return true;
+}
+
+RomLibrary *romLibraryOpen(const char *cacheFile) {
+  RomLibrary *library = calloc(1, sizeof(RomLibrary));
+  if (library == NULL) {
+    return NULL;
+  }
+  library->Cache = romCacheOpen(cacheFile);
+  if (library->Cache == NULL) {
+    free(library);
+    return NULL;
+  }
+  pthread_mutex_init(&library->Lock, NULL);
+  atomic_init(&library->ScanDone, false);
+  atomic_init(&library->StopScan, false);
+  atomic_init(&library->FilesScanned, 0);
+  return library;
+}
+
+bool romLibraryAddDirectory(RomLibrary *library, const char *directory) {
+  if (library->ScanStarted) {
+    return false;
+  }
+  char **directories =
+      realloc(library->Directories,
+              (library->DirectoryCount + 1) * sizeof(char *));
+  if (directories == NULL) {
+    return false;
+  }
+  library->Directories = directories;
+  // Paths are built as directory/name, so a trailing slash would double up
+  size_t length = strlen(directory);
+  while (length > 1 && directory[length - 1] == '/') {
+    length--;
+  }
+  char *copy = strndup(directory, length);
+  if (copy == NULL) {
+    return false;
+  }
+  library->Directories[library->DirectoryCount++] = copy;
+  return true;
+}
+
+static bool isInLibrary(RomLibrary *library, const char *path) {
+  for (int i = 0; i < library->DirectoryCount; i++) {
+    size_t length = strlen(library->Directories[i]);
+    if (strncmp(path, library->Directories[i], length) == 0 &&
+        path[length] == '/') {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void preloadEntry(void *context, const char *path,
+                         const RomInfo *info) {
+  RomLibrary *library = context;
+  if (isInLibrary(library, path)) {
+    appendEntry(&library->Index, path, info);
+  }
+}
+
+typedef struct {
+  RomLibrary *Library;
+  // Everything found, becomes the index when the scan is done
+  EntryList Found;
+  // Found since the last publish, only used without a preloaded index
+  EntryList Batch;
+} Scan;
+
+static void publishBatch(Scan *scan) {
+  RomLibrary *library = scan->Library;
+  pthread_mutex_lock(&library->Lock);
+  if (!mergeEntries(&library->Index, &scan->Batch)) {
+    freeEntries(&scan->Batch);
+  }
+  pthread_mutex_unlock(&library->Lock);
+}
+
+static void scanFile(Scan *scan, const char *path) {
+  RomLibrary *library = scan->Library;
+  RomInfo info;
+  atomic_fetch_add_explicit(&library->FilesScanned, 1, memory_order_relaxed);
+  if (!romCacheLookup(library->Cache, path, &info)) {
+    return;
+  }
+  appendEntry(&scan->Found, path, &info);
+  if (!library->Preloaded && appendEntry(&scan->Batch, path, &info) &&
+      scan->Batch.Count >= PUBLISH_BATCH_SIZE) {
+    publishBatch(scan);
+  }
+}
+
+static void scanDirectory(Scan *scan, const char *directory, int depth) {
+  DIR *dir = opendir(directory);
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  char path[LIBRARY_PATH_SIZE];
+  while ((entry = readdir(dir)) != NULL &&
+         !atomic_load_explicit(&scan->Library->StopScan,
+                               memory_order_relaxed)) {
+    if (entry->d_name[0] == '.' ||
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name) >=
+            (int)sizeof(path)) {
+      continue;
+    }
+    // Links to directories are not followed, so a loop of links can't
+    // keep the scan going forever
+    unsigned char type = entry->d_type;
+    struct stat status;
+    if (type == DT_UNKNOWN && lstat(path, &status) == 0) {
+      type = S_ISDIR(status.st_mode) ? DT_DIR : DT_REG;
+    }
+    if (type == DT_DIR) {
+      if (depth < MAX_SCAN_DEPTH) {
+        scanDirectory(scan, path, depth + 1);
+      }
+    } else if (type == DT_REG || type == DT_LNK) {
+      scanFile(scan, path);
+    }
+  }
+  closedir(dir);
+}
+
+static void *runScan(void *arg) {
+  Scan scan = {arg, {0}, {0}};
+  RomLibrary *library = scan.Library;
+  for (int i = 0; i < library->DirectoryCount; i++) {
+    scanDirectory(&scan, library->Directories[i], 0);
+  }
+  qsort(scan.Found.Items, scan.Found.Count, sizeof(LibraryEntry),
+        compareEntries);
+  freeEntries(&scan.Batch);
+
+  // A stopped scan is incomplete, so it doesn't replace what is there
+  pthread_mutex_lock(&library->Lock);
+  if (!atomic_load(&library->StopScan)) {
+    EntryList old = library->Index;
+    library->Index = scan.Found;
+    scan.Found = old;
+  }
+  pthread_mutex_unlock(&library->Lock);
+  freeEntries(&scan.Found);
+  atomic_store(&library->ScanDone, true);
+  return NULL;
+}
+
+bool romLibraryStartScan(RomLibrary *library) {
+  if (library->ScanStarted) {
+    return false;
+  }
+  romCacheForEach(library->Cache, preloadEntry, library);
+  qsort(library->Index.Items, library->Index.Count, sizeof(LibraryEntry),
+        compareEntries);
+  library->Preloaded = library->Index.Count > 0;
+  if (pthread_create(&library->Scanner, NULL, runScan, library) != 0) {
+    return false;
+  }
+  library->ScanStarted = true;
+  return true;
+}
+
+bool romLibraryScanDone(RomLibrary *library) {
+  return atomic_load(&library->ScanDone);
+}
+
+void romLibraryWaitForScan(RomLibrary *library) {
+  if (library->ScanStarted) {
+    pthread_join(library->Scanner, NULL);
+    library->ScanStarted = false;
+  }
+}
+
+size_t romLibraryFilesScanned(RomLibrary *library) {
+  return atomic_load_explicit(&library->FilesScanned, memory_order_relaxed);
+}
+
+size_t romLibrarySearch(RomLibrary *library, const char *prefix,
+                        RomMatch *matches, size_t maxMatches) {
+  char key[LIBRARY_PATH_SIZE];
+  size_t length = 0;
+  for (; prefix[length] != '\0' && length + 1 < sizeof(key); length++) {
+    key[length] = tolower((unsigned char)prefix[length]);
+  }
+  key[length] = '\0';
+
+  pthread_mutex_lock(&library->Lock);
+  EntryList *index = &library->Index;
+  // The first entry that is not less than the prefix
+  size_t low = 0;
+  size_t high = index->Count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (strcmp(index->Items[middle].Key, key) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  size_t found = 0;
+  for (size_t i = low;
+       i < index->Count && strncmp(index->Items[i].Key, key, length) == 0;
+       i++, found++) {
+    if (found < maxMatches) {
+      snprintf(matches[found].Path, sizeof(matches[found].Path), "%s",
+               index->Items[i].Path);
+      matches[found].Info = index->Items[i].Info;
+    }
+  }
+  pthread_mutex_unlock(&library->Lock);
+  return found;
+}
+
+void romLibraryClose(RomLibrary *library) {
+  if (library == NULL) {
+    return;
+  }
+  atomic_store(&library->StopScan, true);
+  romLibraryWaitForScan(library);
+  romCacheSave(library->Cache);
+  romCacheClose(library->Cache);
+  freeEntries(&library->Index);
+  for (int i = 0; i < library->DirectoryCount; i++) {
+    free(library->Directories[i]);
+  }
+  free(library->Directories);
+  pthread_mutex_destroy(&library->Lock);
+  free(library);
+}
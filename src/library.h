@@ -0,0 +1,40 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "romcache.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LIBRARY_PATH_SIZE 1024
+
+// An index of the ROMs under a set of directories, searchable by the start
+// of their file name. The directories are scanned, recursively, on a
+// background thread; every file is checked for the iNES magic and the results
+// are kept in a RomCache, so a rescan only opens files that are new or have
+// changed since the last one. Until the scan finishes, searches see what
+// the cache knew from last time, or the ROMs found so far if there was no
+// cache yet. All the functions may be called while the scan runs.
+typedef struct RomLibrary RomLibrary;
+
+typedef struct {
+  char Path[LIBRARY_PATH_SIZE];
+  RomInfo Info;
+} RomMatch;
+
+// Returns NULL only when out of memory
+RomLibrary *romLibraryOpen(const char *cacheFile);
+// Directories must all be added before the scan starts
+bool romLibraryAddDirectory(RomLibrary *library, const char *directory);
+bool romLibraryStartScan(RomLibrary *library);
+bool romLibraryScanDone(RomLibrary *library);
+void romLibraryWaitForScan(RomLibrary *library);
+// Files looked at by the scan so far, ROMs or not
+size_t romLibraryFilesScanned(RomLibrary *library);
+// Copies up to maxMatches ROMs whose file name starts with prefix, ignoring
+// case, in name order. Returns how many ROMs match in all.
+size_t romLibrarySearch(RomLibrary *library, const char *prefix,
+                        RomMatch *matches, size_t maxMatches);
+// Stops the scan if it is still running and saves the cache
+void romLibraryClose(RomLibrary *library);
+
+#endif
@@ -0,0 +1,217 @@
+// Lockstep check of the block cache and the JIT against the interpreter:
+// runs a game on two machines, one with the block cache (and the JIT, when
+// it is built) and one in the plain interpreter of cpu.c, and compares their
+// whole state after every frame. At the first frame that differs it goes
+// back to where the frame started and narrows the difference down to the
+// instruction where the two part.
+#include "emulator.h"
+#include "input.h"
+#ifdef NES_JIT
+#include "jit.h"
+#define FAST_NAME "JIT"
+#else
+#define FAST_NAME "block cache"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_FRAMES 3600
+
+void printUsage(char *program) {
+  printf("Usage: %s <game.nes> [--frames N] [--input SCRIPT]\n", program);
+  printf("Runs %d frames, or the length of the input, when not told "
+         "otherwise.\n",
+         DEFAULT_FRAMES);
+}
+
+typedef struct {
+  NesMachine *Fast;
+  NesMachine *Reference;
+  size_t StateSize;
+  uint8_t *FastState;
+  uint8_t *ReferenceState;
+} Lockstep;
+
+// Saves both machines and tells whether they are in the same state
+bool sameState(Lockstep *lockstep) {
+  nesMachineSaveState(lockstep->Fast, lockstep->FastState, lockstep->StateSize);
+  nesMachineSaveState(lockstep->Reference, lockstep->ReferenceState,
+                      lockstep->StateSize);
+  return memcmp(lockstep->FastState, lockstep->ReferenceState,
+                lockstep->StateSize) == 0;
+}
+
+void restore(Lockstep *lockstep, const uint8_t *state) {
+  nesMachineLoadState(lockstep->Fast, state, lockstep->StateSize);
+  nesMachineLoadState(lockstep->Reference, state, lockstep->StateSize);
+}
+
+void printCpu(const char *label, NesMachine *machine) {
+  CPU *cpu = nesMachineGetCpu(machine);
+  char instruction[32];
+  disassembleInstruction(cpu, cpu->PC, instruction, sizeof(instruction));
+  printf("%-11s PC:%04X %-14s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+         label, cpu->PC, instruction, cpu->A, cpu->X, cpu->Y,
+         getProcessorStatus(cpu), cpu->S, (unsigned long long)cpu->Cycles);
+}
+
+void printRamDifferences(Lockstep *lockstep) {
+  CPU *fast = nesMachineGetCpu(lockstep->Fast);
+  CPU *reference = nesMachineGetCpu(lockstep->Reference);
+  int shown = 0;
+  for (int address = 0; address < NES_RAM_SIZE && shown < 8; address++) {
+    if (fast->Ram[address] != reference->Ram[address]) {
+      printf("RAM $%04X: " FAST_NAME " %02X, interpreter %02X\n", address,
+             fast->Ram[address], reference->Ram[address]);
+      shown++;
+    }
+  }
+}
+
+// Runs n instructions on both machines from state, without the NMI, and
+// tells whether they still agree
+bool agreeAfter(Lockstep *lockstep, const uint8_t *state, uint64_t n) {
+  restore(lockstep, state);
+  nesMachineRunInstructions(lockstep->Fast, n);
+  nesMachineRunInstructions(lockstep->Reference, n);
+  return sameState(lockstep);
+}
+
+// The frame that started in state ended differently. Finds the first
+// instruction count after which the machines differ.
+void narrowDown(Lockstep *lockstep, const uint8_t *state,
+                uint64_t instructions) {
+  uint8_t *start = malloc(lockstep->StateSize);
+  if (start == NULL) {
+    return;
+  }
+  memcpy(start, state, lockstep->StateSize);
+  if (agreeAfter(lockstep, start, instructions)) {
+    printf("The frame only differs once the NMI is taken.\n");
+    free(start);
+    return;
+  }
+  uint64_t low = 0;
+  uint64_t high = instructions;
+  while (high - low > 1) {
+    uint64_t middle = low + (high - low) / 2;
+    if (agreeAfter(lockstep, start, middle)) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  agreeAfter(lockstep, start, low);
+  printf("Same state after %llu instructions of the frame:\n",
+         (unsigned long long)low);
+  printCpu("", lockstep->Reference);
+  agreeAfter(lockstep, start, high);
+  printf("After %llu:\n", (unsigned long long)high);
+  printCpu(FAST_NAME, lockstep->Fast);
+  printCpu("Interpreter", lockstep->Reference);
+  printRamDifferences(lockstep);
+  free(start);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  uint64_t frames = DEFAULT_FRAMES;
+  bool framesGiven = false;
+  char *inputScript = NULL;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = strtoull(argv[++i], NULL, 10);
+      framesGiven = true;
+    } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      inputScript = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  InputScript input = {0};
+  if (inputScript != NULL && !loadInputScript(inputScript, &input)) {
+    return 1;
+  }
+  if (inputScript != NULL && !framesGiven) {
+    frames = input.FrameCount;
+  }
+
+  RomImage *image = openGame(argv[1]);
+  Lockstep lockstep = {0};
+  if (image != NULL) {
+    lockstep.Fast = nesMachineCreateFromImage(image);
+    lockstep.Reference = nesMachineCreateFromImage(image);
+  }
+  if (lockstep.Fast == NULL || lockstep.Reference == NULL) {
+    nesMachineDestroy(lockstep.Fast);
+    nesMachineDestroy(lockstep.Reference);
+    romImageRelease(image);
+    freeInputScript(&input);
+    return 1;
+  }
+  CPU *fast = nesMachineGetCpu(lockstep.Fast);
+  bool checked = fast->Blocks != NULL;
+#ifdef NES_JIT
+  checked = checked && fast->Jit != NULL;
+#endif
+  if (!checked) {
+    printf("No memory for the " FAST_NAME ", nothing to check.\n");
+  }
+  nesMachineSetInterpreted(lockstep.Reference, true);
+  lockstep.StateSize = nesMachineStateSize(lockstep.Fast);
+  lockstep.FastState = malloc(lockstep.StateSize);
+  lockstep.ReferenceState = malloc(lockstep.StateSize);
+  uint8_t *frameStart = malloc(lockstep.StateSize);
+  int status = checked && lockstep.FastState != NULL &&
+                       lockstep.ReferenceState != NULL && frameStart != NULL
+                   ? 0
+                   : 1;
+
+  uint64_t instructions = 0;
+  uint64_t frame = 0;
+  for (; frame < frames && status == 0; frame++) {
+    uint8_t buttons = frame < input.FrameCount ? input.Buttons[frame] : 0;
+    nesMachineSetButtons(lockstep.Fast, 0, buttons);
+    nesMachineSetButtons(lockstep.Reference, 0, buttons);
+    nesMachineSaveState(lockstep.Reference, frameStart, lockstep.StateSize);
+    uint64_t fastInstructions = nesMachineRunFrames(lockstep.Fast, 1);
+    uint64_t referenceInstructions = nesMachineRunFrames(lockstep.Reference, 1);
+    if (fastInstructions == referenceInstructions && sameState(&lockstep)) {
+      instructions += referenceInstructions;
+      continue;
+    }
+    printf("Frame %llu differs: %llu instructions with the " FAST_NAME
+           ", %llu in the interpreter.\n",
+           (unsigned long long)frame, (unsigned long long)fastInstructions,
+           (unsigned long long)referenceInstructions);
+    printCpu(FAST_NAME, lockstep.Fast);
+    printCpu("Interpreter", lockstep.Reference);
+    printRamDifferences(&lockstep);
+    narrowDown(&lockstep, frameStart, referenceInstructions);
+    status = 1;
+  }
+  if (status == 0) {
+    printf("%llu frames and %llu instructions in lockstep.\n",
+           (unsigned long long)frame, (unsigned long long)instructions);
+  }
+#ifdef NES_JIT
+  if (fast->Jit != NULL) {
+    printf("Blocks translated: %u, evicted: %u\n", fast->Jit->Translated,
+           fast->Jit->Evicted);
+  }
+#endif
+
+  free(frameStart);
+  free(lockstep.FastState);
+  free(lockstep.ReferenceState);
+  nesMachineDestroy(lockstep.Fast);
+  nesMachineDestroy(lockstep.Reference);
+  romImageRelease(image);
+  freeInputScript(&input);
+  return status;
+}
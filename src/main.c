@@ -1,55 +1,103 @@
 #include "SDL_keycode.h"
 #define SDL_MAIN_HANDLED
 #include "emulator.h"
+#include "input.h"
+#include "library.h"
+#include "runahead.h"
 #include "utilities.h"
 #include <SDL.h>
 #include <SDL_ttf.h>
-#include <dirent.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
+// ROM index of the current directory, kept between runs
+#define ROM_LIBRARY_CACHE ".nesemulator-roms"
+#define MAX_LISTED_GAMES 20
+
 int commandInteger;
-char userSelection;
-CPU cpu;
-DIR *userDir;
+int userSelection;
+
+// Asks for the start of a game's name until it picks out a single ROM, or
+// names one exactly. Returns false at the end of input.
+bool chooseGame(RomLibrary *library, char *path, size_t size) {
+  RomMatch matches[MAX_LISTED_GAMES];
+  char prefix[250];
+  for (;;) {
+    printf("Please type the start of the name of the game you wish to "
+           "load.\n");
+    if (fgets(prefix, sizeof(prefix), stdin) == NULL) {
+      return false;
+    }
+    char *p = strchr(prefix, '\n');
+    if (p != NULL) {
+      *p = '\0';
+    }
+    size_t found =
+        romLibrarySearch(library, prefix, matches, MAX_LISTED_GAMES);
+    const char *name = found > 0 ? strrchr(matches[0].Path, '/') : NULL;
+    if (found == 1 || (name != NULL && strcasecmp(name + 1, prefix) == 0)) {
+      snprintf(path, size, "%s", matches[0].Path);
+      return true;
+    }
+    if (found == 0) {
+      printf("No game found%s.\n",
+             romLibraryScanDone(library) ? "" : " yet, still looking");
+      continue;
+    }
+    for (size_t i = 0; i < found && i < MAX_LISTED_GAMES; i++) {
+      printf("%s\n", strrchr(matches[i].Path, '/') + 1);
+    }
+    if (found > MAX_LISTED_GAMES) {
+      printf("...and %zu more.\n", found - MAX_LISTED_GAMES);
+    }
+  }
+}
 
 void *welcomeScreen() {
-  struct dirent *dir;
-  userDir = opendir(".");
+  // Starts looking for ROMs right away, so the list is ready by the time
+  // the user asks for it
+  RomLibrary *library = romLibraryOpen(ROM_LIBRARY_CACHE);
+  if (library == NULL || !romLibraryAddDirectory(library, ".") ||
+      !romLibraryStartScan(library)) {
+    printf("Could not look for games.\n");
+    romLibraryClose(library);
+    return 0;
+  }
 
   for (;;) {
     printf("Welcome to NESEmulator! Please select an option:\n");
     printf("0. Quit.\n");
     printf("1. Load game.\n");
     userSelection = getchar();
-    if (userSelection == '0') {
+    if (userSelection == '0' || userSelection == EOF) {
       printf("Exiting program!\n");
-      return 0;
+      break;
     }
     if (userSelection == '1') {
-      printf("Please type the name of the game you wish to load.\n");
-      while ((dir = readdir(userDir)) != NULL) {
-        if (dir->d_name[0] != '.') {
-          printf("%s\n", dir->d_name);
-        }
-      }
-      char gameName[250];
+      char gameName[LIBRARY_PATH_SIZE];
       resetInputBuffer();
-      fgets(gameName, sizeof(gameName), stdin);
-      char *p = strchr(gameName, '\n');
-      if (p != NULL) {
-        *p = '\0';
+      if (!chooseGame(library, gameName, sizeof(gameName))) {
+        break;
       }
       printf("The game you selected was: %s\n", gameName);
-      loadGame(&cpu, gameName);
+      NesMachine *machine = loadGame(gameName);
+      if (machine != NULL) {
+        execute(nesMachineGetCpu(machine));
+        nesMachineDestroy(machine);
+      }
       printf("Emulator functionality to be developed.\n");
-      return 0;
+      break;
     }
     printf("Command not recognized.\n\n");
   }
 
+  romLibraryClose(library);
   return 0;
 }
 
@@ -71,7 +119,49 @@ int checkInitErrors() {
   return 0;
 }
 
+struct ThreadArgs {
+  NesMachine *machine;
+  // Written by the window on key events, read once per frame by the game
+  _Atomic uint8_t buttons;
+  atomic_bool running;
+  // Movie to record the game's input to, or NULL
+  const char *recordFile;
+  // Frames of the game's input lag run-ahead removes, 0 for none
+  int runAheadFrames;
+  // What the window shows of the CPU, read before the game thread starts,
+  // as it owns the machine from then on
+  uint8_t stackPointer;
+  uint8_t instruction;
+};
+
+// The first controller on the keyboard: arrows, X for A, Z for B, Enter for
+// Start and right Shift for Select
+uint8_t keyButton(SDL_Keycode key) {
+  switch (key) {
+  case SDLK_x:
+    return BUTTON_A;
+  case SDLK_z:
+    return BUTTON_B;
+  case SDLK_RSHIFT:
+    return BUTTON_SELECT;
+  case SDLK_RETURN:
+  case SDLK_KP_ENTER:
+    return BUTTON_START;
+  case SDLK_UP:
+    return BUTTON_UP;
+  case SDLK_DOWN:
+    return BUTTON_DOWN;
+  case SDLK_LEFT:
+    return BUTTON_LEFT;
+  case SDLK_RIGHT:
+    return BUTTON_RIGHT;
+  default:
+    return 0;
+  }
+}
+
 void *createWindow(void *arg) {
+  struct ThreadArgs *args = (struct ThreadArgs *)arg;
   int isInitSuccess = checkInitErrors();
 
   if (isInitSuccess != 0) {
@@ -111,13 +201,13 @@ void *createWindow(void *arg) {
 
   char message[256] = "Stack pointer: ";
   char buffer[256];
-  snprintf(buffer, sizeof(buffer), "%u", getStackPointerValue(&cpu));
+  snprintf(buffer, sizeof(buffer), "%u", args->stackPointer);
   strncat(message, buffer, sizeof(message) - strlen(message) - 1);
 
   char currInstMessage[256] = "Current instruction: ";
   char secBuf[256];
   snprintf(secBuf, sizeof(secBuf), "%s",
-           getInstructionName(getCurrentInstruction(&cpu)));
+           getInstructionName(args->instruction));
   strncat(currInstMessage, secBuf,
           sizeof(currInstMessage) - strlen(currInstMessage) - 1);
 
@@ -189,13 +279,11 @@ void *createWindow(void *arg) {
       if (event.type == SDL_QUIT) {
         printf("QUIT event was issued!\n");
         running = 0;
-      } else if (event.type == SDL_KEYDOWN) {
-        printf("Key was pressed! Code: %u\n", event.key.keysym.sym);
-        if (event.key.keysym.sym == SDLK_KP_ENTER) {
-          printf("ENTER was pressed.");
-        } else if (event.key.keysym.sym == SDLK_RETURN) {
-          printf("ENTER was pressed.\n");
-        }
+      } else if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+        atomic_fetch_or(&args->buttons, keyButton(event.key.keysym.sym));
+      } else if (event.type == SDL_KEYUP) {
+        atomic_fetch_and(&args->buttons,
+                         (uint8_t)~keyButton(event.key.keysym.sym));
       }
     }
 
@@ -207,27 +295,97 @@ void *createWindow(void *arg) {
   return 0;
 }
 
-struct ThreadArgs {
-  struct CPU *cpu;
-};
-
-void *loadAndTestGame(void *arg) {
+// Runs the game at the NES frame rate, taking the buttons held at the start
+// of every frame, until the window closes. The buttons of every frame go to
+// the movie when recording, so headless.out can replay the session. With
+// run-ahead, every frame goes through runAheadFrame.
+void *runGame(void *arg) {
   struct ThreadArgs *args = (struct ThreadArgs *)arg;
-  char gameName[] = "dk";
-  loadGame(args->cpu, gameName);
+  const long frameNanoseconds =
+      1e9 * NTSC_HALF_CYCLES_PER_FRAME / (2.0 * NTSC_CPU_CLOCK_HZ);
+  InputScript recording = {0};
+  bool recorded = true;
+  RunAhead *runAhead = NULL;
+  if (args->runAheadFrames > 0) {
+    runAhead = runAheadCreate(args->machine, args->runAheadFrames);
+    if (runAhead == NULL) {
+      printf("Not enough memory for run-ahead, running without it.\n");
+    }
+  }
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (atomic_load(&args->running)) {
+    uint8_t buttons = atomic_load(&args->buttons);
+    nesMachineSetButtons(args->machine, 0, buttons);
+    if (args->recordFile != NULL && recorded) {
+      recorded = appendInputFrame(&recording, buttons);
+    }
+    if (runAhead != NULL) {
+      runAheadFrame(runAhead, args->machine, NULL, NULL);
+    } else {
+      nesMachineRunFrames(args->machine, 1);
+    }
+
+    next.tv_nsec += frameNanoseconds;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  if (args->recordFile != NULL && !recorded) {
+    printf("Ran out of memory for the recording.\n");
+  } else if (args->recordFile != NULL &&
+             saveInputMovie(args->recordFile, &recording,
+                            nesMachineRomHash(args->machine))) {
+    printf("Recorded %llu frames to %s\n",
+           (unsigned long long)recording.FrameCount, args->recordFile);
+  }
+  runAheadDestroy(runAhead);
+  freeInputScript(&recording);
   return NULL;
 }
 
-void *initHardwareAndUi() {
+void *initHardwareAndUi(const char *recordFile, int runAheadFrames) {
   // Using one thread for the UI, one for the emulator (for now)
   pthread_t thread1;
   struct ThreadArgs *args = malloc(sizeof(struct ThreadArgs));
-  args->cpu = &cpu;
-  initializeInstructionArray();
-
-  pthread_create(&thread1, NULL, loadAndTestGame, &args);
-  createWindow(NULL);
+  args->machine = loadGame("dk");
+  if (args->machine == NULL) {
+    free(args);
+    return NULL;
+  }
+  atomic_init(&args->buttons, 0);
+  atomic_init(&args->running, true);
+  args->recordFile = recordFile;
+  args->runAheadFrames = runAheadFrames;
+  CPU *cpu = nesMachineGetCpu(args->machine);
+  args->stackPointer = getStackPointerValue(cpu);
+  args->instruction = getCurrentInstruction(cpu);
+
+  pthread_create(&thread1, NULL, runGame, args);
+  createWindow(args);
+  atomic_store(&args->running, false);
+  pthread_join(thread1, NULL);
+  nesMachineDestroy(args->machine);
+  free(args);
   return 0;
 }
 
-int main(int argc, char *argv[]) { initHardwareAndUi(); }
+int main(int argc, char *argv[]) {
+  // --record FILE writes the session's input as a movie for headless.out,
+  // --run-ahead FRAMES removes that many frames of input lag
+  const char *recordFile = NULL;
+  int runAheadFrames = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordFile = argv[++i];
+    } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+      runAheadFrames = atoi(argv[++i]);
+    } else {
+      printf("Usage: %s [--record MOVIE] [--run-ahead FRAMES]\n", argv[0]);
+      return 1;
+    }
+  }
+  initHardwareAndUi(recordFile, runAheadFrames);
+}
@@ -0,0 +1,287 @@
+// Microbenchmarks: times every opcode of the table in cpu.c, each in its own
+// addressing mode, on a synthetic program that repeats the instruction over
+// and over, to find which handlers get slower when the bus or the dispatch
+// changes.
+#include "nes.h"
+#include "utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define DEFAULT_INSTRUCTIONS 10000000
+#define DEFAULT_RUNS 3
+// Copies of the instruction in the program, which then jumps back to the
+// start; the jump is under half a percent of what gets timed
+#define BODY_INSTRUCTIONS 256
+#define PROGRAM_START 0x8000
+#define PRG_SIZE 0x8000
+
+// Where operands point: all of it is internal RAM, so every access takes
+// the page table's fast path
+#define OPERAND_ZERO_PAGE 0x10
+#define OPERAND_ABSOLUTE 0x0200
+#define OPERAND_POINTER_X 0x20
+#define OPERAND_POINTER_Y 0x30
+#define POINTER_TARGET 0x0300
+#define JUMP_POINTERS 0x0400
+#define INDEX_VALUE 4
+
+typedef struct {
+  uint8_t Opcode;
+  // "taken" or "not taken" for branches, empty otherwise
+  const char *Variant;
+  double Nanoseconds;
+  double Cycles;
+} Benchmark;
+
+void printUsage(char *program) {
+  printf("Usage: %s [--instructions N] [--runs N] [--filter MNEMONIC] "
+         "[--json FILE]\n",
+         program);
+  printf("Times %d instructions per opcode, the best of %d runs, unless told "
+         "otherwise.\n",
+         DEFAULT_INSTRUCTIONS, DEFAULT_RUNS);
+}
+
+bool isBranch(uint8_t opcode) { return (opcode & 0x1F) == 0x10; }
+
+// The flag a branch tests, and whether it branches when the flag is set
+uint8_t branchFlag(uint8_t opcode, bool *whenSet) {
+  static const uint8_t flags[] = {0x80, 0x40, 0x01, 0x02};
+  *whenSet = opcode & 0x20;
+  return flags[opcode >> 6];
+}
+
+void putWord(uint8_t *prg, uint16_t address, uint16_t value) {
+  prg[address - PROGRAM_START] = value & 0xFF;
+  prg[address - PROGRAM_START + 1] = value >> 8;
+}
+
+// Writes the program into prg and the RAM it needs into ram. Instructions
+// that change the flow go to the instruction after them, so the program
+// still runs top to bottom.
+void buildProgram(uint8_t opcode, uint8_t *prg, uint8_t *ram) {
+  memset(prg, 0xEA, PRG_SIZE);
+  putWord(prg, 0xFFFC, PROGRAM_START);
+  uint16_t at = PROGRAM_START;
+  if (opcode == 0x00) {
+    // BRK jumps through the IRQ vector, right back to itself
+    prg[0] = opcode;
+    putWord(prg, 0xFFFE, PROGRAM_START);
+    return;
+  }
+
+  int copies = BODY_INSTRUCTIONS;
+  if (opcode == 0x60) {
+    // Each RTS pulls its own return address. The stack wraps around after
+    // 128 of them, when the program starts over.
+    copies = 128;
+    for (int i = 0; i < copies; i++) {
+      uint16_t target = PROGRAM_START + i;
+      ram[0x100 + 2 * i] = target & 0xFF;
+      ram[0x101 + 2 * i] = target >> 8;
+    }
+  }
+  uint8_t length = getInstructionLength(opcode);
+  for (int i = 0; i < copies; i++) {
+    uint16_t next = at + length;
+    uint16_t operand = 0;
+    switch (getAddressingMode(opcode)) {
+    case ModeImmediate:
+      operand = 0x01;
+      break;
+    case ModeZeroPage:
+    case ModeZeroPageX:
+    case ModeZeroPageY:
+      operand = OPERAND_ZERO_PAGE;
+      break;
+    case ModeAbsolute:
+      // JMP and JSR
+      operand = opcode == 0x4C || opcode == 0x20 ? next : OPERAND_ABSOLUTE;
+      break;
+    case ModeAbsoluteX:
+    case ModeAbsoluteY:
+      operand = OPERAND_ABSOLUTE;
+      break;
+    case ModeIndirect:
+      operand = JUMP_POINTERS + 2 * i;
+      ram[operand] = next & 0xFF;
+      ram[operand + 1] = next >> 8;
+      break;
+    case ModeIndirectX:
+      operand = OPERAND_POINTER_X;
+      break;
+    case ModeIndirectY:
+      operand = OPERAND_POINTER_Y;
+      break;
+    default:
+      break;
+    }
+    prg[at - PROGRAM_START] = opcode;
+    if (length > 1) {
+      prg[at - PROGRAM_START + 1] = operand & 0xFF;
+    }
+    if (length > 2) {
+      prg[at - PROGRAM_START + 2] = operand >> 8;
+    }
+    at = next;
+  }
+  prg[at - PROGRAM_START] = 0x4C;
+  putWord(prg, at + 1, PROGRAM_START);
+  ram[OPERAND_POINTER_X + INDEX_VALUE] = POINTER_TARGET & 0xFF;
+  ram[OPERAND_POINTER_X + INDEX_VALUE + 1] = POINTER_TARGET >> 8;
+  ram[OPERAND_POINTER_Y] = POINTER_TARGET & 0xFF;
+  ram[OPERAND_POINTER_Y + 1] = POINTER_TARGET >> 8;
+}
+
+// RTI pulls the status and the address from the stack as one frame of three
+// bytes, which doesn't line up with the stack wrapping around, so there is
+// no program that runs it forever
+bool canBenchmark(uint8_t opcode) {
+  return strcmp(getInstructionName(opcode), "???") != 0 && opcode != 0x40;
+}
+
+// Runs the opcode's program and keeps the fastest of the runs
+bool runBenchmark(Benchmark *benchmark, uint64_t instructions, int runs) {
+  static uint8_t rom[16 + PRG_SIZE];
+  static const uint8_t header[16] = {'N', 'E', 'S', 0x1A, PRG_SIZE / 0x4000};
+  uint8_t ram[NES_RAM_SIZE] = {0};
+  memcpy(rom, header, sizeof(header));
+  buildProgram(benchmark->Opcode, rom + sizeof(header), ram);
+  NesMachine *machine = nesMachineCreate(rom, sizeof(rom));
+  if (machine == NULL) {
+    return false;
+  }
+  CPU *cpu = nesMachineGetCpu(machine);
+  memcpy(cpu->Ram, ram, sizeof(ram));
+  cpu->X = INDEX_VALUE;
+  cpu->Y = INDEX_VALUE;
+  cpu->S = 0xFF;
+  if (isBranch(benchmark->Opcode)) {
+    bool whenSet;
+    uint8_t flag = branchFlag(benchmark->Opcode, &whenSet);
+    bool set = whenSet == (strcmp(benchmark->Variant, "taken") == 0);
+    setProcessorStatus(cpu, 0x24 | (set ? flag : 0));
+  }
+
+  // Warms up the caches and the branch predictor first
+  nesMachineRunInstructions(machine, instructions / 10);
+  benchmark->Nanoseconds = 0;
+  for (int run = 0; run < runs; run++) {
+    uint64_t startCycles = cpu->Cycles;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nesMachineRunInstructions(machine, instructions);
+    double nanoseconds = secondsSince(&start) * 1e9 / instructions;
+    if (run == 0 || nanoseconds < benchmark->Nanoseconds) {
+      benchmark->Nanoseconds = nanoseconds;
+    }
+    benchmark->Cycles = (double)(cpu->Cycles - startCycles) / instructions;
+  }
+  nesMachineDestroy(machine);
+  return true;
+}
+
+bool writeJson(const char *fileName, Benchmark *benchmarks, int count,
+               uint64_t instructions) {
+  FILE *file = fopen(fileName, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not create %s\n", fileName);
+    return false;
+  }
+#ifdef NES_LAZY_FLAGS
+  const char *lazyFlags = "true";
+#else
+  const char *lazyFlags = "false";
+#endif
+  fprintf(file,
+          "{\n  \"instructions\": %llu,\n  \"lazy_flags\": %s,\n"
+          "  \"results\": [\n",
+          (unsigned long long)instructions, lazyFlags);
+  for (int i = 0; i < count; i++) {
+    Benchmark *benchmark = &benchmarks[i];
+    fprintf(file,
+            "    {\"opcode\": \"0x%02X\", \"mnemonic\": \"%s\", \"mode\": "
+            "\"%s\", \"variant\": \"%s\", \"ns_per_instruction\": %.3f, "
+            "\"cycles_per_instruction\": %.3f}%s\n",
+            benchmark->Opcode, getInstructionName(benchmark->Opcode),
+            getAddressingModeName(getAddressingMode(benchmark->Opcode)),
+            benchmark->Variant, benchmark->Nanoseconds, benchmark->Cycles,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Could not write %s\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t instructions = DEFAULT_INSTRUCTIONS;
+  int runs = DEFAULT_RUNS;
+  const char *filter = NULL;
+  const char *jsonFile = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+      instructions = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonFile = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (instructions == 0 || runs < 1) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // Branches are timed taken and not taken, everything else once
+  Benchmark benchmarks[2 * 256];
+  int count = 0;
+  for (int opcode = 0; opcode < 256; opcode++) {
+    if (!canBenchmark(opcode) ||
+        (filter != NULL && strcasecmp(filter, getInstructionName(opcode)))) {
+      continue;
+    }
+    if (isBranch(opcode)) {
+      benchmarks[count++] = (Benchmark){.Opcode = opcode, .Variant = "taken"};
+      benchmarks[count++] =
+          (Benchmark){.Opcode = opcode, .Variant = "not taken"};
+    } else {
+      benchmarks[count++] = (Benchmark){.Opcode = opcode, .Variant = ""};
+    }
+  }
+
+  printf("%-6s %-4s %-11s %-9s %8s %8s\n", "Opcode", "", "Mode", "",
+         "ns/inst", "cyc/inst");
+  double total = 0;
+  for (int i = 0; i < count; i++) {
+    Benchmark *benchmark = &benchmarks[i];
+    if (!runBenchmark(benchmark, instructions, runs)) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    total += benchmark->Nanoseconds;
+    printf("0x%02X   %-4s %-11s %-9s %8.3f %8.3f\n", benchmark->Opcode,
+           getInstructionName(benchmark->Opcode),
+           getAddressingModeName(getAddressingMode(benchmark->Opcode)),
+           benchmark->Variant, benchmark->Nanoseconds, benchmark->Cycles);
+  }
+  if (count > 0) {
+    printf("\n%d benchmarks, %.3f ns per instruction on average\n", count,
+           total / count);
+  }
+  if (jsonFile != NULL &&
+      !writeJson(jsonFile, benchmarks, count, instructions)) {
+    return 1;
+  }
+  return 0;
+}
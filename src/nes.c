@@ -0,0 +1,227 @@
+#include "nes.h"
+#include "block.h"
+#include "jit.h"
+#include "romcache.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct NesMachine {
+  // First, so the hot part of the CPU starts on a cache line
+  CPU Cpu;
+  // The machine's reference to its ROM, PrgRom points into it
+  RomImage *Rom;
+  // Hash of the PRG ROM, stamped on save states. Worked out on first use.
+  uint64_t RomHash;
+#ifdef NES_BLOCK_CACHE
+  // Owned by the machine, so they survive the CPU running without them
+  BlockCache *Blocks;
+#endif
+#ifdef NES_JIT
+  JitCache *Jit;
+#endif
+};
+
+// Save states start with this header, followed by the CPU as
+// saveProcessorState writes it and the PRG RAM, if any. The CPU is stored as
+// it sits in memory, so a state only loads into a build with the same
+// struct CPU; Layout tells builds apart.
+#define SAVE_STATE_VERSION 1
+
+typedef struct {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t CpuSize;
+  uint32_t Layout;
+  uint32_t PrgRamSize;
+  uint64_t RomHash;
+} SaveStateHeader;
+
+static uint32_t stateLayout(void) {
+  uint32_t layout = 0;
+#ifdef NES_LAZY_FLAGS
+  layout |= 0x01;
+#endif
+#ifdef NES_TRACE
+  layout |= 0x02;
+#endif
+#ifdef NES_PROFILE
+  layout |= 0x04;
+#endif
+#ifdef NES_IDLE_SKIP
+  layout |= 0x08;
+#endif
+#ifdef NES_BLOCK_CACHE
+  layout |= 0x10;
+#endif
+#ifdef NES_JIT
+  layout |= 0x20;
+#endif
+  return layout;
+}
+
+// Battery backed carts have PRG RAM, and so do nearly all boards with a
+// mapper. Plain NROM carts almost never do, so they are spared the 8KiB,
+// unless a NES 2.0 header asks for it.
+static bool hasPrgRam(const NesHeader *header) {
+  if (header->Format == RomFormatNes2) {
+    return header->PrgRamSize + header->PrgNvramSize > 0;
+  }
+  return header->Battery || header->Mapper != 0;
+}
+
+NesMachine *nesMachineCreate(const uint8_t *rom, size_t size) {
+  RomImage *image = romImageCopy(rom, size, NULL);
+  if (image == NULL) {
+    return NULL;
+  }
+  NesMachine *machine = nesMachineCreateFromImage(image);
+  romImageRelease(image);
+  return machine;
+}
+
+NesMachine *nesMachineCreateFromImage(RomImage *image) {
+  NesMachine *machine = aligned_alloc(CACHE_LINE_SIZE, sizeof(NesMachine));
+  if (machine == NULL) {
+    return NULL;
+  }
+  memset(machine, 0, sizeof(NesMachine));
+  machine->Rom = romImageRetain(image);
+
+  CPU *cpu = &machine->Cpu;
+  const NesHeader *header = romImageHeader(image);
+  cpu->PrgRom = romImageData(image) + prgRomOffset(header);
+  cpu->PrgRomSize = header->PrgRomSize;
+  if (hasPrgRam(header)) {
+    cpu->PrgRam = calloc(PRG_RAM_SIZE, 1);
+    if (cpu->PrgRam == NULL) {
+      nesMachineDestroy(machine);
+      return NULL;
+    }
+  }
+
+#ifdef NES_BLOCK_CACHE
+  machine->Blocks = blockCacheCreate();
+  if (machine->Blocks == NULL) {
+    nesMachineDestroy(machine);
+    return NULL;
+  }
+  cpu->Blocks = machine->Blocks;
+#endif
+#ifdef NES_JIT
+  // Without executable memory the blocks run from the block cache
+  machine->Jit = jitCacheCreate();
+  cpu->Jit = machine->Jit;
+#endif
+
+  initProcessor(cpu);
+  setMapper(cpu, header->Mapper);
+  resetProcessor(cpu);
+  return machine;
+}
+
+void nesMachineReset(NesMachine *machine) { resetProcessor(&machine->Cpu); }
+
+uint64_t nesMachineRunFrames(NesMachine *machine, uint64_t frames) {
+  uint64_t instructions = 0;
+  for (uint64_t i = 0; i < frames; i++) {
+    instructions += runFrame(&machine->Cpu);
+  }
+  return instructions;
+}
+
+uint64_t nesMachineRunInstructions(NesMachine *machine, uint64_t count) {
+  return runInstructions(&machine->Cpu, count);
+}
+
+void nesMachineSetInterpreted(NesMachine *machine, bool interpreted) {
+  CPU *cpu = &machine->Cpu;
+#ifdef NES_BLOCK_CACHE
+  cpu->Blocks = interpreted ? NULL : machine->Blocks;
+#else
+  // Always interpreted
+  (void)interpreted;
+#endif
+#ifdef NES_JIT
+  cpu->Jit = interpreted ? NULL : machine->Jit;
+#endif
+  // The memory map may have changed in the meantime
+  setMapper(cpu, cpu->MapperType);
+}
+
+void nesMachineSetButtons(NesMachine *machine, int port, uint8_t buttons) {
+  machine->Cpu.Buttons[port & 1] = buttons;
+}
+
+CPU *nesMachineGetCpu(NesMachine *machine) { return &machine->Cpu; }
+
+void nesMachineDestroy(NesMachine *machine) {
+  if (machine == NULL) {
+    return;
+  }
+  free(machine->Cpu.PrgRam);
+#ifdef NES_BLOCK_CACHE
+  blockCacheDestroy(machine->Blocks);
+#endif
+#ifdef NES_JIT
+  jitCacheDestroy(machine->Jit);
+#endif
+  romImageRelease(machine->Rom);
+  free(machine);
+}
+
+uint64_t nesMachineRomHash(NesMachine *machine) {
+  if (machine->RomHash == 0) {
+    const NesHeader *header = romImageHeader(machine->Rom);
+    machine->RomHash = hashRomData(romImageData(machine->Rom) +
+                                       prgRomOffset(header),
+                                   header->PrgRomSize);
+  }
+  return machine->RomHash;
+}
+
+static SaveStateHeader stateHeader(NesMachine *machine) {
+  SaveStateHeader header = {
+      .Magic = "NESSTATE",
+      .Version = SAVE_STATE_VERSION,
+      .CpuSize = sizeof(CPU),
+      .Layout = stateLayout(),
+      .PrgRamSize = machine->Cpu.PrgRam != NULL ? PRG_RAM_SIZE : 0,
+      .RomHash = nesMachineRomHash(machine),
+  };
+  return header;
+}
+
+size_t nesMachineStateSize(NesMachine *machine) {
+  return sizeof(SaveStateHeader) + sizeof(CPU) +
+         (machine->Cpu.PrgRam != NULL ? PRG_RAM_SIZE : 0);
+}
+
+bool nesMachineSaveState(NesMachine *machine, uint8_t *state, size_t size) {
+  if (size < nesMachineStateSize(machine)) {
+    return false;
+  }
+  SaveStateHeader header = stateHeader(machine);
+  memcpy(state, &header, sizeof(header));
+  saveProcessorState(&machine->Cpu, state + sizeof(header));
+  if (header.PrgRamSize > 0) {
+    memcpy(state + sizeof(header) + sizeof(CPU), machine->Cpu.PrgRam,
+           PRG_RAM_SIZE);
+  }
+  return true;
+}
+
+bool nesMachineLoadState(NesMachine *machine, const uint8_t *state,
+                         size_t size) {
+  SaveStateHeader expected = stateHeader(machine);
+  if (size != nesMachineStateSize(machine) ||
+      memcmp(state, &expected, sizeof(expected)) != 0) {
+    return false;
+  }
+  loadProcessorState(&machine->Cpu, state + sizeof(expected));
+  if (expected.PrgRamSize > 0) {
+    memcpy(machine->Cpu.PrgRam, state + sizeof(expected) + sizeof(CPU),
+           PRG_RAM_SIZE);
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+#ifndef NES_H
+#define NES_H
+
+#include "cpu.h"
+#include "rom.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A complete emulated console. A machine owns everything it runs on and the
+// core keeps no global state, so a process can host any number of machines,
+// each driven by its own thread. A single machine must not be used from two
+// threads at once.
+typedef struct NesMachine NesMachine;
+
+// Copies the iNES image in rom, powers the machine on and runs the reset
+// sequence. Returns NULL if rom is not a usable iNES image.
+NesMachine *nesMachineCreate(const uint8_t *rom, size_t size);
+// Same, but runs straight from a ROM image, which the machine keeps a
+// reference to. Machines created from one image share its ROM.
+NesMachine *nesMachineCreateFromImage(RomImage *image);
+// Presses the reset button. RAM keeps its contents.
+void nesMachineReset(NesMachine *machine);
+// Both return the number of instructions executed
+uint64_t nesMachineRunFrames(NesMachine *machine, uint64_t frames);
+uint64_t nesMachineRunInstructions(NesMachine *machine, uint64_t count);
+// Runs the machine in the plain interpreter of cpu.c, without the block
+// cache or the JIT, or goes back to them. The results are the same either
+// way, which is what makes the interpreter the reference to check them
+// against.
+void nesMachineSetInterpreted(NesMachine *machine, bool interpreted);
+// Sets the buttons held on controller port 0 or 1, a mask of BUTTON_* bits.
+// The game sees them the next time it reads the port.
+void nesMachineSetButtons(NesMachine *machine, int port, uint8_t buttons);
+// Save states hold everything that changes while a machine runs, in a
+// binary format tied to the build: a state only loads into the same build
+// of the core, running the same game. Saving and loading are plain copies.
+size_t nesMachineStateSize(NesMachine *machine);
+// Both return false if size doesn't fit; loading also if the state was
+// saved by another build or from another game.
+bool nesMachineSaveState(NesMachine *machine, uint8_t *state, size_t size);
+bool nesMachineLoadState(NesMachine *machine, const uint8_t *state,
+                         size_t size);
+// hashRomData of the PRG ROM, what save states and movies are tied to
+uint64_t nesMachineRomHash(NesMachine *machine);
+// For front ends and debuggers that need to look at the registers
+CPU *nesMachineGetCpu(NesMachine *machine);
+void nesMachineDestroy(NesMachine *machine);
+
+#endif
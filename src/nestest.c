@@ -0,0 +1,287 @@
+// Conformance runner: runs nestest.nes in automation mode, starting at
+// $C000 without a PPU, and compares the CPU state before every instruction
+// with the reference log, stopping at the first difference. Then it runs the
+// matching part again at full speed to report how fast the core went.
+#include "emulator.h"
+#include "utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_REPEAT 1000
+#define AUTOMATION_START 0xC000
+
+// The state one line of the log expects before its instruction runs
+typedef struct {
+  const char *Text;
+  uint16_t PC;
+  uint8_t A;
+  uint8_t X;
+  uint8_t Y;
+  uint8_t P;
+  uint8_t S;
+  // Older logs count PPU dots in CYC rather than CPU cycles
+  bool HasCycles;
+  uint64_t Cycles;
+} LogLine;
+
+typedef struct {
+  char *Buffer;
+  LogLine *Lines;
+  size_t LineCount;
+} GoldenLog;
+
+void printUsage(char *program) {
+  printf("Usage: %s <nestest.nes> <nestest.log> [--repeat N]\n", program);
+  printf("Repeats the timed run %d times unless --repeat says otherwise.\n",
+         DEFAULT_REPEAT);
+}
+
+// Lines look like
+// C000  4C F5 C5  JMP $C5F5    A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+bool parseLogLine(char *text, LogLine *line) {
+  unsigned pc, a, x, y, p, s;
+  unsigned long long cycles;
+  char *registers = strstr(text, "A:");
+  if (sscanf(text, "%4x", &pc) != 1 || registers == NULL ||
+      sscanf(registers, "A:%2x X:%2x Y:%2x P:%2x SP:%2x", &a, &x, &y, &p,
+             &s) != 5) {
+    return false;
+  }
+  char *cycleField = strstr(registers, "CYC:");
+  line->Text = text;
+  line->PC = pc;
+  line->A = a;
+  line->X = x;
+  line->Y = y;
+  line->P = p;
+  line->S = s;
+  line->HasCycles = cycleField != NULL && strstr(registers, "SL:") == NULL &&
+                    sscanf(cycleField, "CYC:%llu", &cycles) == 1;
+  line->Cycles = line->HasCycles ? cycles : 0;
+  return true;
+}
+
+// Reads the whole log into memory up front, so the comparison never waits
+// for the disk
+bool loadGoldenLog(const char *fileName, GoldenLog *log) {
+  memset(log, 0, sizeof(GoldenLog));
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open %s\n", fileName);
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  log->Buffer = size >= 0 ? malloc(size + 1) : NULL;
+  if (log->Buffer == NULL ||
+      fread(log->Buffer, 1, size, file) != (size_t)size) {
+    fprintf(stderr, "Could not read %s\n", fileName);
+    fclose(file);
+    free(log->Buffer);
+    return false;
+  }
+  fclose(file);
+  log->Buffer[size] = '\0';
+
+  size_t capacity = 0;
+  for (char *text = log->Buffer; *text != '\0';) {
+    char *end = text + strcspn(text, "\r\n");
+    bool last = *end == '\0';
+    *end = '\0';
+    if (log->LineCount == capacity) {
+      capacity = capacity == 0 ? 16384 : capacity * 2;
+      LogLine *grown = realloc(log->Lines, capacity * sizeof(LogLine));
+      if (grown == NULL) {
+        free(log->Lines);
+        free(log->Buffer);
+        return false;
+      }
+      log->Lines = grown;
+    }
+    if (*text != '\0' && !parseLogLine(text, &log->Lines[log->LineCount++])) {
+      fprintf(stderr, "%s:%zu: not a nestest log line\n", fileName,
+              log->LineCount);
+      free(log->Lines);
+      free(log->Buffer);
+      return false;
+    }
+    text = last ? end : end + 1;
+    text += strspn(text, "\r\n");
+  }
+  return true;
+}
+
+void freeGoldenLog(GoldenLog *log) {
+  free(log->Lines);
+  free(log->Buffer);
+}
+
+// Formats the state like the log does, so the two lines can be compared by
+// eye
+void formatState(CPU *cpu, char *buffer, int size) {
+  char instruction[32];
+  char bytes[16] = "";
+  int length = disassembleInstruction(cpu, cpu->PC, instruction,
+                                      sizeof(instruction));
+  for (int i = 0; i < length; i++) {
+    snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ",
+             readMemory(cpu, cpu->PC + i));
+  }
+  snprintf(buffer, size,
+           "%04X  %-9s %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu",
+           cpu->PC, bytes, instruction, cpu->A, cpu->X, cpu->Y,
+           getProcessorStatus(cpu), cpu->S, (unsigned long long)cpu->Cycles);
+}
+
+bool matchesLine(CPU *cpu, const LogLine *line) {
+  return cpu->PC == line->PC && cpu->A == line->A && cpu->X == line->X &&
+         cpu->Y == line->Y && getProcessorStatus(cpu) == line->P &&
+         cpu->S == line->S &&
+         (!line->HasCycles || cpu->Cycles == line->Cycles);
+}
+
+void printDivergence(CPU *cpu, const GoldenLog *log, size_t index) {
+  char state[128];
+  formatState(cpu, state, sizeof(state));
+  printf("Diverged at line %zu:\n", index + 1);
+  if (index > 0) {
+    printf("  %s\n", log->Lines[index - 1].Text);
+  }
+  printf("- %s\n", log->Lines[index].Text);
+  printf("+ %s\n", state);
+
+  const LogLine *line = &log->Lines[index];
+  printf("Differs in:");
+  if (cpu->PC != line->PC) {
+    printf(" PC");
+  }
+  if (cpu->A != line->A) {
+    printf(" A");
+  }
+  if (cpu->X != line->X) {
+    printf(" X");
+  }
+  if (cpu->Y != line->Y) {
+    printf(" Y");
+  }
+  if (getProcessorStatus(cpu) != line->P) {
+    printf(" P");
+  }
+  if (cpu->S != line->S) {
+    printf(" SP");
+  }
+  if (line->HasCycles && cpu->Cycles != line->Cycles) {
+    printf(" CYC");
+  }
+  printf("\n");
+}
+
+// A machine at the start of automation mode, right after reset
+NesMachine *startMachine(RomImage *image) {
+  NesMachine *machine = nesMachineCreateFromImage(image);
+  if (machine != NULL) {
+    nesMachineGetCpu(machine)->PC = AUTOMATION_START;
+  }
+  return machine;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  int repeat = DEFAULT_REPEAT;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (repeat < 1) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  GoldenLog log;
+  if (!loadGoldenLog(argv[2], &log)) {
+    return 1;
+  }
+  if (log.LineCount == 0) {
+    fprintf(stderr, "%s has no lines\n", argv[2]);
+    freeGoldenLog(&log);
+    return 1;
+  }
+  RomImage *image = openGame(argv[1]);
+  NesMachine *machine = image != NULL ? startMachine(image) : NULL;
+  if (machine == NULL) {
+    romImageRelease(image);
+    freeGoldenLog(&log);
+    return 1;
+  }
+
+  // One instruction at a time, checking the state before each of them
+  CPU *cpu = nesMachineGetCpu(machine);
+  size_t matched = 0;
+  while (matched < log.LineCount && matchesLine(cpu, &log.Lines[matched])) {
+    matched++;
+    if (matched < log.LineCount) {
+      nesMachineRunInstructions(machine, 1);
+    }
+  }
+  printf("\n");
+  if (matched < log.LineCount) {
+    printDivergence(cpu, &log, matched);
+  } else {
+    printf("All %zu lines match.\n", log.LineCount);
+  }
+  // nestest leaves the code of the first failed test in $02 (official
+  // opcodes) and $03 (unofficial ones), 0 if they all passed
+  printf("Result codes: $02=%02X $03=%02X\n", readMemory(cpu, 0x02),
+         readMemory(cpu, 0x03));
+  uint8_t steppedState[sizeof(CPU)];
+  saveProcessorState(cpu, steppedState);
+  nesMachineDestroy(machine);
+
+  // The same instructions again in one call each, the way frames run them,
+  // which has to end in the same state. When every line matched, the last
+  // one was checked but not run.
+  uint64_t instructions =
+      matched == log.LineCount && matched > 0 ? matched - 1 : matched;
+  int status = matched == log.LineCount ? 0 : 1;
+  bool sameState = true;
+  double seconds = 0;
+  for (int i = 0; i < repeat && sameState; i++) {
+    machine = startMachine(image);
+    if (machine == NULL) {
+      status = 1;
+      break;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nesMachineRunInstructions(machine, instructions);
+    seconds += secondsSince(&start);
+    uint8_t state[sizeof(CPU)];
+    saveProcessorState(nesMachineGetCpu(machine), state);
+    if (memcmp(state, steppedState, sizeof(state)) != 0) {
+      printf("Running the instructions in one go ended in another state.\n");
+      sameState = false;
+      status = 1;
+    }
+    nesMachineDestroy(machine);
+  }
+  if (seconds > 0) {
+    printf("Instructions per second: %.0f (%.2f MIPS) over %d runs of %llu\n",
+           instructions * repeat / seconds,
+           instructions * repeat / seconds / 1e6, repeat,
+           (unsigned long long)instructions);
+  }
+
+  romImageRelease(image);
+  freeGoldenLog(&log);
+  return status;
+}
@@ -0,0 +1,93 @@
+// Opcode histogram and PC hotspots. The counting itself is inline in
+// profile.h; this is the report. Only built when NES_PROFILE is enabled.
+#include "profile.h"
+#include "cpu.h"
+#include <stdlib.h>
+
+Profile *profileCreate(void) { return calloc(1, sizeof(Profile)); }
+
+void profileDestroy(Profile *profile) { free(profile); }
+
+// Sorting by cycles needs the counters, which qsort can't pass along
+static const uint64_t *sortCycles;
+
+static int byCyclesDescending(const void *a, const void *b) {
+  uint64_t left = sortCycles[*(const uint32_t *)a];
+  uint64_t right = sortCycles[*(const uint32_t *)b];
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+int64_t sortByCycles(const uint64_t *counts, const uint64_t *cycles,
+                     uint32_t size, uint32_t **order) {
+  *order = malloc(size * sizeof(uint32_t));
+  if (*order == NULL) {
+    return -1;
+  }
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    if (counts[i] > 0) {
+      (*order)[used++] = i;
+    }
+  }
+  sortCycles = cycles;
+  qsort(*order, used, sizeof(uint32_t), byCyclesDescending);
+  return used;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total > 0 ? 100.0 * part / total : 0;
+}
+
+void profileReport(Profile *profile, struct CPU *cpu, FILE *file,
+                   int hotspots) {
+  uint64_t instructions = 0;
+  uint64_t cycles = 0;
+  for (int i = 0; i < 256; i++) {
+    instructions += profile->OpcodeCount[i];
+    cycles += profile->OpcodeCycles[i];
+  }
+  fprintf(file, "Profile: %llu instructions, %llu cycles\n",
+          (unsigned long long)instructions, (unsigned long long)cycles);
+
+  uint32_t *order;
+  int64_t used = sortByCycles(profile->OpcodeCount, profile->OpcodeCycles,
+                              256, &order);
+  if (used < 0) {
+    fprintf(file, "Out of memory for the report\n");
+    return;
+  }
+  fprintf(file, "\nOpcodes by cycles\n");
+  fprintf(file, "%-6s %-4s %-11s %14s %7s %14s %7s\n", "Opcode", "Name",
+          "Mode", "Count", "%", "Cycles", "%");
+  for (int64_t i = 0; i < used; i++) {
+    uint8_t opcode = order[i];
+    fprintf(file, "0x%02X   %-4s %-11s %14llu %6.2f%% %14llu %6.2f%%\n",
+            opcode, getInstructionName(opcode),
+            getAddressingModeName(getAddressingMode(opcode)),
+            (unsigned long long)profile->OpcodeCount[opcode],
+            percent(profile->OpcodeCount[opcode], instructions),
+            (unsigned long long)profile->OpcodeCycles[opcode],
+            percent(profile->OpcodeCycles[opcode], cycles));
+  }
+  free(order);
+
+  used = sortByCycles(profile->PcCount, profile->PcCycles, PROFILE_ADDRESSES,
+                      &order);
+  if (used < 0) {
+    fprintf(file, "Out of memory for the report\n");
+    return;
+  }
+  fprintf(file, "\nHotspots by cycles\n");
+  fprintf(file, "%-4s  %-16s %14s %14s %7s\n", "PC", "Instruction", "Count",
+          "Cycles", "%");
+  for (int64_t i = 0; i < used && i < hotspots; i++) {
+    uint16_t pc = order[i];
+    char line[32];
+    disassembleInstruction(cpu, pc, line, sizeof(line));
+    fprintf(file, "%04X  %-16s %14llu %14llu %6.2f%%\n", pc, line,
+            (unsigned long long)profile->PcCount[pc],
+            (unsigned long long)profile->PcCycles[pc],
+            percent(profile->PcCycles[pc], cycles));
+  }
+  free(order);
+}
@@ -0,0 +1,71 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Execution profile, compiled in only when NES_PROFILE is defined (cmake
+// -DNES_PROFILE=ON). Every instruction bumps a counter for its opcode and one
+// for its address, in flat arrays indexed directly. The cycles it took are
+// only known once the next instruction starts, so they are credited then.
+// An interrupt's cycles go to the instruction it interrupted.
+
+#define PROFILE_ADDRESSES 0x10000
+
+typedef struct {
+  uint64_t OpcodeCount[256];
+  uint64_t OpcodeCycles[256];
+  uint64_t PcCount[PROFILE_ADDRESSES];
+  uint64_t PcCycles[PROFILE_ADDRESSES];
+  // The instruction that is running, until the next one starts
+  bool Running;
+  uint8_t LastOpcode;
+  uint16_t LastPC;
+  uint64_t LastCycles;
+} Profile;
+
+struct CPU;
+
+#ifdef NES_PROFILE
+
+Profile *profileCreate(void);
+void profileDestroy(Profile *profile);
+// Writes the opcodes sorted by the cycles spent in them, then the hotspots
+// most cycles went to, disassembled from the CPU's memory
+void profileReport(Profile *profile, struct CPU *cpu, FILE *file,
+                   int hotspots);
+// Puts the indices of the non-zero counts in order, most cycles first.
+// Returns how many there are, or -1 without memory. The caller frees order.
+int64_t sortByCycles(const uint64_t *counts, const uint64_t *cycles,
+                     uint32_t size, uint32_t **order);
+
+static inline void profileCount(Profile *profile, uint16_t pc,
+                                uint8_t opcode, uint64_t cycles) {
+  if (profile->Running) {
+    uint64_t spent = cycles - profile->LastCycles;
+    profile->OpcodeCycles[profile->LastOpcode] += spent;
+    profile->PcCycles[profile->LastPC] += spent;
+  }
+  profile->OpcodeCount[opcode]++;
+  profile->PcCount[pc]++;
+  profile->Running = true;
+  profile->LastOpcode = opcode;
+  profile->LastPC = pc;
+  profile->LastCycles = cycles;
+}
+
+#define PROFILE_INSTRUCTION(cpu, opcode)                                       \
+  do {                                                                         \
+    if ((cpu)->Profiler != NULL) {                                             \
+      profileCount((cpu)->Profiler, (cpu)->PC, (opcode), (cpu)->Cycles);       \
+    }                                                                          \
+  } while (0)
+
+#else
+
+#define PROFILE_INSTRUCTION(cpu, opcode) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+#include "rewind.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Equal runs shorter than this are cheaper to copy than to encode
+#define MIN_EQUAL_RUN 4
+
+typedef struct {
+  uint32_t Offset;
+  uint32_t Size;
+  bool Keyframe;
+} RewindRecord;
+
+struct Rewind {
+  // Records live in Buffer in the order they were captured, wrapping back
+  // to the start when one doesn't fit at the end
+  uint8_t *Buffer;
+  size_t BufferSize;
+  // Circular list of records, First is the oldest
+  RewindRecord *Records;
+  size_t MaxFrames;
+  size_t First;
+  size_t Count;
+  int KeyframeInterval;
+  int SinceKeyframe;
+  // Set after a step back: the next capture starts a new keyframe
+  bool NeedKeyframe;
+
+  size_t StateSize;
+  // The keyframe deltas are taken against, and scratch space
+  uint8_t *Keyframe;
+  uint8_t *State;
+  uint8_t *Delta;
+};
+
+// A delta is a list of (equal bytes, changed bytes) run lengths, 16 bits
+// each, the changed bytes following their lengths. States are far smaller
+// than 64KiB; longer runs are split.
+static size_t encodeDelta(const uint8_t *state, const uint8_t *keyframe,
+                          size_t size, uint8_t *delta) {
+  uint8_t *out = delta;
+  size_t i = 0;
+  while (i < size) {
+    size_t equalStart = i;
+    while (i + 8 <= size && i - equalStart < 0xFFF8 &&
+           memcmp(state + i, keyframe + i, 8) == 0) {
+      i += 8;
+    }
+    while (i < size && i - equalStart < 0xFFFF && state[i] == keyframe[i]) {
+      i++;
+    }
+    uint16_t equal = i - equalStart;
+    size_t changedStart = i;
+    // A changed run ends at the first MIN_EQUAL_RUN equal bytes
+    size_t equalSeen = 0;
+    while (i < size && i - changedStart < 0xFFFF &&
+           equalSeen < MIN_EQUAL_RUN) {
+      equalSeen = state[i] == keyframe[i] ? equalSeen + 1 : 0;
+      i++;
+    }
+    if (equalSeen == MIN_EQUAL_RUN) {
+      i -= MIN_EQUAL_RUN;
+    }
+    uint16_t changed = i - changedStart;
+    memcpy(out, &equal, 2);
+    memcpy(out + 2, &changed, 2);
+    memcpy(out + 4, state + changedStart, changed);
+    out += 4 + changed;
+  }
+  return out - delta;
+}
+
+static void decodeDelta(const uint8_t *delta, size_t deltaSize,
+                        const uint8_t *keyframe, size_t size,
+                        uint8_t *state) {
+  memcpy(state, keyframe, size);
+  size_t position = 0;
+  const uint8_t *end = delta + deltaSize;
+  while (delta < end) {
+    uint16_t equal;
+    uint16_t changed;
+    memcpy(&equal, delta, 2);
+    memcpy(&changed, delta + 2, 2);
+    position += equal;
+    memcpy(state + position, delta + 4, changed);
+    position += changed;
+    delta += 4 + changed;
+  }
+}
+
+// Worst case: every run is MIN_EQUAL_RUN - 1 equal bytes and 1 changed one
+static size_t maxDeltaSize(size_t stateSize) { return stateSize * 2 + 4; }
+
+Rewind *rewindCreate(NesMachine *machine, size_t memoryBudget,
+                     size_t maxFrames, int keyframeInterval) {
+  size_t stateSize = nesMachineStateSize(machine);
+  if (memoryBudget < 2 * stateSize || maxFrames == 0 ||
+      memoryBudget > UINT32_MAX || keyframeInterval < 1) {
+    return NULL;
+  }
+  Rewind *rewind = calloc(1, sizeof(Rewind));
+  if (rewind == NULL) {
+    return NULL;
+  }
+  rewind->Buffer = malloc(memoryBudget);
+  rewind->BufferSize = memoryBudget;
+  rewind->Records = malloc(maxFrames * sizeof(RewindRecord));
+  rewind->MaxFrames = maxFrames;
+  rewind->KeyframeInterval = keyframeInterval;
+  rewind->NeedKeyframe = true;
+  rewind->StateSize = stateSize;
+  rewind->Keyframe = malloc(stateSize);
+  rewind->State = malloc(stateSize);
+  rewind->Delta = malloc(maxDeltaSize(stateSize));
+  if (rewind->Buffer == NULL || rewind->Records == NULL ||
+      rewind->Keyframe == NULL || rewind->State == NULL ||
+      rewind->Delta == NULL) {
+    rewindDestroy(rewind);
+    return NULL;
+  }
+  return rewind;
+}
+
+static RewindRecord *record(Rewind *rewind, size_t index) {
+  return &rewind->Records[(rewind->First + index) % rewind->MaxFrames];
+}
+
+// Drops the oldest keyframe and the deltas taken against it
+static void evictOldest(Rewind *rewind) {
+  do {
+    rewind->First = (rewind->First + 1) % rewind->MaxFrames;
+    rewind->Count--;
+  } while (rewind->Count > 0 && !record(rewind, 0)->Keyframe);
+}
+
+// Finds room for size bytes after the newest record, evicting the oldest
+// ones until there is. Returns the offset.
+static uint32_t allocate(Rewind *rewind, size_t size) {
+  while (rewind->Count > 0) {
+    RewindRecord *oldest = record(rewind, 0);
+    RewindRecord *newest = record(rewind, rewind->Count - 1);
+    size_t tail = newest->Offset + newest->Size;
+    if (newest->Offset >= oldest->Offset) {
+      // Not wrapped: free space after the newest, and before the oldest
+      if (size <= rewind->BufferSize - tail) {
+        return tail;
+      }
+      if (size <= oldest->Offset) {
+        return 0;
+      }
+    } else if (size <= oldest->Offset - tail) {
+      return tail;
+    }
+    evictOldest(rewind);
+  }
+  return 0;
+}
+
+// Returns false if the record could not be kept
+static bool store(Rewind *rewind, const uint8_t *data, size_t size,
+                  bool keyframe) {
+  if (size > rewind->BufferSize) {
+    return false;
+  }
+  if (rewind->Count == rewind->MaxFrames) {
+    evictOldest(rewind);
+  }
+  uint32_t offset = allocate(rewind, size);
+  // Making room may have evicted the keyframe a delta was taken against
+  if (!keyframe && rewind->Count == 0) {
+    return false;
+  }
+  memcpy(rewind->Buffer + offset, data, size);
+  RewindRecord *stored = record(rewind, rewind->Count++);
+  stored->Offset = offset;
+  stored->Size = size;
+  stored->Keyframe = keyframe;
+  return true;
+}
+
+bool rewindCapture(Rewind *rewind, NesMachine *machine) {
+  if (!nesMachineSaveState(machine, rewind->State, rewind->StateSize)) {
+    return false;
+  }
+  if (!rewind->NeedKeyframe &&
+      rewind->SinceKeyframe < rewind->KeyframeInterval) {
+    size_t deltaSize = encodeDelta(rewind->State, rewind->Keyframe,
+                                   rewind->StateSize, rewind->Delta);
+    // A state that has drifted that far may as well start a keyframe
+    if (deltaSize < rewind->StateSize &&
+        store(rewind, rewind->Delta, deltaSize, false)) {
+      rewind->SinceKeyframe++;
+      return true;
+    }
+  }
+  memcpy(rewind->Keyframe, rewind->State, rewind->StateSize);
+  rewind->SinceKeyframe = 1;
+  rewind->NeedKeyframe = false;
+  return store(rewind, rewind->State, rewind->StateSize, true);
+}
+
+bool rewindStep(Rewind *rewind, NesMachine *machine) {
+  if (rewind->Count == 0) {
+    return false;
+  }
+  size_t newestIndex = rewind->Count - 1;
+  RewindRecord *newest = record(rewind, newestIndex);
+  const uint8_t *state = rewind->Buffer + newest->Offset;
+  if (!newest->Keyframe) {
+    size_t keyIndex = newestIndex;
+    while (!record(rewind, keyIndex)->Keyframe) {
+      keyIndex--;
+    }
+    decodeDelta(state, newest->Size,
+                rewind->Buffer + record(rewind, keyIndex)->Offset,
+                rewind->StateSize, rewind->State);
+    state = rewind->State;
+  }
+  rewind->Count--;
+  rewind->NeedKeyframe = true;
+  return nesMachineLoadState(machine, state, rewind->StateSize);
+}
+
+size_t rewindFrameCount(const Rewind *rewind) { return rewind->Count; }
+
+size_t rewindBytesUsed(const Rewind *rewind) {
+  size_t used = 0;
+  for (size_t i = 0; i < rewind->Count; i++) {
+    used += rewind->Records[(rewind->First + i) % rewind->MaxFrames].Size;
+  }
+  return used;
+}
+
+void rewindDestroy(Rewind *rewind) {
+  if (rewind == NULL) {
+    return;
+  }
+  free(rewind->Buffer);
+  free(rewind->Records);
+  free(rewind->Keyframe);
+  free(rewind->State);
+  free(rewind->Delta);
+  free(rewind);
+}
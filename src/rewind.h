@@ -0,0 +1,33 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "nes.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// The last few seconds of a machine's states, one per frame, in a buffer of
+// fixed size. Every KeyframeInterval frames a whole save state is stored;
+// the frames in between only store the runs of bytes that differ from that
+// keyframe, which for a running game is a few hundred bytes. When the buffer
+// or the frame limit is full, the oldest keyframe is dropped along with the
+// frames that depend on it.
+typedef struct Rewind Rewind;
+
+// Half a second at 60 frames per second
+#define REWIND_KEYFRAME_INTERVAL 30
+
+// Keeps at most maxFrames frames in memoryBudget bytes. Returns NULL if
+// memoryBudget can't hold two keyframes, or when out of memory.
+Rewind *rewindCreate(NesMachine *machine, size_t memoryBudget,
+                     size_t maxFrames, int keyframeInterval);
+// Call once per frame, after running it
+bool rewindCapture(Rewind *rewind, NesMachine *machine);
+// Puts the machine back to the newest stored frame and forgets that frame,
+// so calling it every frame plays the game backwards. Returns false when
+// there is nothing left.
+bool rewindStep(Rewind *rewind, NesMachine *machine);
+size_t rewindFrameCount(const Rewind *rewind);
+size_t rewindBytesUsed(const Rewind *rewind);
+void rewindDestroy(Rewind *rewind);
+
+#endif
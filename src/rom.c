@@ -0,0 +1,130 @@
+#include "rom.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct RomImage {
+  const uint8_t *Data;
+  size_t Size;
+  NesHeader Header;
+  // Data is a mapping of the file, otherwise it was malloc'd
+  bool Mapped;
+  atomic_int References;
+};
+
+const char *checkRom(const uint8_t *data, size_t size, NesHeader *header) {
+  if (!parseNesHeader(data, size, header)) {
+    return "Not an iNES file.";
+  }
+  if (header->PrgRomSize == 0) {
+    return "The header declares no PRG ROM.";
+  }
+  // NES 2.0 can size ROM to the byte, but PRG is only ever switched and
+  // mirrored in 8KiB banks
+  if (header->PrgRomSize % PRG_WINDOW_SIZE != 0) {
+    return "The PRG ROM is not a whole number of 8KiB banks.";
+  }
+  if (prgRomOffset(header) + header->PrgRomSize + header->ChrRomSize > size) {
+    return "The file is smaller than its header says.";
+  }
+  return NULL;
+}
+
+static RomImage *newImage(const uint8_t *data, size_t size,
+                          const NesHeader *header, bool mapped) {
+  RomImage *image = malloc(sizeof(RomImage));
+  if (image != NULL) {
+    image->Data = data;
+    image->Size = size;
+    image->Header = *header;
+    image->Mapped = mapped;
+    atomic_init(&image->References, 1);
+  }
+  return image;
+}
+
+static RomImage *fail(const char **error, const char *message) {
+  if (error != NULL) {
+    *error = message;
+  }
+  return NULL;
+}
+
+RomImage *romImageOpen(const char *fileName, const char **error) {
+  int file = open(fileName, O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    return fail(error, "File not found.");
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode)) {
+    close(file);
+    return fail(error, "Not a regular file.");
+  }
+  size_t size = status.st_size;
+  if (size < INES_HEADER_SIZE) {
+    close(file);
+    return fail(error, "File is too small to hold an iNES header.");
+  }
+  // The mapping keeps the file referenced, so the descriptor can go
+  void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if (data == MAP_FAILED) {
+    return fail(error, "Could not map the file.");
+  }
+  NesHeader header;
+  const char *problem = checkRom(data, size, &header);
+  RomImage *image =
+      problem == NULL ? newImage(data, size, &header, true) : NULL;
+  if (image == NULL) {
+    munmap(data, size);
+    return fail(error, problem != NULL ? problem : "Out of memory.");
+  }
+  return image;
+}
+
+RomImage *romImageCopy(const uint8_t *data, size_t size, const char **error) {
+  NesHeader header;
+  const char *problem = checkRom(data, size, &header);
+  if (problem != NULL) {
+    return fail(error, problem);
+  }
+  uint8_t *copy = malloc(size);
+  RomImage *image = copy != NULL ? newImage(copy, size, &header, false) : NULL;
+  if (image == NULL) {
+    free(copy);
+    return fail(error, "Out of memory.");
+  }
+  memcpy(copy, data, size);
+  return image;
+}
+
+RomImage *romImageRetain(RomImage *image) {
+  atomic_fetch_add_explicit(&image->References, 1, memory_order_relaxed);
+  return image;
+}
+
+void romImageRelease(RomImage *image) {
+  if (image == NULL || atomic_fetch_sub_explicit(&image->References, 1,
+                                                 memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (image->Mapped) {
+    munmap((void *)image->Data, image->Size);
+  } else {
+    free((void *)image->Data);
+  }
+  free(image);
+}
+
+const uint8_t *romImageData(const RomImage *image) { return image->Data; }
+
+size_t romImageSize(const RomImage *image) { return image->Size; }
+
+const NesHeader *romImageHeader(const RomImage *image) {
+  return &image->Header;
+}
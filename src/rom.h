@@ -0,0 +1,32 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include "ines.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// The bytes of an iNES file, header included, shared read-only by every
+// machine that runs it. Images opened from a file are memory mapped, so the
+// PRG and CHR data is paged in from the page cache as it is used, and all
+// the machines of a process (and other processes running the same file)
+// share one copy of it. An image lives until its last reference is released
+// and may be shared between threads. A ROM file must not be truncated while
+// it is open.
+typedef struct RomImage RomImage;
+
+// Maps fileName read-only. Returns NULL if the file can't be mapped or is not
+// a usable iNES image; error then says why, if it is not NULL.
+RomImage *romImageOpen(const char *fileName, const char **error);
+// Copies an iNES image that is already in memory
+RomImage *romImageCopy(const uint8_t *data, size_t size, const char **error);
+RomImage *romImageRetain(RomImage *image);
+void romImageRelease(RomImage *image);
+const uint8_t *romImageData(const RomImage *image);
+size_t romImageSize(const RomImage *image);
+const NesHeader *romImageHeader(const RomImage *image);
+
+// Parses the header of data into header. Returns NULL if data holds all the
+// PRG and CHR ROM the header promises, or else what is wrong with it.
+const char *checkRom(const uint8_t *data, size_t size, NesHeader *header);
+
+#endif
@@ -0,0 +1,296 @@
+#include "romcache.h"
+#include "rom.h"
+#include "utilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Version 1 of the cache file, in native byte order: the magic, a record
+// count, then per record the path length and path, file size, modification
+// time in nanoseconds, a usable flag, the 16 header bytes and the two
+// hashes. The raw header is kept rather than NesHeader, so the format does
+// not change when NesHeader does; decoding 16 bytes costs nothing next to
+// opening the file.
+static const char cacheMagic[8] = "NESROMC1";
+
+typedef struct {
+  char *Path;
+  uint64_t Size;
+  int64_t ModifiedNs;
+  bool Usable;
+  uint8_t Header[INES_HEADER_SIZE];
+  uint64_t PrgHash;
+  uint64_t ChrHash;
+} CacheEntry;
+
+struct RomCache {
+  char *FileName;
+  // Open addressing hash table on Path, Capacity is a power of two
+  CacheEntry *Entries;
+  uint32_t Capacity;
+  uint32_t Count;
+  bool Dirty;
+};
+
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+  return value << bits | value >> (64 - bits);
+}
+
+// Each word goes through its own multiply before it is folded in, which
+// keeps the chain between iterations to a xor, a rotate and a multiply.
+uint64_t hashRomData(const uint8_t *data, size_t size) {
+  const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+  const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+  uint64_t hash = size * prime1;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = rotateLeft(hash ^ (word * prime2), 31) * prime1;
+  }
+  for (; i < size; i++) {
+    hash = rotateLeft(hash ^ (data[i] * prime2), 11) * prime1;
+  }
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  return hash;
+}
+
+// Returns the entry for path, or the empty slot it would go in
+static CacheEntry *findEntry(CacheEntry *entries, uint32_t capacity,
+                             const char *path) {
+  uint32_t slot =
+      hashBytes((const uint8_t *)path, strlen(path)) & (capacity - 1);
+  while (entries[slot].Path != NULL && strcmp(entries[slot].Path, path) != 0) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &entries[slot];
+}
+
+// Keeps the table at most half full
+static bool reserve(RomCache *cache, uint32_t count) {
+  if (count * 2 <= cache->Capacity) {
+    return true;
+  }
+  uint32_t capacity = cache->Capacity;
+  while (count * 2 > capacity) {
+    capacity *= 2;
+  }
+  CacheEntry *entries = calloc(capacity, sizeof(CacheEntry));
+  if (entries == NULL) {
+    return false;
+  }
+  for (uint32_t i = 0; i < cache->Capacity; i++) {
+    if (cache->Entries[i].Path != NULL) {
+      *findEntry(entries, capacity, cache->Entries[i].Path) =
+          cache->Entries[i];
+    }
+  }
+  free(cache->Entries);
+  cache->Entries = entries;
+  cache->Capacity = capacity;
+  return true;
+}
+
+// Takes ownership of entry->Path
+static bool insertEntry(RomCache *cache, CacheEntry *entry) {
+  if (!reserve(cache, cache->Count + 1)) {
+    return false;
+  }
+  CacheEntry *slot = findEntry(cache->Entries, cache->Capacity, entry->Path);
+  if (slot->Path != NULL) {
+    free(slot->Path);
+  } else {
+    cache->Count++;
+  }
+  *slot = *entry;
+  return true;
+}
+
+static bool readRecord(FILE *file, CacheEntry *entry) {
+  uint32_t pathLength;
+  if (fread(&pathLength, sizeof(pathLength), 1, file) != 1 ||
+      pathLength > 4096) {
+    return false;
+  }
+  entry->Path = malloc(pathLength + 1);
+  if (entry->Path == NULL) {
+    return false;
+  }
+  entry->Path[pathLength] = '\0';
+  if (fread(entry->Path, 1, pathLength, file) == pathLength &&
+      fread(&entry->Size, sizeof(entry->Size), 1, file) == 1 &&
+      fread(&entry->ModifiedNs, sizeof(entry->ModifiedNs), 1, file) == 1 &&
+      fread(&entry->Usable, sizeof(entry->Usable), 1, file) == 1 &&
+      fread(entry->Header, sizeof(entry->Header), 1, file) == 1 &&
+      fread(&entry->PrgHash, sizeof(entry->PrgHash), 1, file) == 1 &&
+      fread(&entry->ChrHash, sizeof(entry->ChrHash), 1, file) == 1) {
+    return true;
+  }
+  free(entry->Path);
+  return false;
+}
+
+static void loadCacheFile(RomCache *cache) {
+  FILE *file = fopen(cache->FileName, "rb");
+  if (file == NULL) {
+    return;
+  }
+  char magic[sizeof(cacheMagic)];
+  uint32_t count;
+  if (fread(magic, sizeof(magic), 1, file) == 1 &&
+      memcmp(magic, cacheMagic, sizeof(magic)) == 0 &&
+      fread(&count, sizeof(count), 1, file) == 1 && count <= 1u << 24 &&
+      reserve(cache, count)) {
+    // A truncated file keeps the records that made it
+    CacheEntry entry;
+    for (uint32_t i = 0; i < count && readRecord(file, &entry); i++) {
+      if (!insertEntry(cache, &entry)) {
+        free(entry.Path);
+        break;
+      }
+    }
+  }
+  fclose(file);
+}
+
+RomCache *romCacheOpen(const char *cacheFile) {
+  RomCache *cache = calloc(1, sizeof(RomCache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->Capacity = 64;
+  cache->Entries = calloc(cache->Capacity, sizeof(CacheEntry));
+  cache->FileName = strdup(cacheFile);
+  if (cache->Entries == NULL || cache->FileName == NULL) {
+    romCacheClose(cache);
+    return NULL;
+  }
+  loadCacheFile(cache);
+  return cache;
+}
+
+static void fillInfo(const CacheEntry *entry, RomInfo *info) {
+  parseNesHeader(entry->Header, entry->Size, &info->Header);
+  info->PrgHash = entry->PrgHash;
+  info->ChrHash = entry->ChrHash;
+}
+
+bool romCacheLookup(RomCache *cache, const char *fileName, RomInfo *info) {
+  struct stat status;
+  if (stat(fileName, &status) != 0) {
+    return false;
+  }
+  int64_t modifiedNs =
+      (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+  CacheEntry *cached = findEntry(cache->Entries, cache->Capacity, fileName);
+  if (cached->Path != NULL && cached->Size == (uint64_t)status.st_size &&
+      cached->ModifiedNs == modifiedNs) {
+    if (cached->Usable) {
+      fillInfo(cached, info);
+    }
+    return cached->Usable;
+  }
+
+  CacheEntry entry = {0};
+  entry.Size = status.st_size;
+  entry.ModifiedNs = modifiedNs;
+  RomImage *image = romImageOpen(fileName, NULL);
+  if (image != NULL) {
+    const uint8_t *data = romImageData(image);
+    const NesHeader *header = romImageHeader(image);
+    const uint8_t *prgRom = data + prgRomOffset(header);
+    entry.Usable = true;
+    memcpy(entry.Header, data, INES_HEADER_SIZE);
+    entry.PrgHash = hashRomData(prgRom, header->PrgRomSize);
+    entry.ChrHash =
+        hashRomData(prgRom + header->PrgRomSize, header->ChrRomSize);
+    romImageRelease(image);
+  }
+  entry.Path = strdup(fileName);
+  if (entry.Path != NULL && insertEntry(cache, &entry)) {
+    cache->Dirty = true;
+  } else {
+    free(entry.Path);
+  }
+  if (entry.Usable) {
+    fillInfo(&entry, info);
+  }
+  return entry.Usable;
+}
+
+void romCacheForEach(RomCache *cache,
+                     void (*visit)(void *context, const char *fileName,
+                                   const RomInfo *info),
+                     void *context) {
+  for (uint32_t i = 0; i < cache->Capacity; i++) {
+    CacheEntry *entry = &cache->Entries[i];
+    if (entry->Path != NULL && entry->Usable) {
+      RomInfo info;
+      fillInfo(entry, &info);
+      visit(context, entry->Path, &info);
+    }
+  }
+}
+
+static bool writeRecord(FILE *file, const CacheEntry *entry) {
+  uint32_t pathLength = strlen(entry->Path);
+  return fwrite(&pathLength, sizeof(pathLength), 1, file) == 1 &&
+         fwrite(entry->Path, 1, pathLength, file) == pathLength &&
+         fwrite(&entry->Size, sizeof(entry->Size), 1, file) == 1 &&
+         fwrite(&entry->ModifiedNs, sizeof(entry->ModifiedNs), 1, file) ==
+             1 &&
+         fwrite(&entry->Usable, sizeof(entry->Usable), 1, file) == 1 &&
+         fwrite(entry->Header, sizeof(entry->Header), 1, file) == 1 &&
+         fwrite(&entry->PrgHash, sizeof(entry->PrgHash), 1, file) == 1 &&
+         fwrite(&entry->ChrHash, sizeof(entry->ChrHash), 1, file) == 1;
+}
+
+bool romCacheSave(RomCache *cache) {
+  if (!cache->Dirty) {
+    return true;
+  }
+  size_t nameLength = strlen(cache->FileName);
+  char *temporaryName = malloc(nameLength + 5);
+  if (temporaryName == NULL) {
+    return false;
+  }
+  memcpy(temporaryName, cache->FileName, nameLength);
+  memcpy(temporaryName + nameLength, ".tmp", 5);
+  FILE *file = fopen(temporaryName, "wb");
+  bool ok = file != NULL &&
+            fwrite(cacheMagic, sizeof(cacheMagic), 1, file) == 1 &&
+            fwrite(&cache->Count, sizeof(cache->Count), 1, file) == 1;
+  for (uint32_t i = 0; ok && i < cache->Capacity; i++) {
+    if (cache->Entries[i].Path != NULL) {
+      ok = writeRecord(file, &cache->Entries[i]);
+    }
+  }
+  if (file != NULL && fclose(file) != 0) {
+    ok = false;
+  }
+  if (ok && rename(temporaryName, cache->FileName) == 0) {
+    cache->Dirty = false;
+  } else {
+    remove(temporaryName);
+    ok = false;
+  }
+  free(temporaryName);
+  return ok;
+}
+
+void romCacheClose(RomCache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  if (cache->Entries != NULL) {
+    for (uint32_t i = 0; i < cache->Capacity; i++) {
+      free(cache->Entries[i].Path);
+    }
+  }
+  free(cache->Entries);
+  free(cache->FileName);
+  free(cache);
+}
@@ -0,0 +1,43 @@
+#ifndef ROMCACHE_H
+#define ROMCACHE_H
+
+#include "ines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// What is known about a ROM file without running it
+typedef struct {
+  NesHeader Header;
+  uint64_t PrgHash;
+  uint64_t ChrHash;
+} RomInfo;
+
+// A fast 64 bit hash, 8 bytes at a time. Not cryptographic; it tells dumps
+// apart, it doesn't authenticate them.
+uint64_t hashRomData(const uint8_t *data, size_t size);
+
+// ROM metadata kept on disk between runs, keyed by path and checked against
+// the file's size and modification time. Files that are not usable ROMs are
+// remembered too, so rescanning a folder doesn't open them again. A cache
+// must not be used from two threads at once.
+typedef struct RomCache RomCache;
+
+// Loads cacheFile. A missing or unreadable cache file gives an empty cache.
+// Returns NULL only when out of memory.
+RomCache *romCacheOpen(const char *cacheFile);
+// Fills info for fileName, from the cache when the file is unchanged and by
+// mapping, parsing and hashing it otherwise. Returns false if the file is
+// missing or not a usable iNES image.
+bool romCacheLookup(RomCache *cache, const char *fileName, RomInfo *info);
+// Calls visit for every usable ROM in the cache, as it was when last looked
+// up. Nothing is checked against the file system.
+void romCacheForEach(RomCache *cache,
+                     void (*visit)(void *context, const char *fileName,
+                                   const RomInfo *info),
+                     void *context);
+// Writes the cache back if anything changed. The file is replaced in one
+// rename, so a crash never leaves half a cache behind.
+bool romCacheSave(RomCache *cache);
+void romCacheClose(RomCache *cache);
+
+#endif
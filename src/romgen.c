@@ -0,0 +1,299 @@
+// Writes random NROM programs for the regression tests. Every documented
+// opcode shows up in its addressing modes, with operands in RAM, PRG RAM,
+// ROM and, with --io, the I/O registers, between forward branches, short
+// loops, subroutine calls and an NMI handler. Like a game, the main loop
+// waits for the NMI on every pass, so the idle loop detector has something
+// to find. PHP leaves the flags on the stack, where the RAM hash that
+// headless.out prints covers them. The same seed always gives the same ROM.
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BLOCKS 120
+#define PROGRAM_START 0x8000
+#define PRG_SIZE 0x8000
+#define CHR_SIZE 0x2000
+// Room kept free for the end of the main loop, the subroutine, the NMI
+// handler and the vectors
+#define PRG_RESERVE 0x200
+
+// Zero page the random code leaves alone, unless an index takes it there:
+// the frame counter the NMI handler increments and the pointers of the
+// indirect modes
+#define RANDOM_ZERO_PAGE 0xE0
+#define FRAME_COUNTER 0xEF
+#define POINTERS 0xF0
+#define POINTER_COUNT 6
+#define MAX_CALLS 1024
+
+typedef struct {
+  uint8_t Prg[PRG_SIZE];
+  uint16_t Size;
+  uint64_t Random;
+  bool Io;
+  // Where each JSR's operand goes once the subroutine is placed
+  uint16_t Calls[MAX_CALLS];
+  int CallCount;
+} Program;
+
+void printUsage(char *program) {
+  printf("Usage: %s <out.nes> <seed> [--io] [--blocks N]\n", program);
+  printf("Writes a main loop of %d random blocks unless told otherwise.\n",
+         DEFAULT_BLOCKS);
+}
+
+// xorshift64*, so the ROMs don't depend on the C library
+uint32_t nextRandom(Program *program) {
+  program->Random ^= program->Random >> 12;
+  program->Random ^= program->Random << 25;
+  program->Random ^= program->Random >> 27;
+  return (program->Random * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+int randomBelow(Program *program, int n) { return nextRandom(program) % n; }
+
+void put(Program *program, uint8_t byte) {
+  program->Prg[program->Size++] = byte;
+}
+
+void putWord(Program *program, uint16_t word) {
+  put(program, word & 0xFF);
+  put(program, word >> 8);
+}
+
+uint16_t here(const Program *program) { return PROGRAM_START + program->Size; }
+
+// Mostly RAM, where the results end up in the hash
+uint16_t randomAddress(Program *program) {
+  int choice = randomBelow(program, 100);
+  if (program->Io && choice < 5) {
+    static const uint16_t registers[] = {0x2002, 0x2007, 0x4015, 0x4016};
+    return registers[randomBelow(program, 4)];
+  }
+  if (choice < 10) {
+    return PROGRAM_START + randomBelow(program, PRG_SIZE);
+  }
+  if (choice < 20) {
+    return 0x6000 + randomBelow(program, 0x2000);
+  }
+  return 0x0200 + randomBelow(program, NES_RAM_SIZE - 0x0200);
+}
+
+// Instructions that change the flow or the stack pointer are placed by the
+// generator itself, not picked at random
+bool isRandomOpcode(uint8_t opcode) {
+  static const uint8_t excluded[] = {0x00, 0x20, 0x40, 0x4C, 0x6C,
+                                     0x60, 0x9A, 0x48, 0x68, 0x08, 0x28};
+  if (strcmp(getInstructionName(opcode), "???") == 0 ||
+      getAddressingMode(opcode) == ModeRelative) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(excluded); i++) {
+    if (opcode == excluded[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// LDX, TAX, TSX, INX and DEX, which would upset the count of a loop on X
+bool writesX(uint8_t opcode) {
+  return opcode == 0xA2 || opcode == 0xA6 || opcode == 0xAE ||
+         opcode == 0xB6 || opcode == 0xBE || opcode == 0xAA ||
+         opcode == 0xBA || opcode == 0xE8 || opcode == 0xCA;
+}
+
+void putRandomInstruction(Program *program, bool keepX) {
+  // One in ten is a balanced push and pull: PHA / PLA, PHP / PLP, or PHP /
+  // PLA to look at the flags
+  if (randomBelow(program, 10) == 0) {
+    static const uint8_t pairs[][2] = {
+        {0x48, 0x68}, {0x08, 0x28}, {0x08, 0x68}};
+    int pair = randomBelow(program, 3);
+    put(program, pairs[pair][0]);
+    put(program, pairs[pair][1]);
+    return;
+  }
+  uint8_t opcode;
+  do {
+    opcode = nextRandom(program);
+  } while (!isRandomOpcode(opcode) || (keepX && writesX(opcode)));
+  put(program, opcode);
+  switch (getAddressingMode(opcode)) {
+  case ModeImmediate:
+    put(program, nextRandom(program));
+    break;
+  case ModeZeroPage:
+  case ModeZeroPageX:
+  case ModeZeroPageY:
+    put(program, randomBelow(program, RANDOM_ZERO_PAGE));
+    break;
+  case ModeIndirectX:
+  case ModeIndirectY:
+    put(program, POINTERS + 2 * randomBelow(program, POINTER_COUNT));
+    break;
+  case ModeAbsolute:
+  case ModeAbsoluteX:
+  case ModeAbsoluteY:
+    putWord(program, randomAddress(program));
+    break;
+  default:
+    break;
+  }
+}
+
+void putRandomInstructions(Program *program, int count, bool keepX) {
+  for (int i = 0; i < count; i++) {
+    putRandomInstruction(program, keepX);
+  }
+}
+
+// A run of random instructions, ended by a branch over a few more, a call
+// or a short loop on X
+void putBlock(Program *program) {
+  putRandomInstructions(program, 1 + randomBelow(program, 19), false);
+  int ending = randomBelow(program, 20);
+  if (ending < 10) {
+    uint8_t branch = 0x10 + 0x20 * randomBelow(program, 8);
+    put(program, branch);
+    uint16_t offset = program->Size;
+    put(program, 0);
+    putRandomInstructions(program, randomBelow(program, 4), false);
+    program->Prg[offset] = program->Size - offset - 1;
+  } else if (ending < 12) {
+    put(program, 0x20);
+    program->Calls[program->CallCount++] = program->Size;
+    putWord(program, 0);
+  } else if (ending < 13) {
+    put(program, 0xA2);
+    put(program, 1 + randomBelow(program, 5));
+    uint16_t top = program->Size;
+    putRandomInstructions(program, 1 + randomBelow(program, 4), true);
+    put(program, 0xCA);
+    int offset = top - (program->Size + 2);
+    if (offset >= -128) {
+      put(program, 0xD0);
+      put(program, offset & 0xFF);
+    }
+  }
+}
+
+void buildProgram(Program *program, int blocks) {
+  static const uint16_t pointers[POINTER_COUNT] = {0x0300, 0x04F0, 0x6100,
+                                                   0x0701, 0x8000, 0x0200};
+  // Reset: stack, pointers, then the NMI on
+  put(program, 0x78);
+  put(program, 0xD8);
+  put(program, 0xA2);
+  put(program, 0xFF);
+  put(program, 0x9A);
+  for (int i = 0; i < POINTER_COUNT; i++) {
+    uint16_t pointer = program->Io && i == POINTER_COUNT - 1 ? 0x2002
+                                                             : pointers[i];
+    put(program, 0xA9);
+    put(program, pointer & 0xFF);
+    put(program, 0x85);
+    put(program, POINTERS + 2 * i);
+    put(program, 0xA9);
+    put(program, pointer >> 8);
+    put(program, 0x85);
+    put(program, POINTERS + 2 * i + 1);
+  }
+  put(program, 0xA9);
+  put(program, 0x80);
+  put(program, 0x8D);
+  putWord(program, 0x2000);
+
+  uint16_t loop = here(program);
+  for (int i = 0; i < blocks && program->Size < PRG_SIZE - PRG_RESERVE &&
+                  program->CallCount < MAX_CALLS;
+       i++) {
+    putBlock(program);
+  }
+  // Turns the NMI back on, in case a random store turned it off, then waits
+  // for vblank and for the NMI to move the frame counter on
+  put(program, 0xA9);
+  put(program, 0x80);
+  put(program, 0x8D);
+  putWord(program, 0x2000);
+  if (program->Io) {
+    put(program, 0x2C);
+    putWord(program, 0x2002);
+    put(program, 0x10);
+    put(program, 0xFB);
+  }
+  put(program, 0xA5);
+  put(program, FRAME_COUNTER);
+  put(program, 0xC5);
+  put(program, FRAME_COUNTER);
+  put(program, 0xF0);
+  put(program, 0xFC);
+  put(program, 0x4C);
+  putWord(program, loop);
+
+  uint16_t subroutine = here(program);
+  putRandomInstructions(program, 1 + randomBelow(program, 9), false);
+  put(program, 0x60);
+  for (int i = 0; i < program->CallCount; i++) {
+    program->Prg[program->Calls[i]] = subroutine & 0xFF;
+    program->Prg[program->Calls[i] + 1] = subroutine >> 8;
+  }
+
+  // The NMI handler keeps the registers
+  uint16_t nmi = here(program);
+  static const uint8_t save[] = {0x48, 0x8A, 0x48, 0x98, 0x48};
+  static const uint8_t restore[] = {0x68, 0xA8, 0x68, 0xAA, 0x68, 0x40};
+  for (size_t i = 0; i < sizeof(save); i++) {
+    put(program, save[i]);
+  }
+  put(program, 0xE6);
+  put(program, FRAME_COUNTER);
+  putRandomInstructions(program, 10, false);
+  for (size_t i = 0; i < sizeof(restore); i++) {
+    put(program, restore[i]);
+  }
+
+  program->Size = PRG_SIZE - 6;
+  putWord(program, nmi);
+  putWord(program, PROGRAM_START);
+  putWord(program, PROGRAM_START);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  static Program program;
+  program.Random = strtoull(argv[2], NULL, 10) * 2 + 1;
+  int blocks = DEFAULT_BLOCKS;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--io") == 0) {
+      program.Io = true;
+    } else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+      blocks = atoi(argv[++i]);
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  buildProgram(&program, blocks);
+
+  static const uint8_t header[16] = {'N', 'E', 'S', 0x1A, PRG_SIZE / 0x4000,
+                                     CHR_SIZE / 0x2000};
+  static const uint8_t chr[CHR_SIZE];
+  FILE *file = fopen(argv[1], "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not create %s\n", argv[1]);
+    return 1;
+  }
+  bool written = fwrite(header, sizeof(header), 1, file) == 1 &&
+                 fwrite(program.Prg, PRG_SIZE, 1, file) == 1 &&
+                 fwrite(chr, CHR_SIZE, 1, file) == 1;
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Could not write %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
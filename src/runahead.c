@@ -0,0 +1,51 @@
+#include "runahead.h"
+#include <stdlib.h>
+
+struct RunAhead {
+  int Frames;
+  // Where the machine really is, between the real frame and the ones run
+  // ahead of it
+  uint8_t *State;
+  size_t StateSize;
+};
+
+RunAhead *runAheadCreate(NesMachine *machine, int frames) {
+  RunAhead *runAhead = calloc(1, sizeof(RunAhead));
+  if (runAhead == NULL) {
+    return NULL;
+  }
+  runAhead->Frames = frames > 0 ? frames : 0;
+  runAhead->StateSize = nesMachineStateSize(machine);
+  runAhead->State = malloc(runAhead->StateSize);
+  if (runAhead->State == NULL) {
+    free(runAhead);
+    return NULL;
+  }
+  return runAhead;
+}
+
+uint64_t runAheadFrame(RunAhead *runAhead, NesMachine *machine,
+                       FrameCallback present, void *context) {
+  uint64_t instructions = nesMachineRunFrames(machine, 1);
+  if (runAhead->Frames == 0) {
+    if (present != NULL) {
+      present(context, machine);
+    }
+    return instructions;
+  }
+  nesMachineSaveState(machine, runAhead->State, runAhead->StateSize);
+  instructions += nesMachineRunFrames(machine, runAhead->Frames);
+  if (present != NULL) {
+    present(context, machine);
+  }
+  nesMachineLoadState(machine, runAhead->State, runAhead->StateSize);
+  return instructions;
+}
+
+void runAheadDestroy(RunAhead *runAhead) {
+  if (runAhead == NULL) {
+    return;
+  }
+  free(runAhead->State);
+  free(runAhead);
+}
@@ -0,0 +1,26 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include "nes.h"
+#include <stdint.h>
+
+// Run-ahead hides the frames of lag a game has between reading the
+// controller and showing the result. Each frame of real time, the machine
+// runs its one real frame, is saved, then runs Frames more with the same
+// input, the last of which is shown, and is put back to the saved state.
+// The frames run ahead must not react to anything that lasts longer than
+// the frame: only the shown one reaches present, so only it is rendered.
+typedef struct RunAhead RunAhead;
+
+// Called with the machine as it is at the end of the shown frame
+typedef void (*FrameCallback)(void *context, NesMachine *machine);
+
+// Returns NULL when out of memory. frames can be 0, which just runs frames.
+RunAhead *runAheadCreate(NesMachine *machine, int frames);
+// Runs one frame of real time with the buttons set on the machine. present
+// may be NULL. Returns the number of instructions executed, shown or not.
+uint64_t runAheadFrame(RunAhead *runAhead, NesMachine *machine,
+                       FrameCallback present, void *context);
+void runAheadDestroy(RunAhead *runAhead);
+
+#endif
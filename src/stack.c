@@ -1,23 +1,257 @@
-#include <stdio.h>
+// Shadow call stack and subroutine profile. Only built when NES_PROFILE is
+// enabled.
 #include "stack.h"
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
 
-void initStack(Stack *s){
-	s->stackPointer = s->stack - 1;
+#define CALL_ADDRESSES 0x10000
+// The main frame is below every real one: no return brings S above $FF
+#define MAIN_FRAME_BASE 0x100
+#define NO_NODE UINT32_MAX
+
+typedef struct {
+  uint32_t Node;
+  uint16_t Base;
+  uint16_t Entry;
+  uint64_t Start;
+} CallFrame;
+
+// A distinct chain of calls, a node of the call tree
+typedef struct {
+  uint32_t Parent;
+  uint32_t FirstChild;
+  uint32_t NextSibling;
+  uint16_t Entry;
+  uint8_t Kind;
+  uint64_t Cycles;
+} CallNode;
+
+struct CallStack {
+  CallFrame Frames[CALL_STACK_DEPTH];
+  int Depth;
+  // Calls that didn't fit, their cycles go to the frame below
+  uint64_t Dropped;
+  // When the top frame last got its cycles
+  uint64_t Credited;
+
+  CallNode *Nodes;
+  uint32_t NodeCount;
+  uint32_t NodeCapacity;
+
+  // Per entry address
+  uint64_t Calls[CALL_ADDRESSES];
+  uint64_t Inclusive[CALL_ADDRESSES];
+  uint64_t Exclusive[CALL_ADDRESSES];
+  uint8_t Kind[CALL_ADDRESSES];
+};
+
+static uint32_t addNode(CallStack *stack, uint32_t parent, FrameKind kind,
+                        uint16_t entry) {
+  if (stack->NodeCount == stack->NodeCapacity) {
+    uint32_t capacity =
+        stack->NodeCapacity == 0 ? 1024 : stack->NodeCapacity * 2;
+    CallNode *grown = realloc(stack->Nodes, capacity * sizeof(CallNode));
+    if (grown == NULL) {
+      return NO_NODE;
+    }
+    stack->Nodes = grown;
+    stack->NodeCapacity = capacity;
+  }
+  uint32_t index = stack->NodeCount++;
+  CallNode *node = &stack->Nodes[index];
+  node->Parent = parent;
+  node->FirstChild = NO_NODE;
+  node->NextSibling = NO_NODE;
+  node->Entry = entry;
+  node->Kind = kind;
+  node->Cycles = 0;
+  if (parent != NO_NODE) {
+    node->NextSibling = stack->Nodes[parent].FirstChild;
+    stack->Nodes[parent].FirstChild = index;
+  }
+  return index;
+}
+
+static uint32_t findChild(CallStack *stack, uint32_t parent, FrameKind kind,
+                          uint16_t entry) {
+  for (uint32_t child = stack->Nodes[parent].FirstChild; child != NO_NODE;
+       child = stack->Nodes[child].NextSibling) {
+    if (stack->Nodes[child].Entry == entry &&
+        stack->Nodes[child].Kind == kind) {
+      return child;
+    }
+  }
+  return addNode(stack, parent, kind, entry);
+}
+
+// Gives the top frame the cycles since it last got any
+static void credit(CallStack *stack, uint64_t cycles) {
+  CallFrame *top = &stack->Frames[stack->Depth - 1];
+  uint64_t spent = cycles - stack->Credited;
+  stack->Nodes[top->Node].Cycles += spent;
+  stack->Exclusive[top->Entry] += spent;
+  stack->Credited = cycles;
+}
+
+CallStack *callStackCreate(uint16_t pc, uint64_t cycles) {
+  CallStack *stack = calloc(1, sizeof(CallStack));
+  if (stack == NULL) {
+    return NULL;
+  }
+  uint32_t root = addNode(stack, NO_NODE, FrameMain, pc);
+  if (root == NO_NODE) {
+    free(stack);
+    return NULL;
+  }
+  stack->Frames[0] = (CallFrame){root, MAIN_FRAME_BASE, pc, cycles};
+  stack->Depth = 1;
+  stack->Credited = cycles;
+  stack->Calls[pc] = 1;
+  stack->Kind[pc] = FrameMain;
+  return stack;
 }
 
-void pushStack(Stack *s, int value){
-	s->stackPointer++;
-	*(s->stackPointer) = value;
+void callStackDestroy(CallStack *stack) {
+  if (stack == NULL) {
+    return;
+  }
+  free(stack->Nodes);
+  free(stack);
 }
 
-int popStack(Stack *s){
-	if(s->stackPointer < s->stack)
-	{
-		printf("ERROR: Stack underflow detected!\n");
-		return -1;
-	}
-	int value = *(s->stackPointer);
-	s->stackPointer--;
-	return value;
+void callStackEnter(CallStack *stack, FrameKind kind, uint16_t entry,
+                    uint8_t base, uint64_t cycles) {
+  credit(stack, cycles);
+  uint32_t node =
+      stack->Depth < CALL_STACK_DEPTH
+          ? findChild(stack, stack->Frames[stack->Depth - 1].Node, kind, entry)
+          : NO_NODE;
+  if (node == NO_NODE) {
+    stack->Dropped++;
+    return;
+  }
+  stack->Frames[stack->Depth++] = (CallFrame){node, base, entry, cycles};
+  stack->Calls[entry]++;
+  stack->Kind[entry] = kind;
 }
 
+// Whether entry is also on the stack below the top frame, so recursion
+// doesn't count the same cycles twice
+static bool isOuterFrame(CallStack *stack, uint16_t entry) {
+  for (int i = 0; i < stack->Depth - 1; i++) {
+    if (stack->Frames[i].Entry == entry) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void callStackReturn(CallStack *stack, uint8_t s, uint64_t cycles) {
+  credit(stack, cycles);
+  while (stack->Frames[stack->Depth - 1].Base <= s) {
+    CallFrame *top = &stack->Frames[stack->Depth - 1];
+    if (!isOuterFrame(stack, top->Entry)) {
+      stack->Inclusive[top->Entry] += cycles - top->Start;
+    }
+    stack->Depth--;
+  }
+}
+
+static const char *frameName(FrameKind kind) {
+  switch (kind) {
+  case FrameMain:
+    return "main";
+  case FrameNmi:
+    return "nmi";
+  case FrameIrq:
+    return "irq";
+  default:
+    return "sub";
+  }
+}
+
+// Inclusive cycles so far, with what the open frames have taken until now
+static uint64_t *inclusiveUntil(CallStack *stack, uint64_t cycles) {
+  uint64_t *inclusive = malloc(sizeof(stack->Inclusive));
+  if (inclusive == NULL) {
+    return NULL;
+  }
+  memcpy(inclusive, stack->Inclusive, sizeof(stack->Inclusive));
+  for (int i = 0; i < stack->Depth; i++) {
+    bool outer = false;
+    for (int j = 0; j < i; j++) {
+      outer = outer || stack->Frames[j].Entry == stack->Frames[i].Entry;
+    }
+    if (!outer) {
+      inclusive[stack->Frames[i].Entry] += cycles - stack->Frames[i].Start;
+    }
+  }
+  return inclusive;
+}
+
+void callStackReport(CallStack *stack, uint64_t cycles, FILE *file, int top) {
+  credit(stack, cycles);
+  uint64_t *inclusive = inclusiveUntil(stack, cycles);
+  uint32_t *order = NULL;
+  int64_t used = inclusive != NULL ? sortByCycles(stack->Calls, inclusive,
+                                                  CALL_ADDRESSES, &order)
+                                   : -1;
+  if (used < 0) {
+    fprintf(file, "Out of memory for the report\n");
+    free(inclusive);
+    free(order);
+    return;
+  }
+  uint64_t total = 0;
+  for (uint32_t entry = 0; entry < CALL_ADDRESSES; entry++) {
+    total += stack->Exclusive[entry];
+  }
+
+  fprintf(file, "\nSubroutines by inclusive cycles\n");
+  fprintf(file, "%-9s %10s %14s %7s %14s %7s\n", "Entry", "Calls",
+          "Inclusive", "%", "Exclusive", "%");
+  for (int64_t i = 0; i < used && i < top; i++) {
+    uint16_t entry = order[i];
+    fprintf(file, "%s_%04X  %10llu %14llu %6.2f%% %14llu %6.2f%%\n",
+            frameName(stack->Kind[entry]), entry,
+            (unsigned long long)stack->Calls[entry],
+            (unsigned long long)inclusive[entry],
+            total > 0 ? 100.0 * inclusive[entry] / total : 0,
+            (unsigned long long)stack->Exclusive[entry],
+            total > 0 ? 100.0 * stack->Exclusive[entry] / total : 0);
+  }
+  if (stack->Dropped > 0) {
+    fprintf(file, "%llu calls deeper than %d frames were not followed\n",
+            (unsigned long long)stack->Dropped, CALL_STACK_DEPTH);
+  }
+  free(inclusive);
+  free(order);
+}
+
+bool callStackWriteFolded(CallStack *stack, uint64_t cycles, FILE *file) {
+  credit(stack, cycles);
+  for (uint32_t i = 0; i < stack->NodeCount; i++) {
+    if (stack->Nodes[i].Cycles == 0) {
+      continue;
+    }
+    // The chain from the main frame down, at most one node per frame
+    uint32_t chain[CALL_STACK_DEPTH];
+    int length = 0;
+    for (uint32_t node = i; node != NO_NODE && length < CALL_STACK_DEPTH;
+         node = stack->Nodes[node].Parent) {
+      chain[length++] = node;
+    }
+    while (length-- > 0) {
+      CallNode *node = &stack->Nodes[chain[length]];
+      if (node->Kind == FrameMain) {
+        fprintf(file, "main");
+      } else {
+        fprintf(file, "%s_%04X", frameName(node->Kind), node->Entry);
+      }
+      fputc(length > 0 ? ';' : ' ', file);
+    }
+    fprintf(file, "%llu\n", (unsigned long long)stack->Nodes[i].Cycles);
+  }
+  return !ferror(file);
+}
@@ -1,13 +1,67 @@
 #ifndef STACK_H
 #define STACK_H
 
-typedef struct {
-	int stack[64];
-	int* stackPointer;
-} Stack;
-
-void initStack(Stack *s);
-void pushStack(Stack *s, int value);
-int popStack(Stack *s);
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Shadow call stack, part of the profiler (cmake -DNES_PROFILE=ON). JSR and
+// interrupts push a frame, RTS and RTI pop one, and the cycles in between
+// are credited to every 6502 subroutine, with and without the ones it
+// calls, and to every distinct chain of calls for flame graphs.
+//
+// Returns are matched to frames by the stack pointer, not one for one, so
+// code that drops a return address (PLA PLA, then RTS) unwinds both frames,
+// and an RTS used to jump through a pushed address stays in its frame.
+
+#define CALL_STACK_DEPTH 64
+
+typedef enum {
+  // Whatever runs outside any call, from reset on
+  FrameMain,
+  FrameSubroutine,
+  FrameNmi,
+  FrameIrq,
+} FrameKind;
+
+typedef struct CallStack CallStack;
+
+#ifdef NES_PROFILE
+
+// pc and cycles are where the main frame starts
+CallStack *callStackCreate(uint16_t pc, uint64_t cycles);
+void callStackDestroy(CallStack *stack);
+// base is S before the call pushed anything, where returning brings it back
+void callStackEnter(CallStack *stack, FrameKind kind, uint16_t entry,
+                    uint8_t base, uint64_t cycles);
+// s is S after the return pulled its address
+void callStackReturn(CallStack *stack, uint8_t s, uint64_t cycles);
+// Subroutines and interrupt handlers sorted by inclusive cycles, counting
+// the frames still open up to cycles
+void callStackReport(CallStack *stack, uint64_t cycles, FILE *file, int top);
+// One "main;sub_C123;sub_C456 cycles" line per chain of calls, exclusive
+// cycles, the input flamegraph.pl and similar tools take
+bool callStackWriteFolded(CallStack *stack, uint64_t cycles, FILE *file);
+
+#define PROFILE_CALL(cpu, kind, entry, base)                                   \
+  do {                                                                         \
+    if ((cpu)->Calls != NULL) {                                                \
+      callStackEnter((cpu)->Calls, (kind), (entry), (base), (cpu)->Cycles);    \
+    }                                                                          \
+  } while (0)
+
+#define PROFILE_RETURN(cpu)                                                    \
+  do {                                                                         \
+    if ((cpu)->Calls != NULL) {                                                \
+      callStackReturn((cpu)->Calls, (cpu)->S, (cpu)->Cycles);                  \
+    }                                                                          \
+  } while (0)
+
+#else
+
+#define PROFILE_CALL(cpu, kind, entry, base) ((void)0)
+#define PROFILE_RETURN(cpu) ((void)0)
+
+#endif
 
 #endif
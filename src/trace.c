@@ -0,0 +1,117 @@
+// Binary instruction trace. The emulator thread only copies records into a
+// single-producer/single-consumer ring buffer, and a writer thread drains it
+// to disk in large chunks, so tracing never waits on stdio.
+// Only built when NES_TRACE is enabled.
+#include "trace.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Must be a power of two. 65536 records is 1 MiB of buffer.
+#define TRACE_RING_RECORDS 65536
+#define TRACE_RING_MASK (TRACE_RING_RECORDS - 1)
+// How long the writer sleeps when the ring is empty
+#define TRACE_WRITER_IDLE_NS 1000000
+
+struct Trace {
+  TraceRecord Ring[TRACE_RING_RECORDS];
+  // Only the emulator thread moves Head, only the writer thread moves Tail.
+  _Atomic uint64_t Head;
+  _Atomic uint64_t Tail;
+  _Atomic bool Stopping;
+  FILE *File;
+  pthread_t Writer;
+};
+
+// Writes every record between Tail and Head, at most up to the end of the
+// ring per fwrite. Returns false when there was nothing to write.
+static bool flushRing(Trace *trace) {
+  uint64_t tail = atomic_load_explicit(&trace->Tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&trace->Head, memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  while (tail != head) {
+    uint64_t start = tail & TRACE_RING_MASK;
+    uint64_t count = head - tail;
+    if (start + count > TRACE_RING_RECORDS) {
+      count = TRACE_RING_RECORDS - start;
+    }
+    fwrite(&trace->Ring[start], sizeof(TraceRecord), count, trace->File);
+    tail += count;
+    atomic_store_explicit(&trace->Tail, tail, memory_order_release);
+  }
+  return true;
+}
+
+static void *traceWriterThread(void *arg) {
+  Trace *trace = arg;
+  struct timespec idle = {0, TRACE_WRITER_IDLE_NS};
+  while (!atomic_load_explicit(&trace->Stopping, memory_order_acquire)) {
+    if (!flushRing(trace)) {
+      nanosleep(&idle, NULL);
+    }
+  }
+  // The emulator has stopped producing, write out whatever is left.
+  flushRing(trace);
+  return NULL;
+}
+
+Trace *traceOpen(const char *fileName) {
+  FILE *file = fopen(fileName, "wb");
+  if (file == NULL) {
+    printf("Could not open trace file: %s\n", fileName);
+    return NULL;
+  }
+
+  Trace *trace = malloc(sizeof(Trace));
+  if (trace == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  atomic_init(&trace->Head, 0);
+  atomic_init(&trace->Tail, 0);
+  atomic_init(&trace->Stopping, false);
+  trace->File = file;
+
+  uint32_t version = TRACE_FILE_VERSION;
+  uint32_t recordSize = sizeof(TraceRecord);
+  fwrite("NESTRACE", 1, 8, file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&recordSize, sizeof(recordSize), 1, file);
+
+  if (pthread_create(&trace->Writer, NULL, traceWriterThread, trace) != 0) {
+    printf("Could not start the trace writer thread.\n");
+    fclose(file);
+    free(trace);
+    return NULL;
+  }
+  return trace;
+}
+
+void traceClose(Trace *trace) {
+  if (trace == NULL) {
+    return;
+  }
+  atomic_store_explicit(&trace->Stopping, true, memory_order_release);
+  pthread_join(trace->Writer, NULL);
+  fclose(trace->File);
+  free(trace);
+}
+
+void traceRecord(Trace *trace, const TraceRecord *record) {
+  uint64_t head = atomic_load_explicit(&trace->Head, memory_order_relaxed);
+  // The ring only fills up if the disk cannot keep up. Wait for the writer
+  // rather than drop records, since a trace with holes is of little use.
+  while (head - atomic_load_explicit(&trace->Tail, memory_order_acquire) ==
+         TRACE_RING_RECORDS) {
+    sched_yield();
+  }
+  trace->Ring[head & TRACE_RING_MASK] = *record;
+  atomic_store_explicit(&trace->Head, head + 1, memory_order_release);
+}
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Instruction trace, compiled in only when NES_TRACE is defined (cmake
+// -DNES_TRACE=ON). Every executed instruction appends one fixed-size record
+// to a ring buffer, and a background thread writes the buffer to disk.
+//
+// File layout: "NESTRACE", uint32 version, uint32 record size, then one
+// TraceRecord per instruction in host byte order.
+
+#define TRACE_FILE_VERSION 1
+
+// CPU state right before the instruction at PC executes
+typedef struct {
+  uint64_t Cycle;
+  uint16_t PC;
+  uint8_t Opcode;
+  uint8_t A;
+  uint8_t X;
+  uint8_t Y;
+  uint8_t P;
+  uint8_t S;
+} TraceRecord;
+
+typedef struct Trace Trace;
+
+#ifdef NES_TRACE
+
+Trace *traceOpen(const char *fileName);
+void traceClose(Trace *trace);
+void traceRecord(Trace *trace, const TraceRecord *record);
+
+#define TRACE_INSTRUCTION(cpu, opcode)                                         \
+  do {                                                                         \
+    if ((cpu)->Tracer != NULL) {                                               \
+      TraceRecord record = {(cpu)->Cycles, (cpu)->PC, (opcode),                \
+                            (cpu)->A,      (cpu)->X,  (cpu)->Y,                \
+                            getProcessorStatus(cpu), (cpu)->S};                \
+      traceRecord((cpu)->Tracer, &record);                                     \
+    }                                                                          \
+  } while (0)
+
+#else
+
+#define TRACE_INSTRUCTION(cpu, opcode) ((void)0)
+
+#endif
+
+#endif
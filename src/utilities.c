@@ -10,16 +10,48 @@ void resetInputBuffer() {
     ;
 }
 
-int countMatchingFiles(char *directory, char *match) {
+// Counts the entries of directory, hidden ones aside, whose name matches the
+// extended regular expression match, or all of them when match is NULL.
+// Returns -1 if the directory can't be read or match doesn't compile.
+int countMatchingFiles(const char *directory, const char *match) {
+  regex_t pattern;
+  if (match != NULL &&
+      regcomp(&pattern, match, REG_EXTENDED | REG_NOSUB) != 0) {
+    return -1;
+  }
   DIR *d = opendir(directory);
+  if (d == NULL) {
+    if (match != NULL) {
+      regfree(&pattern);
+    }
+    return -1;
+  }
   struct dirent *dir;
 
   int count = 0;
   while ((dir = readdir(d)) != NULL) {
-    if (dir->d_name[0] != '.') {
+    if (dir->d_name[0] != '.' &&
+        (match == NULL || regexec(&pattern, dir->d_name, 0, NULL, 0) == 0)) {
       count++;
     }
   }
   closedir(d);
+  if (match != NULL) {
+    regfree(&pattern);
+  }
   return count;
 }
+
+double secondsSince(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+uint32_t hashBytes(const uint8_t *data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
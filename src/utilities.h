@@ -1,2 +1,16 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
 void resetInputBuffer();
-int countMatchingFiles(char *directory, char *match);
+int countMatchingFiles(const char *directory, const char *match);
+// Seconds of CLOCK_MONOTONIC since start
+double secondsSince(const struct timespec *start);
+// FNV-1a, the hash of RAM batch.out and headless.out print to tell whether
+// two runs ended in the same state
+uint32_t hashBytes(const uint8_t *data, size_t size);
+
+#endif
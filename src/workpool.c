@@ -0,0 +1,122 @@
+#include "workpool.h"
+#include "cpu.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+// The jobs a thread still has to run, Next up to End. The owner takes jobs
+// from the front and thieves take from the back, so they only meet on the
+// lock when the share is nearly empty. Each share has its own cache line.
+typedef struct {
+  alignas(CACHE_LINE_SIZE) pthread_mutex_t Lock;
+  int Next;
+  int End;
+} WorkShare;
+
+typedef struct {
+  WorkShare *Shares;
+  int ShareCount;
+  WorkFunction Work;
+  void *Context;
+} WorkPool;
+
+typedef struct {
+  WorkPool *Pool;
+  int Index;
+  uint64_t Steals;
+  pthread_t Thread;
+} Worker;
+
+static bool takeJob(WorkShare *share, int *job) {
+  pthread_mutex_lock(&share->Lock);
+  bool found = share->Next < share->End;
+  if (found) {
+    *job = share->Next++;
+  }
+  pthread_mutex_unlock(&share->Lock);
+  return found;
+}
+
+// Moves the back half of the first non-empty share after the thief's own
+// into the thief's share. Jobs are never added once the pool runs, so when
+// every share is empty there is nothing left to do.
+static bool stealJobs(Worker *thief) {
+  WorkPool *pool = thief->Pool;
+  WorkShare *own = &pool->Shares[thief->Index];
+  for (int i = 1; i < pool->ShareCount; i++) {
+    WorkShare *victim = &pool->Shares[(thief->Index + i) % pool->ShareCount];
+    pthread_mutex_lock(&victim->Lock);
+    int remaining = victim->End - victim->Next;
+    int first = victim->End - (remaining + 1) / 2;
+    int end = victim->End;
+    victim->End = first;
+    pthread_mutex_unlock(&victim->Lock);
+    if (remaining > 0) {
+      pthread_mutex_lock(&own->Lock);
+      own->Next = first;
+      own->End = end;
+      pthread_mutex_unlock(&own->Lock);
+      thief->Steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *runWorker(void *arg) {
+  Worker *worker = arg;
+  WorkPool *pool = worker->Pool;
+  int job;
+  do {
+    while (takeJob(&pool->Shares[worker->Index], &job)) {
+      pool->Work(pool->Context, job);
+    }
+  } while (stealJobs(worker));
+  return NULL;
+}
+
+bool runWorkStealing(int jobCount, int threadCount, WorkFunction work,
+                     void *context, uint64_t *steals) {
+  if (threadCount < 1) {
+    threadCount = 1;
+  }
+  WorkShare *shares = aligned_alloc(CACHE_LINE_SIZE,
+                                    threadCount * sizeof(WorkShare));
+  Worker *workers = calloc(threadCount, sizeof(Worker));
+  if (shares == NULL || workers == NULL) {
+    free(shares);
+    free(workers);
+    return false;
+  }
+  WorkPool pool = {shares, threadCount, work, context};
+  for (int i = 0; i < threadCount; i++) {
+    pthread_mutex_init(&shares[i].Lock, NULL);
+    shares[i].Next = (int)((int64_t)jobCount * i / threadCount);
+    shares[i].End = (int)((int64_t)jobCount * (i + 1) / threadCount);
+  }
+
+  int started = 0;
+  for (; started < threadCount; started++) {
+    workers[started].Pool = &pool;
+    workers[started].Index = started;
+    if (pthread_create(&workers[started].Thread, NULL, runWorker,
+                       &workers[started]) != 0) {
+      break;
+    }
+  }
+  // If a thread failed to start, the ones that did steal its share
+  uint64_t totalSteals = 0;
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i].Thread, NULL);
+    totalSteals += workers[i].Steals;
+  }
+  for (int i = 0; i < threadCount; i++) {
+    pthread_mutex_destroy(&shares[i].Lock);
+  }
+  free(shares);
+  free(workers);
+  if (steals != NULL) {
+    *steals = totalSteals;
+  }
+  return started > 0;
+}
@@ -0,0 +1,18 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*WorkFunction)(void *context, int job);
+
+// Runs work(context, job) for every job in 0..jobCount-1 on threadCount
+// threads and returns once all of them are done. Each thread starts with an
+// equal, contiguous share of the jobs; a thread that runs out steals half of
+// what is left in another thread's share, so a few long jobs don't leave the
+// other threads idle. steals, if not NULL, receives the number of steals.
+// Returns false if the threads could not be started.
+bool runWorkStealing(int jobCount, int threadCount, WorkFunction work,
+                     void *context, uint64_t *steals);
+
+#endif